@@ -0,0 +1,63 @@
+#include "another-c-library/ac_io.h"
+#include "another-c-library/ac_json.h"
+#include "another-c-library/ac_pool.h"
+#include "another-c-library/ac_timer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("%s <repeat> <file.json> [file2.json] ...\n", argv[0]);
+    return -1;
+  }
+
+  int repeat = atoi(argv[1]);
+  if (repeat < 1)
+    repeat = 1;
+
+  ac_pool_t *pool = ac_pool_init(1024 * 1024);
+  ac_buffer_t *bh = ac_buffer_init(1024);
+  for (int i = 2; i < argc; i++) {
+    size_t length;
+    char *json = ac_io_read_file(&length, argv[i]);
+    if (!json) {
+      printf("%s could not be read\n", argv[i]);
+      continue;
+    }
+
+    /* the parser modifies its input, so each pass parses a fresh copy */
+    char *work = (char *)ac_malloc(length + 1);
+    ac_timer_t *timer = ac_timer_init(repeat);
+    ac_json_t *j = NULL;
+    for (int r = 0; r < repeat; r++) {
+      memcpy(work, json, length + 1);
+      ac_pool_clear(pool);
+      ac_timer_start(timer);
+      j = ac_json_parse(pool, work, work + length);
+      ac_timer_stop(timer);
+    }
+    if (ac_json_is_error(j)) {
+      ac_json_dump_error(stdout, j);
+    } else {
+      /* the checksum of the dumped tree should match across builds */
+      ac_buffer_clear(bh);
+      ac_json_dump_to_buffer(bh, j);
+      uint64_t checksum = 0;
+      char *p = ac_buffer_data(bh);
+      char *ep = ac_buffer_end(bh);
+      while (p < ep)
+        checksum = (checksum * 31) + (unsigned char)*p++;
+      double us = ac_timer_us(timer);
+      printf("%s: %lu bytes, %0.3fus per parse, %0.2f MB/s (checksum %" PRIx64
+             ")\n",
+             argv[i], length, us, us > 0 ? length / us : 0.0, checksum);
+    }
+    ac_timer_destroy(timer);
+    ac_free(work);
+    ac_free(json);
+  }
+  ac_buffer_destroy(bh);
+  ac_pool_destroy(pool);
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include "another-c-library/ac-search/ac_bit_set.h"
+#include "another-c-library/ac_pool.h"
+#include "another-c-library/ac_timer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_SETS 64
+
+static ac_bit_set_t *random_set(ac_pool_t *pool, uint32_t num_items,
+                                uint32_t one_in) {
+  ac_bit_set_t *h = ac_bit_set_init(pool, num_items);
+  for (uint32_t i = 0; i < num_items; i++)
+    if ((rand() % one_in) == 0)
+      ac_bit_set_set(h, i);
+  return h;
+}
+
+static void report(const char *name, ac_timer_t *timer, uint32_t num_items,
+                   uint32_t num_inputs, uint64_t checksum) {
+  double us = ac_timer_us(timer);
+  /* bytes read across all of the inputs */
+  double bytes = (num_items / 8.0) * num_inputs;
+  printf("%-18s %10.3fus %8.2f GB/s (checksum %lu)\n", name, us,
+         us > 0 ? bytes / (us * 1000.0) : 0.0, (unsigned long)checksum);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    printf("%s <num_items> <num_sets> <repeat>\n", argv[0]);
+    return -1;
+  }
+
+  uint32_t num_items = atoi(argv[1]);
+  uint32_t num_sets = atoi(argv[2]);
+  int repeat = atoi(argv[3]);
+  if (num_sets < 2)
+    num_sets = 2;
+  if (num_sets > MAX_SETS)
+    num_sets = MAX_SETS;
+  if (repeat < 1)
+    repeat = 1;
+
+  ac_pool_t *pool = ac_pool_init(1024 * 1024);
+  ac_bit_set_t *sets[MAX_SETS];
+  /* facet filters tend to be dense, so most sets keep about half their bits
+     and a few are selective */
+  srand(0);
+  for (uint32_t i = 0; i < num_sets; i++)
+    sets[i] = random_set(pool, num_items, (i % 4) == 3 ? 64 : 2);
+  ac_bit_set_t *dest = ac_bit_set_init(pool, num_items);
+
+  ac_timer_t *timer = ac_timer_init(repeat);
+  uint64_t checksum = 0;
+  for (int r = 0; r < repeat; r++) {
+    ac_timer_start(timer);
+    checksum += ac_bit_set_count(sets[0]);
+    ac_timer_stop(timer);
+  }
+  report("count", timer, num_items, 1, checksum);
+  ac_timer_destroy(timer);
+
+  const char *names[] = {"and", "or", "not", "and_count"};
+  for (int op = 0; op < 4; op++) {
+    timer = ac_timer_init(repeat);
+    checksum = 0;
+    for (int r = 0; r < repeat; r++) {
+      ac_bit_set_false(dest);
+      ac_bit_set_or(dest, sets[0]);
+      ac_timer_start(timer);
+      if (op == 0)
+        ac_bit_set_and(dest, sets[1]);
+      else if (op == 1)
+        ac_bit_set_or(dest, sets[1]);
+      else if (op == 2)
+        ac_bit_set_not(dest, sets[1]);
+      else
+        checksum += ac_bit_set_and_count(dest, sets[1]);
+      ac_timer_stop(timer);
+      if (op != 3)
+        checksum += ac_bit_set_count(dest);
+    }
+    report(names[op], timer, num_items, 2, checksum);
+    ac_timer_destroy(timer);
+  }
+
+  /* combining every set one at a time vs in one pass */
+  for (int op = 0; op < 4; op++) {
+    timer = ac_timer_init(repeat);
+    checksum = 0;
+    for (int r = 0; r < repeat; r++) {
+      ac_bit_set_false(dest);
+      ac_bit_set_or(dest, sets[0]);
+      ac_timer_start(timer);
+      if (op == 0) {
+        for (uint32_t i = 1; i < num_sets; i++)
+          ac_bit_set_and(dest, sets[i]);
+      } else if (op == 1)
+        ac_bit_set_and_many(dest, sets + 1, num_sets - 1);
+      else if (op == 2) {
+        for (uint32_t i = 1; i < num_sets; i++)
+          ac_bit_set_or(dest, sets[i]);
+      } else
+        ac_bit_set_or_many(dest, sets + 1, num_sets - 1);
+      ac_timer_stop(timer);
+      checksum += ac_bit_set_count(dest);
+    }
+    const char *many_names[] = {"and x N", "and_many", "or x N", "or_many"};
+    report(many_names[op], timer, num_items, num_sets, checksum);
+    ac_timer_destroy(timer);
+  }
+
+  timer = ac_timer_init(repeat);
+  checksum = 0;
+  for (int r = 0; r < repeat; r++) {
+    ac_bit_set_false(dest);
+    ac_bit_set_or(dest, sets[0]);
+    ac_timer_start(timer);
+    checksum += ac_bit_set_count_and_zero(dest);
+    ac_timer_stop(timer);
+  }
+  report("count_and_zero", timer, num_items, 1, checksum);
+  ac_timer_destroy(timer);
+
+  ac_pool_destroy(pool);
+  return 0;
+}
@@ -34,6 +34,8 @@ typedef struct {
   bool lz4;
 
   bool full_record_required;
+  size_t read_ahead;
+  size_t io_uring;
 
   ac_io_compare_cb compare;
   void *compare_arg;
@@ -26,15 +26,21 @@ typedef struct {
   ac_lz4_block_size_t size;
   bool block_checksum;
   bool content_checksum;
+  int lz4_threads;
 
   bool gz;
   bool lz4;
 } ac_out_options_t;
 
+/* called as a sort buffer fills (and empties) with the change in the number of
+   bytes it holds, returning true writes the buffer out early */
+typedef bool (*ac_out_spill_check_cb)(int64_t change, void *arg);
+
 typedef struct {
   /* need to set first block */
   bool use_extra_thread;
   bool lz4_tmp;
+  size_t io_uring;
 
   bool sort_before_partitioning;
   bool sort_while_partitioning;
@@ -43,6 +49,7 @@ typedef struct {
   ac_io_partition_cb partition;
   void *partition_arg;
   size_t num_partitions;
+  ac_io_range_partition_t *range_partition;
 
   ac_io_compare_cb compare;
   void *compare_arg;
@@ -65,4 +72,11 @@ typedef struct {
 
   ac_io_fixed_sort_cb fixed_sort;
   void *fixed_sort_arg;
+
+  ac_out_spill_check_cb spill_check;
+  void *spill_check_arg;
+
+  bool combine;
+  ac_io_hash_cb combine_hash;
+  void *combine_hash_arg;
 } ac_out_ext_options_t;
@@ -0,0 +1,184 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/* One node per value, stored in document order.  An object or array is
+   followed directly by its entries, so the first entry is c+1 and the next
+   sibling is c+skip. */
+struct ac_json_cursor_s {
+  char *key;
+  char *value;
+  uint32_t length; /* string length or number of entries */
+  uint16_t type;
+  uint16_t last; /* last entry of its parent */
+  uint32_t skip; /* nodes in this subtree including this one */
+};
+
+static inline ac_json_type_t ac_json_cursor_type(ac_json_cursor_t *c) {
+  return (ac_json_type_t)(c->type);
+}
+
+static inline bool ac_json_cursor_is_object(ac_json_cursor_t *c) {
+  return c->type == AC_JSON_OBJECT;
+}
+
+static inline bool ac_json_cursor_is_array(ac_json_cursor_t *c) {
+  return c->type == AC_JSON_ARRAY;
+}
+
+static inline uint32_t ac_json_cursor_count(ac_json_cursor_t *c) {
+  if (c && c->type <= AC_JSON_ARRAY)
+    return c->length;
+  return 0;
+}
+
+static inline ac_json_cursor_t *ac_json_cursor_first(ac_json_cursor_t *c) {
+  if (c && c->type <= AC_JSON_ARRAY && c->length)
+    return c + 1;
+  return NULL;
+}
+
+static inline ac_json_cursor_t *ac_json_cursor_next(ac_json_cursor_t *c) {
+  if (!c || c->last)
+    return NULL;
+  return c + c->skip;
+}
+
+static inline char *ac_json_cursor_key(ac_json_cursor_t *c) { return c->key; }
+
+static inline ac_json_cursor_t *ac_json_cursor_scan(ac_json_cursor_t *c,
+                                                    const char *key) {
+  if (!c || c->type != AC_JSON_OBJECT || !c->length)
+    return NULL;
+  c++;
+  while (true) {
+    if (!strcmp(c->key, key))
+      return c;
+    if (c->last)
+      return NULL;
+    c += c->skip;
+  }
+}
+
+static inline ac_json_cursor_t *ac_json_cursor_nth(ac_json_cursor_t *c,
+                                                   uint32_t nth) {
+  if (!c || c->type > AC_JSON_ARRAY || nth >= c->length)
+    return NULL;
+  c++;
+  while (nth) {
+    c += c->skip;
+    nth--;
+  }
+  return c;
+}
+
+static inline ac_json_cursor_t *ac_json_cursor_path(ac_json_cursor_t *c,
+                                                    const char *path) {
+  char key[256];
+  while (c && *path) {
+    const char *ep = strchr(path, '.');
+    size_t len = ep ? (size_t)(ep - path) : strlen(path);
+    if (len >= sizeof(key))
+      return NULL;
+    memcpy(key, path, len);
+    key[len] = 0;
+    if (c->type == AC_JSON_ARRAY) {
+      uint32_t nth = 0;
+      if (sscanf(key, "%u", &nth) != 1)
+        return NULL;
+      c = ac_json_cursor_nth(c, nth);
+    } else
+      c = ac_json_cursor_scan(c, key);
+    path += len;
+    if (*path)
+      path++;
+  }
+  return c;
+}
+
+static inline char *ac_json_cursor_value(ac_json_cursor_t *c) {
+  if (c && c->type >= AC_JSON_STRING)
+    return c->value;
+  return NULL;
+}
+
+static inline char *ac_json_cursor_decode(ac_pool_t *pool,
+                                          ac_json_cursor_t *c) {
+  if (!c)
+    return NULL;
+  else if (c->type == AC_JSON_STRING)
+    return ac_json_decode(pool, c->value, c->length);
+  else if (c->type > AC_JSON_STRING)
+    return c->value;
+  return NULL;
+}
+
+static inline char *ac_json_cursor_binary(ac_json_cursor_t *c,
+                                          size_t *length) {
+  if (c && c->type >= AC_JSON_BINARY) {
+    *length = c->length;
+    return c->value;
+  }
+  return NULL;
+}
+
+static inline int ac_json_cursor_scan_int(ac_json_cursor_t *c,
+                                          const char *key, int default_value) {
+  return parse_int(ac_json_cursor_value(ac_json_cursor_scan(c, key)),
+                   default_value);
+}
+
+static inline int32_t ac_json_cursor_scan_int32(ac_json_cursor_t *c,
+                                                const char *key,
+                                                int32_t default_value) {
+  return parse_int32(ac_json_cursor_value(ac_json_cursor_scan(c, key)),
+                     default_value);
+}
+
+static inline uint32_t ac_json_cursor_scan_uint32(ac_json_cursor_t *c,
+                                                  const char *key,
+                                                  uint32_t default_value) {
+  return parse_uint32(ac_json_cursor_value(ac_json_cursor_scan(c, key)),
+                      default_value);
+}
+
+static inline int64_t ac_json_cursor_scan_int64(ac_json_cursor_t *c,
+                                                const char *key,
+                                                int64_t default_value) {
+  return parse_int64(ac_json_cursor_value(ac_json_cursor_scan(c, key)),
+                     default_value);
+}
+
+static inline uint64_t ac_json_cursor_scan_uint64(ac_json_cursor_t *c,
+                                                  const char *key,
+                                                  uint64_t default_value) {
+  return parse_uint64(ac_json_cursor_value(ac_json_cursor_scan(c, key)),
+                      default_value);
+}
+
+static inline char *ac_json_cursor_scan_str(ac_json_cursor_t *c,
+                                            const char *key,
+                                            const char *default_value) {
+  char *value = ac_json_cursor_value(ac_json_cursor_scan(c, key));
+  return value ? value : (char *)default_value;
+}
+
+static inline char *ac_json_cursor_scan_strd(ac_pool_t *pool,
+                                             ac_json_cursor_t *c,
+                                             const char *key,
+                                             const char *default_value) {
+  char *value = ac_json_cursor_decode(pool, ac_json_cursor_scan(c, key));
+  return value ? value : (char *)default_value;
+}
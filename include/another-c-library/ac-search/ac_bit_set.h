@@ -15,6 +15,11 @@ void ac_bit_set_boolean(ac_bit_set_t *h, uint32_t id, bool v);
 void ac_bit_set_unset(ac_bit_set_t *h, uint32_t id);
 
 void ac_bit_set_and(ac_bit_set_t *dest, ac_bit_set_t *to_and);
+/* dest &= to_and, returns the number of bits left in dest */
+uint32_t ac_bit_set_and_count(ac_bit_set_t *dest, ac_bit_set_t *to_and);
+/* apply every set to dest in one pass over dest */
+void ac_bit_set_and_many(ac_bit_set_t *dest, ac_bit_set_t **to_and, uint32_t num_to_and);
+void ac_bit_set_or_many(ac_bit_set_t *dest, ac_bit_set_t **to_or, uint32_t num_to_or);
 void ac_bit_set_complement(ac_bit_set_t *h);
 ac_bit_set_t *ac_bit_set_copy(ac_pool_t *pool, ac_bit_set_t *src);
 uint32_t ac_bit_set_count(ac_bit_set_t *h);
@@ -28,4 +33,8 @@ void ac_bit_set_true(ac_bit_set_t *h);
 
 ac_cursor_t *ac_bit_set_open_cursor(ac_pool_t *pool, ac_bit_set_t *h);
 
+/* raw access for other set representations (bit i is words[i>>6] & (1<<(i&63))) */
+uint32_t ac_bit_set_num_items(ac_bit_set_t *h);
+uint64_t *ac_bit_set_words(ac_bit_set_t *h, uint32_t *num_words);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,55 @@
+#ifndef _ac_roaring_bit_set_h
+#define _ac_roaring_bit_set_h
+
+#include "another-c-library/ac_pool.h"
+#include "another-c-library/ac-search/ac_bit_set.h"
+#include "another-c-library/ac-search/ac_cursor.h"
+
+/*
+    A compressed alternative to ac_bit_set_t.  ids are grouped by their upper
+    16 bits and each group is stored as a sorted array (sparse), a 64k bitmap
+    (dense) or a list of runs, whichever is smallest.  A set with a few
+    thousand ids over a 100M id space costs kilobytes instead of 12MB and
+    operations only visit the groups which are present.
+*/
+struct ac_roaring_bit_set_s;
+typedef struct ac_roaring_bit_set_s ac_roaring_bit_set_t;
+
+/* ids must be less than num_items (as with ac_bit_set_init) */
+ac_roaring_bit_set_t * ac_roaring_bit_set_init(ac_pool_t *pool, uint32_t num_items);
+bool ac_roaring_bit_set(ac_roaring_bit_set_t *h, uint32_t id);
+
+void ac_roaring_bit_set_set(ac_roaring_bit_set_t *h, uint32_t id);
+void ac_roaring_bit_set_boolean(ac_roaring_bit_set_t *h, uint32_t id, bool v);
+void ac_roaring_bit_set_unset(ac_roaring_bit_set_t *h, uint32_t id);
+
+void ac_roaring_bit_set_and(ac_roaring_bit_set_t *dest, ac_roaring_bit_set_t *to_and);
+void ac_roaring_bit_set_complement(ac_roaring_bit_set_t *h);
+ac_roaring_bit_set_t *ac_roaring_bit_set_copy(ac_pool_t *pool, ac_roaring_bit_set_t *src);
+uint32_t ac_roaring_bit_set_count(ac_roaring_bit_set_t *h);
+// get first set bit
+uint32_t ac_roaring_bit_set_first(ac_roaring_bit_set_t *h);
+void ac_roaring_bit_set_false(ac_roaring_bit_set_t *h);
+void ac_roaring_bit_set_not(ac_roaring_bit_set_t *dest, ac_roaring_bit_set_t *to_not);
+void ac_roaring_bit_set_or(ac_roaring_bit_set_t *dest, ac_roaring_bit_set_t *to_or);
+void ac_roaring_bit_set_true(ac_roaring_bit_set_t *h);
+
+/* convert containers built up by ac_roaring_bit_set_set to runs where that is
+   smaller (results of the boolean operations are already optimized) */
+void ac_roaring_bit_set_optimize(ac_roaring_bit_set_t *h);
+
+ac_cursor_t *ac_roaring_bit_set_open_cursor(ac_pool_t *pool, ac_roaring_bit_set_t *h);
+
+/* mixing with dense bit sets */
+void ac_roaring_bit_set_and_bit_set(ac_roaring_bit_set_t *dest, ac_bit_set_t *to_and);
+void ac_roaring_bit_set_not_bit_set(ac_roaring_bit_set_t *dest, ac_bit_set_t *to_not);
+void ac_roaring_bit_set_or_bit_set(ac_roaring_bit_set_t *dest, ac_bit_set_t *to_or);
+
+void ac_bit_set_and_roaring(ac_bit_set_t *dest, ac_roaring_bit_set_t *to_and);
+void ac_bit_set_not_roaring(ac_bit_set_t *dest, ac_roaring_bit_set_t *to_not);
+void ac_bit_set_or_roaring(ac_bit_set_t *dest, ac_roaring_bit_set_t *to_or);
+
+ac_roaring_bit_set_t *ac_roaring_bit_set_from_bit_set(ac_pool_t *pool, ac_bit_set_t *src);
+ac_bit_set_t *ac_roaring_bit_set_to_bit_set(ac_pool_t *pool, ac_roaring_bit_set_t *src);
+
+#endif
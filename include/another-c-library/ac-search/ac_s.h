@@ -4,6 +4,7 @@
 #include <inttypes.h>
 #include "another-c-library/ac_pool.h"
 #include "another-c-library/ac-search/ac_token.h"
+#include "another-c-library/ac-search/ac_top_n.h"
 
 struct ac_s_s;
 typedef struct ac_s_s ac_s_t;
@@ -31,6 +32,20 @@ uint8_t *ac_s_find(ac_s_t *h, uint32_t *len, const char *term, uint32_t id);
    to get each id which matches the given query. */
 ac_s_cursor_t *ac_s_open_cursor(ac_pool_t *pool, ac_s_t *search, ac_token_t *t, void *arg);
 
+/* ranked retrieval.  score is called with a term cursor on a matching id
+   (c->current, and c->wp..c->ewp are the word positions) and the number of
+   ids which have the term (0 for custom term cursors, whose size isn't
+   known).  An id's weight is the sum of the scores of its
+   terms.  max_score must return at least the score of any id of a term with
+   num_ids ids and at most max_frequency word positions, it is used to skip
+   ids (and whole 4096 id groups) which can't make it into top.  Queries which
+   are a single term or an OR of terms of this index are pruned, anything
+   else is scored id by id.  The cursor must not have been advanced. */
+typedef double (*ac_s_score_cb)(ac_s_cursor_t *c, uint32_t num_ids, void *arg);
+typedef double (*ac_s_max_score_cb)(uint32_t max_frequency, uint32_t num_ids, void *arg);
+
+void ac_s_top_n(ac_top_n_t *top, ac_s_cursor_t *c, ac_s_score_cb score, ac_s_max_score_cb max_score, void *arg);
+
 /* advanced: for manually constructed queries */
 typedef uint32_t (*ac_s_advance_cb)( void * c );
 typedef uint32_t (*ac_s_advance_to_cb)( void * c, uint32_t id );
@@ -25,6 +25,21 @@ void ac_search_builder_termf(ac_search_builder_t *h, uint32_t id, int32_t value,
 void ac_search_builder_wterm(ac_search_builder_t *h, uint32_t id, int32_t value, uint16_t pos, size_t sp, const char *term );
 void ac_search_builder_wtermf(ac_search_builder_t *h, uint32_t id, int32_t value, uint16_t pos, size_t sp, const char *term, ... );
 
+/* Builds the same image using several threads.  Postings are partitioned by
+   a hash of the term into num_partitions runs which are sorted and encoded
+   into segments num_threads at a time and then concatenated into one image.
+   The builder returned can be used as a producer itself.  Other threads should
+   each get their own producer through ac_search_builder_producer and may add
+   terms and globals concurrently.  Each producer buffers up to buffer_size
+   bytes.  Producers are finished by calling ac_search_builder_destroy on the
+   builder returned here (after all producer threads are done) and must not be
+   destroyed individually. */
+ac_search_builder_t *ac_search_builder_init_parallel(const char *filename, size_t buffer_size,
+                                                     size_t num_partitions, size_t num_threads);
+
+/* thread safe, h must come from ac_search_builder_init_parallel */
+ac_search_builder_t *ac_search_builder_producer(ac_search_builder_t *h);
+
 void ac_search_builder_destroy(ac_search_builder_t *h);
 
 
@@ -48,8 +63,21 @@ typedef struct {
     ac_search_builder_image_term_pos_t *term_pos;
     uint32_t num_term_pos;
 
+    // NULL for images opened with ac_search_builder_image_map
     char **term;
     char **eterm;
+
+    // terms with many ids are stored in blocks of 128 (block_ids is NULL otherwise)
+    uint32_t *block_ids;
+    uint8_t *controls;
+    uint32_t *skip;
+    uint8_t *blocks;
+    uint32_t num_ids;
+    uint32_t num_blocks;
+    uint32_t block;
+    uint32_t block_size;
+    uint32_t idx;
+    uint32_t payload_idx;
 } ac_search_builder_image_term_t;
 
 struct ac_search_builder_image_s;
@@ -57,6 +85,13 @@ typedef struct ac_search_builder_image_s ac_search_builder_image_t;
 
 ac_search_builder_image_t *ac_search_builder_image_init(const char *filename);
 
+/* same as ac_search_builder_image_init, except that the files are memory mapped
+   (read only, shared) instead of being read into the heap.  Processes which map
+   the same image share one copy in the page cache.  Terms are found by a binary
+   search of the mapped term offset table (_term_offs), so nothing is built per
+   term at startup.  term/eterm are not set for terms found in a mapped image. */
+ac_search_builder_image_t *ac_search_builder_image_map(const char *filename);
+
 // length is found in the 4 bytes prior to the returned pointer if non null
 const void * ac_search_builder_image_global(ac_search_builder_image_t *h, uint32_t gid);
 
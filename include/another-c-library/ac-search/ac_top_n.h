@@ -11,11 +11,22 @@ typedef struct {
 struct ac_top_n_s;
 typedef struct ac_top_n_s ac_top_n_t;
 
+/* keeps the size items with the largest weights (ties go to the smaller id) */
 ac_top_n_t *ac_top_n_init(ac_pool_t *pool, uint32_t size);
 
 void ac_top_n_reset(ac_top_n_t *h);
 void ac_top_n_add(ac_top_n_t *h, uint32_t id, double weight);
 
+/* the weight of the worst item being kept (-DBL_MAX until 2*size items have
+   been added).  ac_top_n_add ignores weights below it, and an equal weight
+   only replaces a larger id.  It only rises. */
+double ac_top_n_threshold(ac_top_n_t *h);
+
+/* add the items of src to dest, for combining the results of queries run
+   over shards (one ac_top_n_t per thread) once the threads are done */
+void ac_top_n_merge(ac_top_n_t *dest, ac_top_n_t *src);
+
+/* returns up to size items sorted by descending weight */
 ac_top_n_item_t *ac_top_n_finish(ac_top_n_item_t **ep, ac_top_n_t *h);
 
 #endif
\ No newline at end of file
@@ -122,6 +122,21 @@ void ac_in_options_lz4(ac_in_options_t *h, size_t buffer_size);
 void ac_in_options_compressed_buffer_size(ac_in_options_t *h,
                                           size_t buffer_size);
 
+/*
+  Read and decompress up to num_blocks blocks ahead on a helper thread so that
+  I/O and decompression overlap with processing records.  For lz4 files a
+  block is an lz4 block, otherwise it is buffer_size bytes.
+*/
+void ac_in_options_read_ahead(ac_in_options_t *h, size_t num_blocks);
+
+/*
+  Read files with io_uring (on Linux), keeping up to num_blocks reads of the
+  input buffer in flight.  The files opened on a thread share a ring so that
+  the reads of all of the inputs to a merge are submitted together.  If
+  io_uring isn't available, or for gz files, this has no effect.
+*/
+void ac_in_options_io_uring(ac_in_options_t *h, size_t num_blocks);
+
 /* Within a single cursor, reduce equal items.  In this case, it is assumed
    that the contents are sorted.  */
 void ac_in_options_reducer(ac_in_options_t *h, ac_io_compare_cb compare,
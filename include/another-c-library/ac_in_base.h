@@ -26,6 +26,19 @@ ac_in_base_t *ac_in_base_init_from_buffer(char *buffer, size_t buffer_size,
                                           bool can_free);
 ac_in_base_t *ac_in_base_reinit(ac_in_base_t *base, size_t buffer_size);
 
+/*
+  read (and for gz, decompress) up to num_blocks buffers ahead of the reader
+  on a helper thread.  This does nothing for buffers.
+*/
+void ac_in_base_read_ahead(ac_in_base_t *h, size_t num_blocks);
+
+/*
+  read with io_uring, keeping up to num_blocks buffers in flight.  This does
+  nothing for buffers, gz files, descriptors which can't seek, or if io_uring
+  isn't available.  Read ahead is not used together with io_uring.
+*/
+void ac_in_base_io_uring(ac_in_base_t *h, size_t num_blocks);
+
 const char *ac_in_base_filename(ac_in_base_t *h);
 
 char *ac_in_base_read_delimited(ac_in_base_t *h, int32_t *rlen, int delim,
@@ -60,6 +60,8 @@ typedef int (*ac_io_compare_cb)(const ac_io_record_t *, const ac_io_record_t *,
 typedef size_t (*ac_io_partition_cb)(const ac_io_record_t *r, size_t num_part,
                                     void *tag);
 
+typedef uint64_t (*ac_io_hash_cb)(const ac_io_record_t *r, void *tag);
+
 typedef bool (*ac_io_fixed_reducer_cb)(char *d, size_t num_r, void *tag);
 
 typedef void (*ac_io_fixed_sort_cb)(void *p, size_t total_elems);
@@ -74,6 +76,39 @@ bool ac_io_keep_first(ac_io_record_t *res, const ac_io_record_t *r,
 size_t ac_io_hash_partition(const ac_io_record_t *r, size_t num_part,
                             void *tag);
 
+/* Range partitioning routes records to partitions by comparing them to
+   split points chosen from a sample of the keys, so that the partitions
+   concatenated in order are sorted by compare.  Keys are added with
+   ac_io_range_partition_sample (or by the output, see
+   ac_out_ext_options_range_partition) and a reservoir of max_samples is kept.
+   The split points divide the sorted sample into num_partitions equal parts
+   and are computed by ac_io_range_partition_finish (or on the first call to
+   ac_io_range_partition).  Every producer writing to the same partitions must
+   use the same split points. */
+struct ac_io_range_partition_s;
+typedef struct ac_io_range_partition_s ac_io_range_partition_t;
+
+ac_io_range_partition_t *
+ac_io_range_partition_init(ac_io_compare_cb compare, void *compare_arg,
+                           size_t max_samples);
+
+void ac_io_range_partition_sample(ac_io_range_partition_t *h,
+                                  const ac_io_record_t *r);
+
+void ac_io_range_partition_finish(ac_io_range_partition_t *h,
+                                  size_t num_partitions);
+
+bool ac_io_range_partition_finished(ac_io_range_partition_t *h);
+
+ac_io_compare_cb ac_io_range_partition_compare(ac_io_range_partition_t *h,
+                                               void **compare_arg);
+
+/* partition callback, tag is the ac_io_range_partition_t */
+size_t ac_io_range_partition(const ac_io_record_t *r, size_t num_part,
+                             void *tag);
+
+void ac_io_range_partition_destroy(ac_io_range_partition_t *h);
+
 bool ac_io_file_info(ac_io_file_info_t *fi);
 
 ac_io_file_info_t *
@@ -97,6 +132,9 @@ size_t ac_io_file_size(const char *filename);
 
 time_t ac_io_modified(const char *filename);
 
+/* xxhash64 of the contents of filename, false if it can't be read */
+bool ac_io_hash_file(uint64_t *hash, const char *filename);
+
 bool ac_io_directory(const char *filename);
 bool ac_io_file(const char *filename);
 
@@ -134,24 +172,20 @@ bool ac_io_make_path_valid(char *filename);
 */
 bool ac_io_extension(const char *filename, const char *extension);
 
-/* Do not put on website - common comparison and split functions */
-static inline int ac_io_compare_uint64_t(const ac_io_record_t *p1,
-                                         const ac_io_record_t *p2, void *tag) {
-  uint64_t *a = (uint64_t *)p1->record;
-  uint64_t *b = (uint64_t *)p2->record;
-  if (*a != *b)
-    return (*a < *b) ? -1 : 1;
-  return 0;
-}
+/* Do not put on website - common comparison and split functions.  The
+   comparisons are not inline so that their addresses are unique, ac_in_ext and
+   ac_out_sorted recognize them and avoid calling through the pointer.
+*/
+int ac_io_compare_uint64_t(const ac_io_record_t *p1, const ac_io_record_t *p2,
+                           void *tag);
 
-static inline int ac_io_compare_uint32_t(const ac_io_record_t *p1,
-                                         const ac_io_record_t *p2, void *tag) {
-  uint32_t *a = (uint32_t *)p1->record;
-  uint32_t *b = (uint32_t *)p2->record;
-  if (*a != *b)
-    return (*a < *b) ? -1 : 1;
-  return 0;
-}
+int ac_io_compare_uint32_t(const ac_io_record_t *p1, const ac_io_record_t *p2,
+                           void *tag);
+
+/* Compare records as byte strings (memcmp order, a record sorts before longer
+   records which it is a prefix of). */
+int ac_io_compare_bytes(const ac_io_record_t *p1, const ac_io_record_t *p2,
+                        void *tag);
 
 static inline size_t ac_io_split_by_uint64_t(const ac_io_record_t *r,
                                              size_t num_part, void *tag) {
@@ -0,0 +1,111 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_json_cursor_H
+#define _ac_json_cursor_H
+
+#include "another-c-library/ac_json.h"
+#include "another-c-library/ac_pool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The cursor is a lazy alternative to ac_json_parse.  The document is indexed
+   once into a flat array of nodes (one per value) and nothing else is built.
+   Each node knows how many nodes its subtree spans, so finding a key or the
+   nth element of an array skips over unvisited objects and arrays without
+   looking at them.  Strings are decoded and objects or arrays are turned into
+   ac_json_t only when the caller asks for them.
+
+   Like ac_json_parse, the json is modified in place (strings and numbers are
+   zero terminated) and keys are not decoded. */
+struct ac_json_cursor_s;
+typedef struct ac_json_cursor_s ac_json_cursor_t;
+
+/* Index the json in p - ep.  NULL is returned if the json is not valid.  The
+   index is allocated from the pool and references p, so p must outlive the
+   pool. */
+ac_json_cursor_t *ac_json_cursor_init(ac_pool_t *pool, char *p, char *ep);
+
+static inline ac_json_type_t ac_json_cursor_type(ac_json_cursor_t *c);
+static inline bool ac_json_cursor_is_object(ac_json_cursor_t *c);
+static inline bool ac_json_cursor_is_array(ac_json_cursor_t *c);
+
+/* The number of entries in an object or array, zero otherwise. */
+static inline uint32_t ac_json_cursor_count(ac_json_cursor_t *c);
+
+/* Iterate over the entries in an object or array.  first returns NULL if the
+   object or array is empty (or c is not an object or array) and next returns
+   NULL after the last entry (or for the root). */
+static inline ac_json_cursor_t *ac_json_cursor_first(ac_json_cursor_t *c);
+static inline ac_json_cursor_t *ac_json_cursor_next(ac_json_cursor_t *c);
+
+/* The key of an object entry, NULL if the parent is not an object. */
+static inline char *ac_json_cursor_key(ac_json_cursor_t *c);
+
+/* Find the entry for key in an object or the nth element of an array.  Both
+   are linear in the number of entries (not in the size of the entries). */
+static inline ac_json_cursor_t *ac_json_cursor_scan(ac_json_cursor_t *c,
+                                                    const char *key);
+static inline ac_json_cursor_t *ac_json_cursor_nth(ac_json_cursor_t *c,
+                                                   uint32_t nth);
+
+/* Follow a path of keys and array indices separated by periods
+   (ex. "users.3.name"). */
+static inline ac_json_cursor_t *ac_json_cursor_path(ac_json_cursor_t *c,
+                                                    const char *path);
+
+/* returns NULL if object or array, see ac_jsonv, ac_jsond, and ac_jsonb */
+static inline char *ac_json_cursor_value(ac_json_cursor_t *c);
+static inline char *ac_json_cursor_decode(ac_pool_t *pool,
+                                          ac_json_cursor_t *c);
+static inline char *ac_json_cursor_binary(ac_json_cursor_t *c,
+                                          size_t *length);
+
+static inline int ac_json_cursor_scan_int(ac_json_cursor_t *c,
+                                          const char *key, int default_value);
+static inline int32_t ac_json_cursor_scan_int32(ac_json_cursor_t *c,
+                                                const char *key,
+                                                int32_t default_value);
+static inline uint32_t ac_json_cursor_scan_uint32(ac_json_cursor_t *c,
+                                                  const char *key,
+                                                  uint32_t default_value);
+static inline int64_t ac_json_cursor_scan_int64(ac_json_cursor_t *c,
+                                                const char *key,
+                                                int64_t default_value);
+static inline uint64_t ac_json_cursor_scan_uint64(ac_json_cursor_t *c,
+                                                  const char *key,
+                                                  uint64_t default_value);
+static inline char *ac_json_cursor_scan_str(ac_json_cursor_t *c,
+                                            const char *key,
+                                            const char *default_value);
+static inline char *ac_json_cursor_scan_strd(ac_pool_t *pool,
+                                             ac_json_cursor_t *c,
+                                             const char *key,
+                                             const char *default_value);
+
+/* Materialize c (and everything below it) as ac_json_t so that it can be
+   modified or dumped. */
+ac_json_t *ac_json_cursor_json(ac_pool_t *pool, ac_json_cursor_t *c);
+
+#include "another-c-library/ac-json/ac_json_cursor.h"
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
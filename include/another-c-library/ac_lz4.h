@@ -102,6 +102,12 @@ uint32_t ac_lz4_compress(ac_lz4_t *l, const void *src, uint32_t src_len,
 uint32_t ac_lz4_compress_block(ac_lz4_t *l, const void *src, uint32_t src_len,
                                void *dest, uint32_t dest_len);
 
+/* Blocks are compressed independently, so several ac_lz4_t (one per thread)
+   can compress blocks of the same frame.  Only the ac_lz4_t which writes the
+   frame should have a content checksum.  It must see every block in order
+   through this call before ac_lz4_finish. */
+void ac_lz4_content_checksum(ac_lz4_t *l, const void *src, uint32_t src_len);
+
 /* this will return a negative number if crc doesn't match.  dest should point
    to location for size if compressing and just after block_size if
    decompressing.  If result is non-negative, then it succeeded and read or
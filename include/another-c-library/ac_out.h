@@ -40,6 +40,15 @@ ac_out_t *ac_out_init_with_fd(int fd, bool fd_owner, ac_out_options_t *options);
 ac_out_t *ac_out_ext_init(const char *filename, ac_out_options_t *options,
                           ac_out_ext_options_t *ext_options);
 
+typedef bool (*ac_out_record_cb)(const void *d, size_t len, void *arg);
+typedef void (*ac_out_close_cb)(void *arg);
+
+/* records written to the returned ac_out_t are passed to write_record as is
+   (there is no format or file) and close is called when it is destroyed.
+   ac_out_in returns NULL for this type. */
+ac_out_t *ac_out_init_with_cb(ac_out_record_cb write_record,
+                              ac_out_close_cb close, void *arg);
+
 /* write record in the format specified by ac_out_options_format(...) */
 bool ac_out_write_record(ac_out_t *h, const void *d, size_t len);
 
@@ -111,6 +120,14 @@ void ac_out_options_lz4(ac_out_options_t *h, int level,
                         ac_lz4_block_size_t size, bool block_checksum,
                         bool content_checksum);
 
+/*
+  Compress lz4 blocks on num_threads background threads.  Blocks are still
+  written in order and the file can be read with ac_in like any other lz4
+  file.  Each thread holds two blocks in memory.  The default (0 or 1) is to
+  compress on the thread calling ac_out_write.
+*/
+void ac_out_options_lz4_threads(ac_out_options_t *h, int num_threads);
+
 /* extended options are for partitioned output, sorted output, or both */
 void ac_out_ext_options_init(ac_out_ext_options_t *h);
 
@@ -137,6 +154,16 @@ void ac_out_ext_options_partition(ac_out_ext_options_t *h,
 void ac_out_ext_options_num_partitions(ac_out_ext_options_t *h,
                                        size_t num_partitions);
 
+/* Partition by key range so that the partitions read in order are globally
+   sorted.  If rp has not been finished, every record written is sampled into
+   rp, the output is sorted before partitioning (using rp's compare if no
+   compare is set), and the split points are chosen from the sample once the
+   sorted data is partitioned.  When several outputs (such as the split
+   outputs of a task) write to the same partitions, sample the keys and call
+   ac_io_range_partition_finish before any of them are written. */
+void ac_out_ext_options_range_partition(ac_out_ext_options_t *h,
+                                        ac_io_range_partition_t *rp);
+
 /* By default, tmp files are written every time the buffer fills and all of the
    tmp files are merged at the end.  This causes the tmp files to be merged
    once the number of tmp files reaches the num_per_group. */
@@ -161,12 +188,39 @@ void ac_out_ext_options_intermediate_reducer(ac_out_ext_options_t *h,
                                              ac_io_reducer_cb reducer,
                                              void *arg);
 
+/* Combine records with equal keys as they are written instead of after the
+   sort buffer is sorted.  Each record is looked up in a hash table of the
+   records in the buffer and, if one compares equal (using the intermediate
+   compare), the intermediate reducer is applied to the pair and the result
+   replaces the existing record.  The buffer is only sorted and written out
+   once it fills with distinct keys, which greatly reduces the tmp files
+   written when there are many duplicates.  The reducer is called with two
+   records at a time and must not have side effects (records may be reduced
+   again when the tmp files are merged).  hash must return the same value for
+   records which compare equal.  It may be NULL if the compare is
+   ac_io_compare_uint32_t, ac_io_compare_uint64_t, or ac_io_compare_bytes.
+   Like the sort scratch space, the table doesn't count against the buffer
+   size.  It holds 8 bytes per slot and doubles as distinct keys are added. */
+void ac_out_ext_options_combine(ac_out_ext_options_t *h, ac_io_hash_cb hash,
+                                void *arg);
+
 /* Use an extra thread when sorting output. */
 void ac_out_ext_options_use_extra_thread(ac_out_ext_options_t *h);
 
 /* Default tmp files are stored in lz4 format.  Disable this behavior. */
 void ac_out_ext_options_dont_compress_tmp(ac_out_ext_options_t *h);
 
+/* Read the tmp files with io_uring when merging them (see
+   ac_in_options_io_uring). */
+void ac_out_ext_options_io_uring(ac_out_ext_options_t *h, size_t num_blocks);
+
+/* Check with spill_check each time a sort buffer grows by another 1/16th of
+   its size (and when it is written out).  This lets a caller which is sharing
+   memory between several outputs write buffers out before they are full. */
+void ac_out_ext_options_spill_check(ac_out_ext_options_t *h,
+                                    ac_out_spill_check_cb spill_check,
+                                    void *arg);
+
 /* used to create a partitioned filename */
 void ac_out_partition_filename(char *dest, const char *filename, size_t id);
 
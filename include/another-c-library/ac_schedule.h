@@ -69,7 +69,7 @@ then attempts to keep your process operating fully within that space.
 ac_schedule_t *ac_schedule_init(int argc, char **args, size_t num_partitions,
                                 size_t cpus, size_t ram);
 
-/* Define where the ack directory should be (default is tasks/ack)*/
+/* Define where the ack directory should be (default is tasks/ack) */
 void ac_schedule_ack_dir(ac_schedule_t *h, const char *ack_dir);
 
 /* Define where the tasks directory should be output to (default is tasks) */
@@ -165,6 +165,24 @@ static const size_t AC_OUTPUT_FIRST = 2;
 static const size_t AC_OUTPUT_SPLIT = 4;
 static const size_t AC_OUTPUT_PARTITION = 8;
 
+/* AC_OUTPUT_STREAM (used with AC_OUTPUT_PARTITION) hands the records of each
+   source partition to the same partition of the destination through a
+   bounded in memory channel instead of a file.  The destination partition is
+   started as soon as the source partition starts running and reads records
+   as they are written.  Once out_ram_pct worth of records are waiting, the
+   rest are spilled to disk and read after the channel is drained, so the
+   source never waits on the destination.
+
+   The flag is ignored (and the output is written to a file) unless there is
+   exactly one destination with the same number of partitions, no other output
+   of the task goes to that destination, and the output isn't sorted or split.
+   Streamed records aren't kept, so a source partition reruns whenever its
+   destination partition might run (the destination is forced or selected
+   with -o, hasn't completed since the source last did, reads files from
+   outside of the schedule, or has other dependencies which are newer or
+   haven't completed yet). */
+static const size_t AC_OUTPUT_STREAM = 16;
+
 /* Defines an output which will use name as the base name.  The destinations
    are a list of output tasks which can be NULL to specify none, or multiple if
    separated by vertical bars.
@@ -255,6 +273,14 @@ void ac_task_do_nothing(ac_task_t *task);
 /* this forces a task to run everytime no matter what */
 void ac_task_run_everytime(ac_task_t *task);
 
+/* By default, a partition reruns when its inputs or dependencies are newer
+   than its ack.  A fingerprinted task reads back and hashes its output files
+   after each run and records the fingerprints of its inputs next to the ack
+   (<ack>.hash).  When only its inputs are newer and their fingerprints
+   haven't changed, it isn't run again.  Inputs from another task only have a
+   fingerprint if that task is also fingerprinted. */
+void ac_task_fingerprint(ac_task_t *task);
+
 /**************************************************************************
 The following structures are primarily used within the runner
 ***************************************************************************/
@@ -322,6 +348,9 @@ struct ac_worker_input_s {
   ac_worker_input_t *next;
 };
 
+struct ac_task_stream_s;
+typedef struct ac_task_stream_s ac_task_stream_t;
+
 struct ac_worker_output_s {
   size_t id;
   char *name;
@@ -340,6 +369,9 @@ struct ac_worker_output_s {
   /* this can be num_partitions * dest num_partitions if split */
   bool *cleaned_up_parts;
 
+  /* one per partition if the output is streamed (see AC_OUTPUT_STREAM) */
+  ac_task_stream_t *streams;
+
   ac_task_t *task;
   ac_worker_output_t *next;
 };
@@ -382,6 +414,16 @@ ac_schedule_t *ac_task_schedule(ac_task_t *task);
 /* Return an actual amount of ram given the task/partition and percentage */
 size_t ac_worker_ram(ac_worker_t *w, double pct);
 
+/* Lease pct of the scheduler's ram (split between the workers running right
+   now) for a buffer the runner manages itself.  ac_worker_in and ac_worker_out
+   lease their buffers the same way.  Leases are returned when the worker
+   finishes. */
+size_t ac_worker_lease_ram(ac_worker_t *w, double pct);
+
+/* true if the workers hold most of the ram or others are waiting for memory
+   to start, runners holding large buffers should write them out early */
+bool ac_worker_ram_pressure(ac_worker_t *w);
+
 /* Returns true if in debug mode */
 bool ac_worker_debug(ac_worker_t *w);
 
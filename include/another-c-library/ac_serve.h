@@ -60,6 +60,15 @@ void ac_serve_request_pool_size(ac_serve_t *w, size_t size);
 void ac_serve_backlog(ac_serve_t *w, int backlog);
 void ac_serve_threads(ac_serve_t *w, int num_threads);
 
+/* Give each thread its own SO_REUSEPORT listening socket so that the kernel
+   spreads new connections across the threads instead of waking all of them.
+   This only applies to ac_serve_port_init and more than one thread.  If the
+   extra sockets can't be opened, the threads share the original socket. */
+void ac_serve_reuseport(ac_serve_t *w);
+
+/* Pin each thread to a cpu (thread_id modulo the available cpus, Linux). */
+void ac_serve_pin_threads(ac_serve_t *w);
+
 void ac_serve_run(ac_serve_t *w);
 
 void ac_serve_destroy(ac_serve_t *w);
@@ -139,6 +148,8 @@ struct ac_serve_s {
   bool shutting_down;
 
   bool old_style_cors;
+  bool reuseport;
+  bool pin_threads;
 
   /* Date: ... GMT\r\nThread-Id: 000001\r\n - 56 bytes */
   char date[64];
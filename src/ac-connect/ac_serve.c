@@ -14,9 +14,14 @@ See the License for the specific language governing permissions and
 limitations under the License.
 */
 
+#ifdef __linux__
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#endif
+
 #include "another-c-library/ac_serve.h"
 #include "another-c-library/ac_timer.h"
 #include <pthread.h>
+#include <sched.h>
 
 struct serve_request_s;
 typedef struct serve_request_s serve_request_t;
@@ -441,16 +446,23 @@ void on_accept(uv_poll_t *server, int status, int events) {
   }
 }
 
-static int get_port_fd(int port, int exit_on_non_bind) {
+/* returns -1 if the socket can't be set up (or exits if it can't be bound
+   and exit_on_non_bind is set) */
+static int get_port_fd(int port, int exit_on_non_bind, bool reuseport) {
   int res = -1;
   struct sockaddr_in listen_addr;
   int reuseaddr_on = 1;
   res = socket(AF_INET, SOCK_STREAM, 0);
   if (res < 0)
-    abort();
+    return -1;
   if (setsockopt(res, SOL_SOCKET, SO_REUSEADDR, &reuseaddr_on,
                  sizeof(reuseaddr_on)) == -1)
-    abort();
+    goto fail;
+#ifdef SO_REUSEPORT
+  if (reuseport && setsockopt(res, SOL_SOCKET, SO_REUSEPORT, &reuseaddr_on,
+                              sizeof(reuseaddr_on)) == -1)
+    goto fail;
+#endif
   memset(&listen_addr, 0, sizeof(listen_addr));
   listen_addr.sin_family = AF_INET;
   listen_addr.sin_addr.s_addr = INADDR_ANY;
@@ -458,13 +470,39 @@ static int get_port_fd(int port, int exit_on_non_bind) {
   if (bind(res, (struct sockaddr *)&listen_addr, sizeof(listen_addr)) < 0) {
     if (exit_on_non_bind)
       exit(0);
-    else
-      abort();
+    goto fail;
   }
   if (listen(res, 65000) < 0)
-    abort();
+    goto fail;
   return res;
+
+fail:
+  close(res);
+  return -1;
+}
+
+#ifdef SO_REUSEPORT
+/* The socket from ac_serve_port_init keeps listening (for thread 0) while the
+   other threads' sockets are bound, so the port is never unbound.  Marking it
+   SO_REUSEPORT after it is bound lets the new sockets join it.  If any of
+   them can't be set up, every thread shares the original socket. */
+static bool open_reuseport_fds(ac_serve_t *w) {
+  int on = 1;
+  if (setsockopt(w->fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1)
+    return false;
+  for (int i = 1; i < w->num_threads; i++) {
+    int fd = get_port_fd(w->base.port, 0, true);
+    if (fd == -1) {
+      perror("SO_REUSEPORT socket");
+      for (int j = 1; j < i; j++)
+        close(w->services[j].fd);
+      return false;
+    }
+    w->services[i].fd = fd;
+  }
+  return true;
 }
+#endif
 
 int get_path_fd(const char *socket_path) {
   struct sockaddr_un addr;
@@ -559,8 +597,34 @@ void *run_hammer_loop(void *arg) {
   return NULL;
 }
 
+/* pin the thread to the thread_id'th cpu that the process may run on */
+static void pin_thread(ac_serve_t *w) {
+#ifdef __linux__
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    return;
+  int num_cpus = CPU_COUNT(&allowed);
+  if (num_cpus < 1)
+    return;
+  int n = w->thread_id % num_cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+    if (n-- == 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(cpu, &set);
+      pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+      return;
+    }
+  }
+#endif
+}
+
 void *run_loop(void *arg) {
   ac_serve_t *w = (ac_serve_t *)arg;
+  if (w->pin_threads && w->num_threads > 1)
+    pin_thread(w);
   if (w->hammer)
     return run_hammer_loop(arg);
 
@@ -667,7 +731,7 @@ ac_serve_t *ac_serve_hammer_init(ac_serve_cb on_url, ac_serve_cb on_chunk, char
 }
 
 ac_serve_t *ac_serve_port_init(int port, ac_serve_cb on_url, ac_serve_cb on_chunk) {
-  int fd = get_port_fd(port, 1);
+  int fd = get_port_fd(port, 1, false);
   if (fd == -1)
     return NULL;
   ac_serve_t *s = ac_serve_init(fd, on_url, on_chunk);
@@ -701,6 +765,18 @@ void ac_serve_threads(ac_serve_t *w, int num_threads) {
     w->num_threads = num_threads;
 }
 
+void ac_serve_reuseport(ac_serve_t *w) {
+#ifdef SO_REUSEPORT
+  if (w && w->socket_based)
+    w->reuseport = true;
+#endif
+}
+
+void ac_serve_pin_threads(ac_serve_t *w) {
+  if (w)
+    w->pin_threads = true;
+}
+
 void ac_serve_backlog(ac_serve_t *w, int backlog) {
   if (backlog < 0)
     backlog = 0;
@@ -712,16 +788,25 @@ void ac_serve_run(ac_serve_t *w) {
   if (!w)
     return;
   w->services = (ac_serve_t *)ac_calloc(sizeof(*w) * (w->num_threads));
+  if (w->num_threads == 1)
+    w->reuseport = false;
   double time_spent_hammering = 0.0;
   if (w->num_threads == 1) {
     ac_serve_clone(w->services, w, 0);
     run_loop(w->services + 0);
     time_spent_hammering = w->services[0].time_spent_hammering;
   } else {
-    for (int i = 0; i < w->num_threads; i++) {
+    for (int i = 0; i < w->num_threads; i++)
       ac_serve_clone(w->services, w, i);
-      pthread_create(&(w->services[i].thread), NULL, run_loop, w->services + i);
+#ifdef SO_REUSEPORT
+    if (w->reuseport && !open_reuseport_fds(w)) {
+      w->reuseport = false;
+      for (int i = 1; i < w->num_threads; i++)
+        w->services[i].fd = w->fd;
     }
+#endif
+    for (int i = 0; i < w->num_threads; i++)
+      pthread_create(&(w->services[i].thread), NULL, run_loop, w->services + i);
     for (int i = 0; i < w->num_threads; i++) {
       pthread_join(w->services[i].thread, NULL);
       time_spent_hammering += w->services[i].time_spent_hammering;
@@ -740,6 +825,8 @@ void ac_serve_destroy(ac_serve_t *w) {
     return;
 
   for (int i = 0; i < w->num_threads; i++) {
+    if (w->reuseport && w->services && i > 0)
+      close(w->services[i].fd);
     ac_serve_request_t *r = w->services[i].free_list;
     while (r) {
       ac_serve_request_t *next = r->next;
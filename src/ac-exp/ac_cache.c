@@ -1,44 +1,51 @@
 #include "another-c-library/ac_cache.h"
-#include "another-c-library/ac_map.h"
+#include "another-c-library/ac_allocator.h"
+#include "another-c-library/ac_md5.h"
 
-struct ac_cache_free_node_s;
-typedef struct ac_cache_free_node_s ac_cache_free_node_t;
+#include "the-macro-library/macro_map.h"
 
-struct ac_cache_mutex_s;
-typedef struct ac_cache_mutex_s ac_cache_mutex_t;
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
 
-struct ac_cache_free_node_s {
-    ac_cache_free_node_t *next;
-};
-
-struct ac_cache_mutex_s {
-    pthread_cond_t cond;
-    pthread_mutex_t mutex;
-};
+struct ac_cache_item_s;
+typedef struct ac_cache_item_s ac_cache_item_t;
 
-typedef struct {
-    ac_map_t time_stamp_node;
-    ac_map_t key_node;
+/* Completed items are on the shard's clock (a circular list).  Items being
+   fetched are only in the key map. */
+struct ac_cache_item_s {
+    macro_map_t key_node;
+    ac_cache_item_t *next;
+    ac_cache_item_t *previous;
     uint64_t key;
     size_t bytes;
     void *data;
-    time_t time_stamp;
-    uint32_t hits;
-    uint32_t seconds;
-    ac_cache_mutex_t *fetching;
-} ac_cache_item_t;
+    time_t expires;
+    bool referenced;
+    bool fetching;
+};
 
-static inline
-int compare_time_stamp_for_insert(const ac_cache_item_t *a, const ac_cache_item_t *b) {
-    if(a->time_stamp != b->time_stamp)
-        return (a->time_stamp < b->time_stamp) ? -1 : 1;
-    if(*key != node->key)
-        return (*key < node->key) ? -1 : 1;
-    return 0;
-}
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    macro_map_t *key_root;
+    ac_cache_item_t *hand;
+    ac_cache_item_t *free_items;
+    size_t bytes;
+    size_t cap;
+    size_t items;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t expirations;
+    /* keep shards which are next to each other off of the same cache line */
+    char padding[64];
+} ac_cache_shard_t;
 
-static ac_map_find_m(_time_stamp_find, ac_cache_item_t, ac_cache_item_t, compare_time_stamp_for_insert);
-static ac_map_insert_m(_time_stamp_insert, ac_cache_item_t, compare_time_stamp_for_insert);
+struct ac_cache_s {
+    ac_cache_shard_t *shards;
+    size_t num_shards;
+};
 
 static inline
 int compare_key_for_find(const uint64_t *key, const ac_cache_item_t *node) {
@@ -54,23 +61,24 @@ int compare_key_for_insert(const ac_cache_item_t *a, const ac_cache_item_t *b) {
     return 0;
 }
 
-static ac_map_find2_m(_key_find, uint64_t, ac_cache_item_t, key_node, compare_key_for_find);
-static ac_map_insert2_m(_key_insert, ac_cache_item_t, key_node, compare_key_for_insert);
+static macro_map_find_kv(_key_find, uint64_t, ac_cache_item_t, compare_key_for_find);
+static macro_map_insert(_key_insert, ac_cache_item_t, compare_key_for_insert);
 
-struct ac_cache_s {
-    ac_map_t *key_root;
-    ac_map_t *time_stamp_root;
-    ac_cache_free_node_t *free_item_nodes;
-    ac_cache_free_node_t *free_mutex_nodes;
-    size_t bytes;
-    size_t cap;
-    pthread_mutex_t mutex;
-};
-
-ac_cache_t * ac_cache_init(size_t cap) {
+ac_cache_t * ac_cache_init(size_t cap, size_t num_shards) {
+    if(!num_shards)
+        num_shards = 16;
+    size_t n = 1;
+    while(n < num_shards)
+        n <<= 1;
     ac_cache_t *h = (ac_cache_t *)ac_calloc(sizeof(*h));
-    pthread_mutex_init(&h->mutex);
-    h->cap = cap;
+    h->shards = (ac_cache_shard_t *)ac_calloc(sizeof(ac_cache_shard_t) * n);
+    h->num_shards = n;
+    for(size_t i=0; i<n; i++) {
+        ac_cache_shard_t *shard = h->shards + i;
+        pthread_mutex_init(&shard->mutex, NULL);
+        pthread_cond_init(&shard->cond, NULL);
+        shard->cap = cap / n;
+    }
     return h;
 }
 
@@ -78,17 +86,131 @@ uint64_t ac_cache_key(const char *key) {
     return ac_md5_str(key);
 }
 
+static inline ac_cache_shard_t *get_shard(ac_cache_t *h, uint64_t cache_key) {
+    return h->shards + (cache_key & (h->num_shards-1));
+}
+
+static inline size_t item_charge(ac_cache_item_t *item) {
+    return sizeof(*item) + (item->data ? item->bytes : 0);
+}
+
+static inline void clock_add(ac_cache_shard_t *shard, ac_cache_item_t *item) {
+    /* new items go just behind the hand so they are looked at last */
+    ac_cache_item_t *hand = shard->hand;
+    if(!hand) {
+        item->next = item->previous = item;
+        shard->hand = item;
+    }
+    else {
+        item->next = hand;
+        item->previous = hand->previous;
+        hand->previous->next = item;
+        hand->previous = item;
+    }
+    shard->bytes += item_charge(item);
+    shard->items++;
+}
+
+static inline void clock_remove(ac_cache_shard_t *shard, ac_cache_item_t *item) {
+    if(item->next == item)
+        shard->hand = NULL;
+    else {
+        item->previous->next = item->next;
+        item->next->previous = item->previous;
+        if(shard->hand == item)
+            shard->hand = item->next;
+    }
+    shard->bytes -= item_charge(item);
+    shard->items--;
+}
+
+static inline ac_cache_item_t *new_item(ac_cache_shard_t *shard, uint64_t cache_key) {
+    ac_cache_item_t *item = shard->free_items;
+    if(item)
+        shard->free_items = item->next;
+    else
+        item = (ac_cache_item_t *)ac_malloc(sizeof(*item));
+    memset(item, 0, sizeof(*item));
+    item->key = cache_key;
+    _key_insert(&(shard->key_root), item);
+    return item;
+}
+
+static inline void remove_item(ac_cache_shard_t *shard, ac_cache_item_t *item) {
+    macro_map_erase(&(shard->key_root), &(item->key_node));
+    if(!item->fetching) {
+        clock_remove(shard, item);
+        if(item->data)
+            ac_free(item->data);
+    }
+    item->next = shard->free_items;
+    shard->free_items = item;
+}
+
+static inline bool is_expired(ac_cache_item_t *item, time_t now) {
+    return item->expires && item->expires <= now;
+}
+
+/* finds the key, dropping it if it has expired */
+static inline ac_cache_item_t *find_item(ac_cache_shard_t *shard, uint64_t cache_key) {
+    ac_cache_item_t *item = _key_find(shard->key_root, &cache_key);
+    if(item && !item->fetching && item->expires && is_expired(item, time(NULL))) {
+        remove_item(shard, item);
+        shard->expirations++;
+        return NULL;
+    }
+    return item;
+}
+
+/* Advance the hand giving referenced items a second chance.  keep is the
+   item just added and is never chosen. */
+static ac_cache_item_t *clock_victim(ac_cache_shard_t *shard, ac_cache_item_t *keep, time_t now) {
+    ac_cache_item_t *n = shard->hand;
+    size_t limit = (shard->items << 1) + 1;
+    while(n && limit) {
+        ac_cache_item_t *next = n->next;
+        if(n != keep) {
+            if(!n->referenced || is_expired(n, now)) {
+                shard->hand = next;
+                return n;
+            }
+            n->referenced = false;
+        }
+        n = next;
+        limit--;
+    }
+    return NULL;
+}
+
+static void evict(ac_cache_shard_t *shard, ac_cache_item_t *keep) {
+    time_t now = time(NULL);
+    while(shard->bytes > shard->cap) {
+        ac_cache_item_t *victim = clock_victim(shard, keep, now);
+        if(!victim)
+            break;
+        if(is_expired(victim, now))
+            shard->expirations++;
+        else
+            shard->evictions++;
+        remove_item(shard, victim);
+    }
+}
+
 /*
     checks if data is available in cache
 */
 const void * cache_get(size_t *len, ac_cache_t *h, uint64_t cache_key) {
-    pthread_mutex_lock(&h->mutex);
-    ac_cache_item_t *item = _key_find(cache_key, h->key_root);
+    ac_cache_shard_t *shard = get_shard(h, cache_key);
+    pthread_mutex_lock(&shard->mutex);
+    ac_cache_item_t *item = find_item(shard, cache_key);
     if(!item || item->fetching) {
+        shard->misses++;
         *len = 0;
         return NULL;
     }
-    len = item->bytes;
+    shard->hits++;
+    item->referenced = true;
+    *len = item->bytes;
     return item->data;
 }
 
@@ -97,56 +219,27 @@ const void * cache_get(size_t *len, ac_cache_t *h, uint64_t cache_key) {
     wait on the previously started version
 */
 const void * cache_start(ssize_t *len, ac_cache_t *h, uint64_t cache_key) {
-    pthread_mutex_lock(&h->mutex);
-    ac_cache_item_t *item = _key_find(&cache_key, h->key_root);
-    if(!item) {
-        // create a new item and start process
-        ac_cache_free_node_t *fn = h->free_item_nodes;
-        if(fn) {
-            item = (ac_cache_item_t *)fn;
-            h->free_item_nodes = fn->next;
-            memset(item, 0, sizeof(*item));
-        }
-        else
-            item = (ac_cache_item_t *)ac_pool_calloc(h->cache_pool, sizeof(*item));
-        item->key = cache_key;
-        _key_insert(item, &(h->key_root));
-        fn = h->free_mutex_nodes;
-        if(fn) {
-            item->fetching = (ac_cache_mutex_t *)fn;
-            h->free_mutex_nodes = fn->next;
-        }
-        else
-            item->fetching = (ac_cache_mutex_t *)ac_pool_calloc(h->cache_pool, sizeof(*(item->fetching)));
-        item->fetching->mutex = PTHREAD_MUTEX_INITIALIZER;
-        item->fetching->cond = PTHREAD_COND_INITIALIZER;
-        item->fetching->ref_count = 1;
-        item->fetching->complete = 0;
-        *len = -1;
-        return item;
-    }
-    else if(item->fetching && item->fetching->ref_count) {
-        // wait on item to be fetched and return
-        ac_cache_mutex_t *fetching = item->fetching;
-
-        pthread_mutex_lock(&fetching->mutex);
-        pthread_mutex_unlock(&h->mutex);
-        while(fetching->complete == 0) {
-            pthread_cond_wait(&fetching->cond, &fetching->mutex);
-        }
-        pthread_mutex_lock(&h->mutex);
-        fetching->ref_count--;
-        if(fetching->ref_count == 0) {
-            pthread_mutex_unlock(&fetching->mutex);
-            item->fetching = NULL;
-            ac_cache_free_node_t *fn = (ac_cache_free_node_t *)fetching;
-            fn->next = h->free_mutex_nodes;
-            h->free_mutex_nodes = fn;
+    ac_cache_shard_t *shard = get_shard(h, cache_key);
+    pthread_mutex_lock(&shard->mutex);
+    ac_cache_item_t *item;
+    while(true) {
+        item = find_item(shard, cache_key);
+        if(!item) {
+            /* the caller fetches the item and calls cache_end */
+            item = new_item(shard, cache_key);
+            item->fetching = true;
+            shard->misses++;
+            *len = -1;
+            return NULL;
         }
-        else
-            pthread_mutex_unlock(&fetching->mutex);
+        if(!item->fetching)
+            break;
+        /* the item may be abandoned or evicted while waiting, so look again */
+        pthread_cond_wait(&shard->cond, &shard->mutex);
     }
-    len = item->bytes;
+    shard->hits++;
+    item->referenced = true;
+    *len = item->bytes;
     return item->data;
 }
 
@@ -154,7 +247,7 @@ const void * cache_start(ssize_t *len, ac_cache_t *h, uint64_t cache_key) {
     call after cache_get/cache_start to unlock the cache key
 */
 void cache_unlock(ac_cache_t *h, uint64_t cache_key) {
-    pthread_mutex_unlock(&h->mutex);
+    pthread_mutex_unlock(&get_shard(h, cache_key)->mutex);
 }
 
 /*
@@ -162,56 +255,86 @@ void cache_unlock(ac_cache_t *h, uint64_t cache_key) {
     to indicate that the key was not found
 */
 void cache_end(ac_cache_t *h, uint64_t cache_key, const void *d, size_t len, uint32_t seconds) {
-    pthread_mutex_lock(&h->mutex);
-    ac_cache_item_t *item = _key_find(cache_key, h->key_root);
-    if(!item) {
-        ac_cache_free_node_t *fn = h->free_item_nodes;
-        if(fn) {
-            item = (ac_cache_item_t *)fn;
-            h->free_item_nodes = fn->next;
-            memset(item, 0, sizeof(*item));
+    ac_cache_shard_t *shard = get_shard(h, cache_key);
+    pthread_mutex_lock(&shard->mutex);
+    ac_cache_item_t *item = _key_find(shard->key_root, &cache_key);
+    bool fetching = item && item->fetching;
+    if(!d && !len) {
+        if(fetching) {
+            remove_item(shard, item);
+            pthread_cond_broadcast(&shard->cond);
         }
-        else
-            item = (ac_cache_item_t *)ac_pool_calloc(h->cache_pool, sizeof(*item));
-        item->data = d;
-        item->bytes = len;
-        item->key = cache_key;
-        item->time_stamp = time(NULL) + seconds;
-        item->seconds = seconds;
-        _time_stamp_insert(item, &(h->time_stamp_root));
-        _key_insert(item, &(h->key_root));
-        pthread_mutex_unlock(&h->mutex);
+        pthread_mutex_unlock(&shard->mutex);
         return;
     }
 
-    ac_cache_mutex_t *fetching = item->fetching;
-    pthread_mutex_lock(&fetching->mutex);
-    pthread_mutex_unlock(&h->mutex);
-    fetching->ref_count--;
-    if(fetching->ref_count) {
-        pthread_cond_broadcast(&fetching->cond);
-        pthread_mutex_unlock(&fetching->mutex);
-        pthread_mutex_lock(&h->mutex);
-    }
+    if(!item)
+        item = new_item(shard, cache_key);
+    else if(fetching)
+        item->fetching = false;
     else {
-        pthread_mutex_unlock(&fetching->mutex);
-        pthread_mutex_lock(&h->mutex);
-        item->fetching = NULL;
-        ac_cache_free_node_t *fn = (ac_cache_free_node_t *)fetching;
-        fn->next = h->free_mutex_nodes;
-        h->free_mutex_nodes = fn;
+        clock_remove(shard, item);
+        if(item->data)
+            ac_free(item->data);
+    }
+    item->data = NULL;
+    if(d) {
+        item->data = ac_malloc(len);
+        memcpy(item->data, d, len);
     }
-    if(item->time_stamp)
-        ac_map_erase(&(item->time_stamp_node), &(h->time_stamp_root));
-    item->data = d;
     item->bytes = len;
-    item->key = cache_key;
-    item->time_stamp = time(NULL) + seconds;
-    item->seconds = seconds;
-    _time_stamp_insert(item, &(h->time_stamp_root));
-    pthread_mutex_unlock(&h->mutex);
+    item->expires = seconds ? time(NULL) + seconds : 0;
+    item->referenced = false;
+    clock_add(shard, item);
+    evict(shard, item);
+    if(fetching)
+        pthread_cond_broadcast(&shard->cond);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void ac_cache_stats(ac_cache_stats_t *stats, ac_cache_t *h) {
+    memset(stats, 0, sizeof(*stats));
+    for(size_t i=0; i<h->num_shards; i++) {
+        ac_cache_shard_t *shard = h->shards + i;
+        pthread_mutex_lock(&shard->mutex);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->expirations += shard->expirations;
+        stats->bytes += shard->bytes;
+        stats->items += shard->items;
+        pthread_mutex_unlock(&shard->mutex);
+    }
 }
 
 void ac_cache_destroy(ac_cache_t *h) {
+    for(size_t i=0; i<h->num_shards; i++) {
+        ac_cache_shard_t *shard = h->shards + i;
+        /* the tree can't be walked while freeing it, so chain the items first */
+        ac_cache_item_t *head = NULL;
+        macro_map_t *n = macro_map_first(shard->key_root);
+        while(n) {
+            ac_cache_item_t *item = (ac_cache_item_t *)n;
+            n = macro_map_next(n);
+            item->next = head;
+            head = item;
+        }
+        while(head) {
+            ac_cache_item_t *next = head->next;
+            if(head->data)
+                ac_free(head->data);
+            ac_free(head);
+            head = next;
+        }
+        head = shard->free_items;
+        while(head) {
+            ac_cache_item_t *next = head->next;
+            ac_free(head);
+            head = next;
+        }
+        pthread_mutex_destroy(&shard->mutex);
+        pthread_cond_destroy(&shard->cond);
+    }
+    ac_free(h->shards);
     ac_free(h);
 }
@@ -1,12 +1,30 @@
 #ifndef _ac_cache_h
 #define _ac_cache_h
 
-#include <time.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/types.h>
 
 struct ac_cache_s;
 typedef struct ac_cache_s ac_cache_t;
 
-ac_cache_t * ac_cache_init();
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t expirations;
+    size_t bytes;
+    size_t items;
+} ac_cache_stats_t;
+
+/*
+    cap is the number of bytes of data the cache may hold.  The keys are
+    spread over num_shards (rounded up to a power of 2, 0 for the default)
+    shards, each with its own lock and cap / num_shards bytes.  Entries are
+    evicted using the CLOCK (second chance) policy.
+*/
+ac_cache_t * ac_cache_init(size_t cap, size_t num_shards);
 
 /*
     returns a key to be used with the cached data
@@ -17,23 +35,36 @@ uint64_t ac_cache_key(const char *key);
     checks if data is available in cache
 */
 const void * cache_get(size_t *len, ac_cache_t *h, uint64_t cache_key);
+
 /*
     starts a cache operation.  If the given key is already started, this will
-    wait on the previously started version
+    wait on the previously started version.  If len is set to -1, the caller
+    is responsible for fetching the data and calling cache_end (after calling
+    cache_unlock).
 */
-const void * cache_start(size_t *len, ac_cache_t *h, uint64_t cache_key);
+const void * cache_start(ssize_t *len, ac_cache_t *h, uint64_t cache_key);
 
 /*
-    call after cache_get/cache_start to unlock the cache key
+    call after cache_get/cache_start to unlock the cache key.  The data
+    returned by cache_get/cache_start is only valid until this is called.
 */
 void cache_unlock(ac_cache_t *h, uint64_t cache_key);
 
 /*
     ends a cache operation.  If caching a NULL entry, pass a non-NULL/zero len
-    to indicate that the key was not found
+    to indicate that the key was not found.  A NULL entry with a zero len
+    abandons the operation (one of the waiting threads will start it over).
+    The data is copied.  If seconds is non-zero, the entry expires after that
+    many seconds.
+*/
+void cache_end(ac_cache_t *h, uint64_t cache_key, const void *d, size_t len,
+               uint32_t seconds);
+
+/*
+    sums the counters over all of the shards
 */
-void cache_end(ac_cache_t *h, uint64_t cache_key, const void *d, size_t len);
+void ac_cache_stats(ac_cache_stats_t *stats, ac_cache_t *h);
 
 void ac_cache_destroy(ac_cache_t *h);
 
-#endif
\ No newline at end of file
+#endif
@@ -18,57 +18,149 @@ limitations under the License.
 
 #include "another-c-library/ac_allocator.h"
 
-#include <fcntl.h>
 #include <pthread.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <unistd.h>
+
+/* Objects are handed to the loop through a bounded MPSC ring and a single
+   uv_async_t.  uv_async_send coalesces, so a burst of writes from worker
+   threads costs at most one wake up and the loop drains everything that is
+   pending each time it runs.  If the ring fills, writers fall back to a mutex
+   protected overflow array instead of blocking (the loop thread may write to
+   its own pipe).  Once anything is in overflow, writers keep using it until
+   the loop has taken it, and the loop delivers whatever was claimed in the
+   ring before that point first, so each writer's objects stay in order. */
+#define AC_OBJECT_PIPE_RING_SIZE 4096
+
+typedef struct {
+  size_t seq;
+  void *object;
+} ac_object_pipe_slot_t;
 
 struct ac_object_pipe_s {
-  uv_poll_t read_poll;
-  int read_fd;
-  int write_fd;
+  uv_async_t async;
+  ac_object_pipe_slot_t *ring;
+  size_t mask;
+  char pad0[64];
+  size_t enqueue_pos;
+  char pad1[64];
+  size_t dequeue_pos;
+
+  pthread_mutex_t mutex;
+  void **overflow;
+  size_t overflow_size;
+  size_t num_overflow;
+  void **held;
+  size_t held_size;
+  size_t num_held;
+  size_t barrier;
+
+  bool closing;
+  bool closed;
   ac_object_pipe_cb cb;
   ac_object_pipe_close_cb close_cb;
   void *cb_arg;
 };
 
-static void setnonblock(int fd) {
-  int flags = fcntl(fd, F_GETFL);
-  if (flags < 0)
-    abort();
+static bool ring_push(ac_object_pipe_t *h, void *object) {
+  size_t pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    ac_object_pipe_slot_t *slot = h->ring + (pos & h->mask);
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (!diff) {
+      if (__atomic_compare_exchange_n(&h->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->object = object;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0)
+      return false; /* full */
+    else
+      pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  }
+}
 
-  flags |= O_NONBLOCK;
-  if (fcntl(fd, F_SETFL, flags) < 0)
-    abort();
+/* only the loop thread pops, so no CAS is needed to claim a slot */
+static bool ring_pop(ac_object_pipe_t *h, void **object) {
+  size_t pos = h->dequeue_pos;
+  ac_object_pipe_slot_t *slot = h->ring + (pos & h->mask);
+  if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+    return false;
+  *object = slot->object;
+  __atomic_store_n(&slot->seq, pos + h->mask + 1, __ATOMIC_RELEASE);
+  h->dequeue_pos = pos + 1;
+  return true;
+}
+
+static void overflow_push(ac_object_pipe_t *h, void *object) {
+  pthread_mutex_lock(&h->mutex);
+  if (h->num_overflow == h->overflow_size) {
+    h->overflow_size = h->overflow_size ? h->overflow_size * 2 : 64;
+    h->overflow = (void **)ac_realloc(h->overflow,
+                                      sizeof(void *) * h->overflow_size);
+  }
+  h->overflow[h->num_overflow] = object;
+  __atomic_store_n(&h->num_overflow, h->num_overflow + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&h->mutex);
 }
 
 static void _destroy_object_pipe(uv_handle_t *h) {
   ac_object_pipe_t *op = (ac_object_pipe_t *)(h->data);
   if (op->close_cb)
     op->close_cb(op->cb_arg);
+  pthread_mutex_destroy(&op->mutex);
+  if (op->overflow)
+    ac_free(op->overflow);
+  if (op->held)
+    ac_free(op->held);
+  ac_free(op->ring);
   ac_free(op);
 }
 
-static void on_poll_receive(uv_poll_t *p, int status, int events) {
+static void on_async_receive(uv_async_t *p) {
   ac_object_pipe_t *h = (ac_object_pipe_t *)p->data;
-  char buffer[sizeof(void *) * 1];
-  int n;
-  while ((n = read(h->read_fd, buffer, sizeof(void *) * 1)) > 0) {
-    void **ptr = (void **)buffer;
-    void **ep = (void **)(buffer + n);
-    while (ptr < ep) {
-      if ((ssize_t)(*ptr) != -1) {
-        h->cb(h->cb_arg, *ptr);
-        ptr++;
-      } else {
-        uv_poll_stop(p);
-        close(h->read_fd);
-        close(h->write_fd);
-        h->write_fd = -1;
-        uv_close((uv_handle_t *)p, _destroy_object_pipe);
+  void *object;
+  while (true) {
+    /* ring slots claimed before the overflow was taken may still hold
+       objects which precede it, so those are delivered first.  If one of them
+       hasn't been filled in yet, try again on the next loop iteration. */
+    if (h->num_held) {
+      while (h->dequeue_pos != h->barrier && ring_pop(h, &object))
+        h->cb(h->cb_arg, object);
+      if (h->dequeue_pos != h->barrier) {
+        uv_async_send(p);
         return;
       }
+      for (size_t i = 0; i < h->num_held; i++)
+        h->cb(h->cb_arg, h->held[i]);
+      h->num_held = 0;
     }
+
+    while (ring_pop(h, &object))
+      h->cb(h->cb_arg, object);
+
+    if (!__atomic_load_n(&h->num_overflow, __ATOMIC_SEQ_CST))
+      break;
+
+    /* swap the overflow out so the callbacks run without the lock */
+    pthread_mutex_lock(&h->mutex);
+    void **held = h->held;
+    size_t held_size = h->held_size;
+    h->held = h->overflow;
+    h->held_size = h->overflow_size;
+    h->num_held = h->num_overflow;
+    h->overflow = held;
+    h->overflow_size = held_size;
+    h->barrier = __atomic_load_n(&h->enqueue_pos, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&h->num_overflow, 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&h->mutex);
+  }
+
+  if (__atomic_load_n(&h->closing, __ATOMIC_ACQUIRE) && !h->closed) {
+    __atomic_store_n(&h->closed, true, __ATOMIC_RELEASE);
+    uv_close((uv_handle_t *)p, _destroy_object_pipe);
   }
 }
 
@@ -84,23 +176,33 @@ ac_object_pipe_t *_ac_object_pipe_open(uv_loop_t *loop,
   ac_object_pipe_t *h =
       (ac_object_pipe_t *)ac_malloc(sizeof(ac_object_pipe_t));
 #endif
-  int fds[2];
-  int n = pipe(fds);
-  if (n < 0)
-    abort();
-
-  setnonblock(fds[0]);
-  setnonblock(fds[1]);
-
-  h->read_fd = fds[0];
-  h->write_fd = fds[1];
+  size_t size = AC_OBJECT_PIPE_RING_SIZE;
+  h->ring =
+      (ac_object_pipe_slot_t *)ac_malloc(sizeof(ac_object_pipe_slot_t) * size);
+  for (size_t i = 0; i < size; i++)
+    h->ring[i].seq = i;
+  h->mask = size - 1;
+  h->enqueue_pos = 0;
+  h->dequeue_pos = 0;
+
+  pthread_mutex_init(&h->mutex, NULL);
+  h->overflow = NULL;
+  h->overflow_size = 0;
+  h->num_overflow = 0;
+  h->held = NULL;
+  h->held_size = 0;
+  h->num_held = 0;
+  h->barrier = 0;
+
+  h->closing = false;
+  h->closed = false;
   h->cb = cb;
   h->cb_arg = arg;
   h->close_cb = NULL;
 
-  uv_poll_init(loop, &h->read_poll, fds[0]);
-  h->read_poll.data = h;
-  uv_poll_start(&h->read_poll, UV_READABLE, on_poll_receive);
+  if (uv_async_init(loop, &h->async, on_async_receive) != 0)
+    abort();
+  h->async.data = h;
   return h;
 }
 
@@ -109,19 +211,16 @@ void ac_object_pipe_set_close_cb(ac_object_pipe_t *h,
   h->close_cb = cb;
 }
 
-static void _object_pipe_write(ac_object_pipe_t *h, ssize_t object) {
-  if (h->write_fd == -1)
-    abort();
-  int n = write(h->write_fd, &object, sizeof(object));
-  (void)n;
-}
-
 void ac_object_pipe_write(ac_object_pipe_t *h, void *object) {
-  if ((ssize_t)(object) == -1) // protect -1 from getting through
-    return;
-  _object_pipe_write(h, (ssize_t)(object));
+  if (__atomic_load_n(&h->closed, __ATOMIC_ACQUIRE))
+    abort();
+  if (__atomic_load_n(&h->num_overflow, __ATOMIC_SEQ_CST) ||
+      !ring_push(h, object))
+    overflow_push(h, object);
+  uv_async_send(&h->async);
 }
 
 void ac_object_pipe_close(ac_object_pipe_t *h) {
-  _object_pipe_write(h, -1);
+  __atomic_store_n(&h->closing, true, __ATOMIC_RELEASE);
+  uv_async_send(&h->async);
 }
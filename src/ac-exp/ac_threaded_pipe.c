@@ -18,11 +18,27 @@ limitations under the License.
 
 #include "another-c-library/ac_allocator.h"
 
-#include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <unistd.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+/* Objects move between threads through a bounded ring (Vyukov's MPMC queue).
+   A slot is free for the producer at position pos when its seq is pos and
+   holds an object for the consumer when its seq is pos+1.  Consumers claim a
+   run of ready slots with a single CAS so that a busy worker pays for one
+   atomic operation per batch instead of a read() per object.  Workers only
+   sleep (on a futex where available) when the ring is empty, and writers only
+   make a wake up call when num_idle says someone is sleeping. */
+#define AC_THREADED_PIPE_RING_SIZE 4096
+#define AC_THREADED_PIPE_BATCH 32
+
 typedef struct {
   void *thread_arg;
   void *global_arg;
@@ -37,9 +53,27 @@ typedef struct {
   ac_threaded_pipe_cb cb;
 } ac_threaded_pipe_object_t;
 
+typedef struct {
+  size_t seq;
+  ac_threaded_pipe_object_t o;
+} ac_threaded_pipe_slot_t;
+
 struct ac_threaded_pipe_s {
-  int read_fd;
-  int write_fd;
+  ac_threaded_pipe_slot_t *ring;
+  size_t mask;
+  char pad0[64];
+  size_t enqueue_pos;
+  char pad1[64];
+  size_t dequeue_pos;
+  char pad2[64];
+  uint32_t wake_seq;
+  uint32_t num_idle;
+  bool closing;
+#ifndef __linux__
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+#endif
+
   ac_threaded_pipe_cb cb;
   thread_data_t *threads;
   int num_threads;
@@ -125,11 +159,100 @@ void *update_task(void *arg) {
   }
 }
 
+static bool ring_push(ac_threaded_pipe_t *h, ac_threaded_pipe_object_t *o) {
+  size_t pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    ac_threaded_pipe_slot_t *slot = h->ring + (pos & h->mask);
+    size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+    if (!diff) {
+      if (__atomic_compare_exchange_n(&h->enqueue_pos, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        slot->o = *o;
+        __atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+        return true;
+      }
+    } else if (diff < 0)
+      return false; /* full */
+    else
+      pos = __atomic_load_n(&h->enqueue_pos, __ATOMIC_RELAXED);
+  }
+}
+
+/* claim up to max consecutive ready slots and copy them into objs */
+static size_t ring_pop(ac_threaded_pipe_t *h, ac_threaded_pipe_object_t *objs,
+                       size_t max) {
+  size_t pos = __atomic_load_n(&h->dequeue_pos, __ATOMIC_RELAXED);
+  while (true) {
+    size_t n = 0;
+    while (n < max) {
+      ac_threaded_pipe_slot_t *slot = h->ring + ((pos + n) & h->mask);
+      if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + n + 1)
+        break;
+      n++;
+    }
+    if (!n) {
+      size_t cur = __atomic_load_n(&h->dequeue_pos, __ATOMIC_RELAXED);
+      if (cur == pos)
+        return 0;
+      pos = cur;
+      continue;
+    }
+    if (__atomic_compare_exchange_n(&h->dequeue_pos, &pos, pos + n, true,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+      for (size_t i = 0; i < n; i++) {
+        ac_threaded_pipe_slot_t *slot = h->ring + ((pos + i) & h->mask);
+        objs[i] = slot->o;
+        __atomic_store_n(&slot->seq, pos + i + h->mask + 1, __ATOMIC_RELEASE);
+      }
+      return n;
+    }
+  }
+}
+
+static bool ring_empty(ac_threaded_pipe_t *h) {
+  size_t pos = __atomic_load_n(&h->dequeue_pos, __ATOMIC_SEQ_CST);
+  ac_threaded_pipe_slot_t *slot = h->ring + (pos & h->mask);
+  return __atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != pos + 1;
+}
+
+static void wake_workers(ac_threaded_pipe_t *h, int n) {
+  __atomic_add_fetch(&h->wake_seq, 1, __ATOMIC_SEQ_CST);
+#ifdef __linux__
+  syscall(SYS_futex, &h->wake_seq, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+#else
+  pthread_mutex_lock(&h->mutex);
+  if (n == 1)
+    pthread_cond_signal(&h->cond);
+  else
+    pthread_cond_broadcast(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+#endif
+}
+
+/* num_idle is raised before the ring is checked so that a writer either sees
+   the idle worker or the worker sees the written object.  wake_seq is sampled
+   first so that a wake up between the check and the wait is not lost. */
+static void wait_for_work(ac_threaded_pipe_t *h) {
+  uint32_t seq = __atomic_load_n(&h->wake_seq, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&h->num_idle, 1, __ATOMIC_SEQ_CST);
+  if (ring_empty(h) && !__atomic_load_n(&h->closing, __ATOMIC_SEQ_CST)) {
+#ifdef __linux__
+    syscall(SYS_futex, &h->wake_seq, FUTEX_WAIT_PRIVATE, seq, NULL, NULL, 0);
+#else
+    pthread_mutex_lock(&h->mutex);
+    while (__atomic_load_n(&h->wake_seq, __ATOMIC_SEQ_CST) == seq)
+      pthread_cond_wait(&h->cond, &h->mutex);
+    pthread_mutex_unlock(&h->mutex);
+#endif
+  }
+  __atomic_sub_fetch(&h->num_idle, 1, __ATOMIC_SEQ_CST);
+}
+
 void *do_task(void *arg) {
   thread_data_t *t = (thread_data_t *)arg;
   ac_threaded_pipe_t *h = t->h;
-  int n;
-  ac_threaded_pipe_object_t obj;
+  ac_threaded_pipe_object_t objs[AC_THREADED_PIPE_BATCH];
 
   while (true) {
     /* I think this is a safe way to avoid a mutex */
@@ -153,20 +276,19 @@ void *do_task(void *arg) {
         t->new_args[6] = NULL;
       }
     }
-    if (h->clear_thread_arg)
-      h->clear_thread_arg(t->thread_arg);
-    n = read(h->read_fd, &obj, sizeof(obj));
-    if (n > 0) {
-      if ((ssize_t)(obj.object) != -1) {
-        obj.cb(t->global_arg, t->thread_arg, obj.object, obj.arg);
-      } else {
-        close(h->read_fd);
-        close(h->write_fd);
-        h->write_fd = -1;
+    size_t n = ring_pop(h, objs, AC_THREADED_PIPE_BATCH);
+    if (!n) {
+      /* remaining objects are drained before the workers exit */
+      if (__atomic_load_n(&h->closing, __ATOMIC_SEQ_CST) && ring_empty(h))
         return NULL;
-      }
-    } else
-      break;
+      wait_for_work(h);
+      continue;
+    }
+    for (size_t i = 0; i < n; i++) {
+      if (h->clear_thread_arg)
+        h->clear_thread_arg(t->thread_arg);
+      objs[i].cb(t->global_arg, t->thread_arg, objs[i].object, objs[i].arg);
+    }
   }
   return NULL;
 }
@@ -197,6 +319,13 @@ ac_threaded_pipe_t *_ac_threaded_pipe_init(int num_threads) {
   h->close_cb = NULL;
   h->parent_pid = getppid();
   h->done = false;
+  h->ring = NULL;
+  h->mask = 0;
+  h->enqueue_pos = 0;
+  h->dequeue_pos = 0;
+  h->wake_seq = 0;
+  h->num_idle = 0;
+  h->closing = false;
   return h;
 }
 
@@ -236,29 +365,30 @@ void ac_threaded_pipe_set_close_cb(ac_threaded_pipe_t *h,
 
 bool ac_threaded_pipe_write(ac_threaded_pipe_t *h, ac_threaded_pipe_cb cb,
                               void *object, void *arg) {
-  if (h->write_fd == -1 || (ssize_t)(object) == -1 ||
-      (ssize_t)(object) == -2) // protect -1 from getting through
+  if (!h->ring || __atomic_load_n(&h->closing, __ATOMIC_SEQ_CST))
     return false;
   ac_threaded_pipe_object_t o;
   o.object = object;
   o.arg = arg;
   o.cb = cb;
-  int n = write(h->write_fd, &o, sizeof(o));
-  (void)n;
+  /* a full ring applies back pressure instead of dropping the object */
+  while (!ring_push(h, &o)) {
+    if (__atomic_load_n(&h->num_idle, __ATOMIC_SEQ_CST))
+      wake_workers(h, h->num_threads);
+    sched_yield();
+  }
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->num_idle, __ATOMIC_SEQ_CST))
+    wake_workers(h, 1);
   return true;
 }
 
 void ac_threaded_pipe_close(ac_threaded_pipe_t *h) {
-  if (h->write_fd == -1)
+  if (!h->ring || __atomic_load_n(&h->closing, __ATOMIC_SEQ_CST))
     return;
 
-  ac_threaded_pipe_object_t o;
-  ssize_t v = -1;
-  o.object = (void *)(v);
-  o.arg = NULL;
-  o.cb = NULL;
-  int n = write(h->write_fd, &o, sizeof(o));
-  (void)n;
+  __atomic_store_n(&h->closing, true, __ATOMIC_SEQ_CST);
+  wake_workers(h, h->num_threads);
   h->done = true;
   if (h->update_interval)
     pthread_join(h->update_thread, NULL);
@@ -271,29 +401,25 @@ void ac_threaded_pipe_close(ac_threaded_pipe_t *h) {
     h->destroy_global_arg(h->update_arg, h->global_arg);
   if (h->close_cb)
     h->close_cb(h->close_arg);
+#ifndef __linux__
+  pthread_cond_destroy(&h->cond);
+  pthread_mutex_destroy(&h->mutex);
+#endif
+  ac_free(h->ring);
   ac_free(h);
 }
 
-static void setnonblock(int fd) {
-  int flags = fcntl(fd, F_GETFL);
-  if (flags < 0)
-    abort();
-
-  flags |= O_NONBLOCK;
-  if (fcntl(fd, F_SETFL, flags) < 0)
-    abort();
-}
-
 void ac_threaded_pipe_open(ac_threaded_pipe_t *h) {
-  int fds[2];
-  int n = pipe(fds);
-  if (n < 0)
-    abort();
-
-  setnonblock(fds[1]);
-
-  h->read_fd = fds[0];
-  h->write_fd = fds[1];
+  size_t size = AC_THREADED_PIPE_RING_SIZE;
+  h->ring = (ac_threaded_pipe_slot_t *)ac_malloc(
+      sizeof(ac_threaded_pipe_slot_t) * size);
+  for (size_t i = 0; i < size; i++)
+    h->ring[i].seq = i;
+  h->mask = size - 1;
+#ifndef __linux__
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->cond, NULL);
+#endif
   void *global_arg = h->global_arg;
   for (int i = 0; i < h->num_threads; i++) {
     thread_data_t *t = h->threads + i;
@@ -13,6 +13,8 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include "ac_read_ahead.h"
+
 void ac_out_destroy(ac_out_t *out);
 
 typedef ac_io_record_t *(*ac_in_advance_cb)(ac_in_t *h);
@@ -119,6 +121,7 @@ struct ac_in_s {
   uint32_t fixed;
 
   ac_lz4_t *lz4;
+  ac_read_ahead_t *read_ahead;
   ac_buffer_t *bh; // for overflow
   ac_in_buffer_t buf;
   uint32_t block_size;
@@ -417,6 +420,8 @@ void ac_in_destroy(ac_in_t *h) {
   else if (h->type == AC_IN_CB_TYPE)
     ac_in_destroy_from_cb(h);
   else {
+    if (h->read_ahead)
+      ac_read_ahead_destroy(h->read_ahead);
     if (h->base)
       ac_in_base_destroy(h->base);
     if (h->lz4)
@@ -466,7 +471,29 @@ static int read_lz4_block(ac_in_t *h, ac_in_buffer_t *dest) {
   return n;
 }
 
+/* runs on the read ahead thread */
+static int read_lz4_block_ahead(void *arg, char *dest, size_t len) {
+  ac_in_buffer_t b;
+  b.buffer = dest;
+  b.used = 0;
+  b.size = len;
+  return read_lz4_block((ac_in_t *)arg, &b);
+}
+
 static void fill_blocks(ac_in_t *h, ac_in_buffer_t *dest) {
+  if (h->read_ahead) {
+    while (dest->used + h->block_size <= dest->size) {
+      size_t n;
+      char *p = ac_read_ahead_next(h->read_ahead, &n);
+      if (!p) {
+        dest->eof = true;
+        return;
+      }
+      memcpy(dest->buffer + dest->used, p, n);
+      dest->used += n;
+    }
+    return;
+  }
   while (1) {
     if (dest->used + h->block_size <= dest->size) {
       if (read_lz4_block(h, dest) <= 0) {
@@ -602,10 +629,19 @@ ac_in_t *_ac_in_init(const char *filename, int fd, bool can_close, void *buf,
       h->advance = _advance_fixed_lz4;
     } else
       h->advance = _advance_prefix_lz4;
+    if (options->io_uring)
+      ac_in_base_io_uring(base, options->io_uring);
+    if (options->read_ahead)
+      h->read_ahead = ac_read_ahead_init(options->read_ahead, block_size,
+                                         read_lz4_block_ahead, h);
     // printf("%p filling\n", h);
     fill_blocks(h, &(h->buf));
     // printf("%p filled: %lu, %s\n", h, buffer_size, filename ? filename : "");
   } else {
+    if (options->io_uring)
+      ac_in_base_io_uring(base, options->io_uring);
+    if (options->read_ahead)
+      ac_in_base_read_ahead(base, options->read_ahead);
     h = (ac_in_t *)ac_calloc(sizeof(ac_in_t));
     h->options = *options;
     h->base = base;
@@ -1224,6 +1260,14 @@ void ac_in_options_compressed_buffer_size(ac_in_options_t *h,
   h->compressed_buffer_size = buffer_size;
 }
 
+void ac_in_options_read_ahead(ac_in_options_t *h, size_t num_blocks) {
+  h->read_ahead = num_blocks;
+}
+
+void ac_in_options_io_uring(ac_in_options_t *h, size_t num_blocks) {
+  h->io_uring = num_blocks;
+}
+
 void ac_in_options_reducer(ac_in_options_t *h, ac_io_compare_cb compare,
                            void *compare_arg, ac_io_reducer_cb reducer,
                            void *reducer_arg) {
@@ -1236,117 +1280,248 @@ void ac_in_options_reducer(ac_in_options_t *h, ac_io_compare_cb compare,
 /*****************************************************************************
   ac_in_ext... functionality
 
-  in_heap_t tracks a heap full of ac_in_t objects and sorts based upon given
-  comparison function.
+  in_tree_t is a tournament (loser) tree over the ac_in_t objects being merged.
+  Leaf i lives at node num_leaves+i, internal nodes are 1..num_leaves-1 and
+  hold the loser of the match played there.  losers[0] holds the overall
+  winner.  Advancing the winner only needs one pass from its leaf to the root
+  (log2(k) comparisons instead of the roughly 2*log2(k) of a binary heap).
+  Exhausted inputs are NULL and lose to everything.  Ties are broken by the
+  leaf index so that the merge is stable.
+
+  The current record of each leaf is cached next to the tree so that a match
+  doesn't have to go through the ac_in_t.  When the comparison is
+  ac_io_compare_uint32_t or ac_io_compare_uint64_t, the key is cached as well
+  and compared inline instead of through the callback.
 */
 
-struct in_heap_s;
-typedef struct in_heap_s in_heap_t;
+enum { IN_TREE_CALLBACK = 0, IN_TREE_UINT32 = 1, IN_TREE_UINT64 = 2 };
 
-struct in_heap_s {
-  ssize_t size;
-  ssize_t max_size;
-  ac_in_t **heap;
+typedef struct {
+  ac_in_t **leaves;
+  ac_io_record_t **records;
+  uint64_t *keys;
+  size_t *losers;
+  uint8_t *marked;
+  size_t num_leaves;
+  size_t max_leaves;
+  int key_type;
   ac_io_compare_cb compare;
   void *compare_arg;
-};
-
-static inline void in_heap_init(in_heap_t *h, ssize_t mx,
-                                ac_io_compare_cb compare, void *arg) {
-  h->size = 0;
-  if (mx < 2)
-    mx = 2;
-  h->max_size = mx;
-  h->heap = (ac_in_t **)ac_malloc((mx + 1) * sizeof(ac_in_t *));
-  h->compare = compare;
-  h->compare_arg = arg;
+} in_tree_t;
+
+static inline void in_tree_init(in_tree_t *t, ac_io_compare_cb compare,
+                                void *arg) {
+  memset(t, 0, sizeof(*t));
+  t->compare = compare;
+  t->compare_arg = arg;
+  if (compare == ac_io_compare_uint32_t)
+    t->key_type = IN_TREE_UINT32;
+  else if (compare == ac_io_compare_uint64_t)
+    t->key_type = IN_TREE_UINT64;
+  else
+    t->key_type = IN_TREE_CALLBACK;
+}
+
+static inline void in_tree_destroy(in_tree_t *t) {
+  for (size_t i = 0; i < t->num_leaves; i++) {
+    if (t->leaves[i])
+      ac_in_destroy(t->leaves[i]);
+  }
+  if (t->leaves)
+    ac_free(t->leaves);
+}
+
+/* refresh the cached record and key after the leaf's input moved */
+static inline void in_tree_set(in_tree_t *t, size_t leaf) {
+  ac_in_t *in = t->leaves[leaf];
+  ac_io_record_t *r = in ? in->current : NULL;
+  t->records[leaf] = r;
+  if (!r)
+    t->keys[leaf] = UINT64_MAX;
+  else if (t->key_type == IN_TREE_UINT32)
+    t->keys[leaf] = *(uint32_t *)r->record;
+  else if (t->key_type == IN_TREE_UINT64)
+    t->keys[leaf] = *(uint64_t *)r->record;
+}
+
+/* compare the cached records of two leaves which are not exhausted */
+static inline int in_tree_compare(in_tree_t *t, size_t a, size_t b) {
+  if (t->key_type != IN_TREE_CALLBACK) {
+    uint64_t x = t->keys[a], y = t->keys[b];
+    return x != y ? (x < y ? -1 : 1) : 0;
+  }
+  return t->compare(t->records[a], t->records[b], t->compare_arg);
 }
 
-static inline void in_heap_clear(in_heap_t *h) { h->size = 0; }
-
-static inline size_t in_heap_max(in_heap_t *h) { return h->max_size; }
-
-static inline void in_heap_destroy(in_heap_t *h) {
-  if (!h)
-    return;
-
-  ac_free(h->heap);
+/* true if leaf a wins against leaf b */
+static inline bool in_tree_less(in_tree_t *t, size_t a, size_t b) {
+  if (t->key_type != IN_TREE_CALLBACK) {
+    /* exhausted leaves have a key of UINT64_MAX, which a uint64_t key can
+       also have, so only check for them on a tie */
+    uint64_t x = t->keys[a], y = t->keys[b];
+    if (x != y)
+      return x < y;
+  }
+  ac_io_record_t *x = t->records[a];
+  ac_io_record_t *y = t->records[b];
+  if (!x)
+    return false;
+  if (!y)
+    return true;
+  if (t->key_type == IN_TREE_CALLBACK) {
+    int n = t->compare(x, y, t->compare_arg);
+    if (n)
+      return n < 0;
+  }
+  return a < b;
 }
 
-static inline ac_in_t **in_heap_base(in_heap_t *h) { return h->heap; }
-
-static inline size_t in_heap_size(in_heap_t *h) { return h->size; }
-
-static inline int in_heap_compare(in_heap_t *h, ac_in_t *a, ac_in_t *b) {
-  return h->compare(a->current, b->current, h->compare_arg);
+/* advance the input of leaf, destroying it once it is finished */
+static inline void in_tree_advance(in_tree_t *t, size_t leaf) {
+  ac_in_t *in = t->leaves[leaf];
+  if (!ac_in_advance(in)) {
+    ac_in_destroy(in);
+    t->leaves[leaf] = NULL;
+  }
+  in_tree_set(t, leaf);
+}
+
+static inline void in_tree_add(in_tree_t *t, ac_in_t *in) {
+  if (t->num_leaves >= t->max_leaves) {
+    size_t max_leaves = t->max_leaves ? t->max_leaves * 2 : 16;
+    ac_in_t **leaves = (ac_in_t **)ac_malloc(
+        (sizeof(ac_in_t *) + sizeof(ac_io_record_t *) + sizeof(uint64_t) +
+         sizeof(size_t) + 2) *
+        max_leaves);
+    if (t->num_leaves)
+      memcpy(leaves, t->leaves, sizeof(ac_in_t *) * t->num_leaves);
+    if (t->leaves)
+      ac_free(t->leaves);
+    t->leaves = leaves;
+    t->keys = (uint64_t *)(leaves + max_leaves);
+    t->records = (ac_io_record_t **)(t->keys + max_leaves);
+    t->losers = (size_t *)(t->records + max_leaves);
+    for (size_t i = 0; i < t->num_leaves; i++)
+      in_tree_set(t, i);
+    t->marked = (uint8_t *)(t->losers + max_leaves);
+    memset(t->marked, 0, max_leaves * 2);
+    t->max_leaves = max_leaves;
+  }
+  t->leaves[t->num_leaves] = in;
+  in_tree_set(t, t->num_leaves);
+  t->num_leaves++;
 }
 
-static inline int in_heap_compare2(in_heap_t *h, ac_io_record_t *a,
-                                   ac_in_t *b) {
-  return h->compare(a, b->current, h->compare_arg);
-}
+static inline size_t in_tree_max(in_tree_t *t) { return t->max_leaves; }
 
-void test_heap(in_heap_t *h) {
-  for (size_t i = 1; i <= h->size; i++) {
-    if (h->heap[i] == NULL)
-      abort();
+/* play every match again, used after inputs are added */
+static void in_tree_build(in_tree_t *t) {
+  size_t k = t->num_leaves;
+  if (k < 2) {
+    t->losers[0] = 0;
+    return;
   }
+  size_t *winners = (size_t *)ac_malloc(sizeof(size_t) * k);
+  for (size_t p = k - 1; p > 0; p--) {
+    size_t c = p << 1;
+    size_t a = c >= k ? c - k : winners[c];
+    c++;
+    size_t b = c >= k ? c - k : winners[c];
+    if (in_tree_less(t, b, a)) {
+      winners[p] = b;
+      t->losers[p] = a;
+    } else {
+      winners[p] = a;
+      t->losers[p] = b;
+    }
+  }
+  t->losers[0] = winners[1];
+  ac_free(winners);
 }
 
-static inline void in_heap_push(in_heap_t *h, ac_in_t *item) {
-  if (h->size >= h->max_size) {
-    h->max_size = h->size * 2;
-    ac_in_t **heap =
-        (ac_in_t **)ac_malloc((h->max_size + 1) * sizeof(ac_in_t *));
-    memcpy(heap, h->heap, ((h->size + 1) * sizeof(ac_in_t *)));
-    ac_free(h->heap);
-    h->heap = heap;
-  }
-  h->size++;
-  ssize_t num = h->size;
-  ac_in_t **heap = h->heap;
-  // ac_in_t *tmp = heap[num];
-  heap[num] = item;
-  // heap[0] = tmp;
-  ssize_t i = num;
-  ssize_t j = i >> 1;
-  ac_in_t *tmp;
-
-  while (j > 0 && in_heap_compare(h, heap[i], heap[j]) < 0) {
-    tmp = heap[i];
-    heap[i] = heap[j];
-    heap[j] = tmp;
-    i = j;
-    j = j >> 1;
-  }
-}
-
-static inline ac_in_t *in_heap_pop(in_heap_t *h) {
-  h->size--;
-  ssize_t num = h->size;
-  ac_in_t **heap = h->heap;
-  ac_in_t *r = heap[1];
-  heap[1] = heap[num + 1];
-
-  ssize_t i = 1;
-  ssize_t j = i << 1;
-  ssize_t k = j + 1;
-
-  if (k <= num && in_heap_compare(h, heap[k], heap[j]) < 0)
-    j = k;
-
-  while (j <= num && in_heap_compare(h, heap[j], heap[i]) < 0) {
-    ac_in_t *tmp = heap[i];
-    heap[i] = heap[j];
-    heap[j] = tmp;
-
-    i = j;
-    j = i << 1;
-    k = j + 1;
-    if (k <= num && in_heap_compare(h, heap[k], heap[j]) < 0)
-      j = k;
+static inline ac_in_t *in_tree_winner(in_tree_t *t, size_t *leaf) {
+  if (!t->num_leaves)
+    return NULL;
+  *leaf = t->losers[0];
+  return t->leaves[*leaf];
+}
+
+/* leaf must be the current winner, its input was advanced (or is NULL) */
+static inline void in_tree_replay(in_tree_t *t, size_t leaf) {
+  size_t *losers = t->losers;
+  size_t w = leaf;
+  for (size_t n = (t->num_leaves + leaf) >> 1; n > 0; n >>= 1) {
+    size_t l = losers[n];
+    if (in_tree_less(t, l, w)) {
+      losers[n] = w;
+      w = l;
+    }
   }
-  return r;
+  losers[0] = w;
+}
+
+static size_t in_tree_replay_marked(in_tree_t *t, size_t p) {
+  size_t k = t->num_leaves;
+  t->marked[p] = 0;
+  if (p >= k)
+    return p - k;
+
+  size_t c = p << 1;
+  size_t a = t->marked[c] ? in_tree_replay_marked(t, c) : t->losers[p];
+  c++;
+  size_t b = t->marked[c] ? in_tree_replay_marked(t, c) : t->losers[p];
+  if (in_tree_less(t, b, a)) {
+    t->losers[p] = a;
+    return b;
+  }
+  t->losers[p] = b;
+  return a;
+}
+
+/* Replay after every leaf that tied for the win was advanced.  Each node on
+   the path of such a leaf is marked.  A node that isn't marked has no tied
+   leaf below it, so its winner lost to a tied leaf at the parent and is the
+   loser stored there. */
+static void in_tree_replay_group(in_tree_t *t, size_t *group,
+                                 size_t num_group) {
+  size_t k = t->num_leaves;
+  uint8_t *marked = t->marked;
+  for (size_t i = 0; i < num_group; i++) {
+    size_t n = k + group[i];
+    marked[n] = 1;
+    for (n >>= 1; n > 0 && !marked[n]; n >>= 1)
+      marked[n] = 1;
+  }
+  if (k < 2) {
+    marked[k] = 0;
+    t->losers[0] = 0;
+    return;
+  }
+  t->losers[0] = in_tree_replay_marked(t, 1);
+}
+
+/* Find all of the leaves which compare equal to the winner.  A tied leaf
+   can only have lost to another tied leaf, so it is enough to look at the
+   losers along the path of each tied leaf below the point where it lost.
+   group[0] is the winner. */
+static size_t in_tree_group(in_tree_t *t, size_t *group, size_t *tops) {
+  size_t k = t->num_leaves;
+  size_t w = t->losers[0];
+  size_t num_group = 1;
+  group[0] = w;
+  tops[0] = 0;
+  for (size_t i = 0; i < num_group; i++) {
+    size_t top = tops[i];
+    for (size_t n = (k + group[i]) >> 1; n > top; n >>= 1) {
+      size_t l = t->losers[n];
+      if (t->records[l] && !in_tree_compare(t, w, l)) {
+        group[num_group] = l;
+        tops[num_group] = n;
+        num_group++;
+      }
+    }
+  }
+  return num_group;
 }
 
 /*
@@ -1373,12 +1548,15 @@ typedef struct {
   void (*destroy_out)(ac_out_t *out);
   ac_buffer_t *group_bh;
 
-  ac_in_t **active;
+  /* leaves of the tree which were returned by the last advance */
+  size_t *active;
+  size_t *tops;
   size_t num_active;
   size_t active_size;
   ac_io_record_t *r;
 
-  in_heap_t heap;
+  in_tree_t tree;
+  bool rebuild;
 
   ac_buffer_t *reducer_bh;
   ac_io_reducer_cb reducer;
@@ -1401,7 +1579,7 @@ ac_in_t *ac_in_ext_init(ac_io_compare_cb compare, void *arg,
   h->compare = compare;
   h->compare_arg = arg;
   h->options = *options;
-  in_heap_init(&(h->heap), 0, compare, arg);
+  in_tree_init(&(h->tree), compare, arg);
 
   _ac_in_empty((ac_in_t *)h);
   return (ac_in_t *)h;
@@ -1412,18 +1590,10 @@ void ac_in_ext_destroy(ac_in_t *hp) {
   if (!h)
     return;
 
-  for (size_t i = 0; i < h->num_active; i++)
-    ac_in_destroy(h->active[i]);
-
   if (h->active)
     ac_free(h->active);
 
-  in_heap_t *heap = &(h->heap);
-
-  while (in_heap_size(heap))
-    ac_in_destroy(in_heap_pop(heap));
-
-  in_heap_destroy(heap);
+  in_tree_destroy(&(h->tree));
 
   if (h->reducer_bh)
     ac_buffer_destroy(h->reducer_bh);
@@ -1437,21 +1607,17 @@ void ac_in_ext_destroy(ac_in_t *hp) {
   ac_free(h);
 }
 
-static void move_active_to_heap(ac_in_ext_t *h, bool advance) {
-  if (!h)
-    return;
-
-  in_heap_t *heap = &(h->heap);
-  for (size_t i = 0; i < h->num_active; i++) {
-    ac_in_t *in = h->active[i];
-    if (advance) {
-      if (!ac_in_advance(in)) {
-        ac_in_destroy(in);
-        continue;
-      }
-    }
-    in_heap_push(heap, in);
-  }
+static void advance_active(ac_in_ext_t *h) {
+  in_tree_t *tree = &(h->tree);
+  for (size_t i = 0; i < h->num_active; i++)
+    in_tree_advance(tree, h->active[i]);
+  if (h->rebuild) {
+    in_tree_build(tree);
+    h->rebuild = false;
+  } else if (h->num_active == 1)
+    in_tree_replay(tree, h->active[0]);
+  else if (h->num_active)
+    in_tree_replay_group(tree, h->active, h->num_active);
   h->num_active = 0;
 }
 
@@ -1460,11 +1626,11 @@ ac_io_record_t *ac_in_ext_advance(ac_in_t *hp) {
     return NULL;
 
   ac_in_ext_t *h = (ac_in_ext_t *)hp;
-  move_active_to_heap(h, true);
-  in_heap_t *heap = &(h->heap);
-  if (in_heap_size(heap)) {
-    ac_in_t *in = in_heap_pop(heap);
-    h->active[0] = in;
+  advance_active(h);
+  size_t leaf;
+  ac_in_t *in = in_tree_winner(&(h->tree), &leaf);
+  if (in) {
+    h->active[0] = leaf;
     h->num_active = 1;
     h->current = ac_in_current(in);
     return h->current;
@@ -1479,22 +1645,12 @@ ac_io_record_t *ac_in_ext_advance_unique(ac_in_t *hp, size_t *num_r) {
     return NULL;
 
   ac_in_ext_t *h = (ac_in_ext_t *)hp;
-  in_heap_t *heap = &(h->heap);
-  ac_in_t **activep = h->active + 1;
+  in_tree_t *tree = &(h->tree);
+  h->num_active = in_tree_group(tree, h->active, h->tops);
   ac_io_record_t *rp = h->r;
   *rp++ = *first;
-  ac_in_t *in = NULL;
-  while (in_heap_size(heap)) {
-    in = in_heap_pop(heap);
-    if (!in_heap_compare2(heap, first, in)) {
-      *activep++ = in;
-      *rp++ = *ac_in_current(in);
-    } else {
-      in_heap_push(heap, in);
-      break;
-    }
-  }
-  h->num_active = activep - h->active;
+  for (size_t i = 1; i < h->num_active; i++)
+    *rp++ = *ac_in_current(tree->leaves[h->active[i]]);
   h->num_current = h->num_active;
   h->current = h->r;
   *num_r = h->num_current;
@@ -1531,19 +1687,22 @@ void ac_in_ext_add(ac_in_t *hp, ac_in_t *in, int tag) {
     return;
   }
 
-  in_heap_t *heap = &(h->heap);
-  move_active_to_heap(h, false);
-  in_heap_push(heap, in);
+  /* inputs are normally added before the merge starts, so the tree is
+     rebuilt on the next advance rather than after every add */
+  in_tree_t *tree = &(h->tree);
+  in_tree_add(tree, in);
+  h->rebuild = true;
+  h->num_active = 0;
 
-  if (h->active_size < in_heap_size(heap)) {
+  if (h->active_size < in_tree_max(tree)) {
     if (h->active)
       ac_free(h->active);
-    h->active_size = in_heap_max(heap);
-    h->active = (ac_in_t **)ac_malloc(
-        (sizeof(ac_in_t *) + sizeof(ac_io_record_t)) * h->active_size);
-    h->r = (ac_io_record_t *)(h->active + h->active_size);
+    h->active_size = in_tree_max(tree);
+    h->active = (size_t *)ac_malloc(
+        ((sizeof(size_t) * 2) + sizeof(ac_io_record_t)) * h->active_size);
+    h->tops = h->active + h->active_size;
+    h->r = (ac_io_record_t *)(h->tops + h->active_size);
   }
-  h->num_active = 0;
 
   if (h->advance == empty_record) {
     if (h->reducer)
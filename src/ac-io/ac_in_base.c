@@ -3,6 +3,9 @@
 #include "another-c-library/ac_allocator.h"
 #include "another-c-library/ac_buffer.h"
 
+#include "ac_read_ahead.h"
+#include "ac_uring.h"
+
 #include <errno.h>
 #include <fcntl.h>
 #include <time.h>
@@ -18,8 +21,19 @@ struct ac_in_base_s {
   ac_buffer_t *bh;
   char *zerop;
   char zero;
+
+  ac_read_ahead_t *read_ahead;
+  ac_uring_file_t *uring;
 };
 
+static int read_ahead_fd(void *arg, char *dest, size_t len) {
+  return read((int)(intptr_t)arg, dest, len);
+}
+
+static int read_ahead_gz(void *arg, char *dest, size_t len) {
+  return gzread((gzFile)arg, dest, len);
+}
+
 static inline void reset_block(ac_in_buffer_t *b) {
   memmove(b->buffer, b->buffer + b->pos, b->used - b->pos);
   b->used -= b->pos;
@@ -32,7 +46,15 @@ static void fill_blocks(ac_in_base_t *h, ac_in_buffer_t *b) {
 
   int bytes = b->size - b->used;
   int n;
-  if (h->fd != -1)
+  if (h->read_ahead)
+    n = ac_read_ahead_copy(h->read_ahead, b->buffer + b->used, bytes);
+  else if (h->uring) {
+    n = ac_uring_file_copy(h->uring, b->buffer + b->used, bytes);
+    /* don't let a failed read pass for the end of the input */
+    if (n < 0)
+      abort();
+  }
+  else if (h->fd != -1)
     n = read(h->fd, b->buffer + b->used, bytes);
   else if (h->gz)
     n = gzread(h->gz, b->buffer + b->used, bytes);
@@ -82,6 +104,28 @@ ac_in_base_t *ac_in_base_reinit(ac_in_base_t *base, size_t buffer_size) {
   return h;
 }
 
+void ac_in_base_read_ahead(ac_in_base_t *h, size_t num_blocks) {
+  if (h->read_ahead || h->uring || h->buf.eof)
+    return;
+  /* pass the descriptor and not h as ac_in_base_reinit moves h */
+  if (h->fd != -1)
+    h->read_ahead = ac_read_ahead_init(num_blocks, h->buf.size, read_ahead_fd,
+                                       (void *)(intptr_t)h->fd);
+  else if (h->gz)
+    h->read_ahead =
+        ac_read_ahead_init(num_blocks, h->buf.size, read_ahead_gz, h->gz);
+}
+
+void ac_in_base_io_uring(ac_in_base_t *h, size_t num_blocks) {
+  if (h->read_ahead || h->uring || h->buf.eof || h->fd == -1)
+    return;
+  /* reads are issued at explicit offsets starting where read() left off */
+  off_t offset = lseek(h->fd, 0, SEEK_CUR);
+  if (offset == -1)
+    return;
+  h->uring = ac_uring_file_init(h->fd, offset, num_blocks, h->buf.size);
+}
+
 ac_in_base_t *ac_in_base_init_gz(const char *filename, int fd, bool can_close,
                                  size_t buffer_size) {
   gzFile gz = NULL;
@@ -454,6 +498,10 @@ char *ac_in_base_read(ac_in_base_t *h, int32_t len) {
 }
 
 void ac_in_base_destroy(ac_in_base_t *h) {
+  if (h->read_ahead)
+    ac_read_ahead_destroy(h->read_ahead);
+  if (h->uring)
+    ac_uring_file_destroy(h->uring);
   if (h->bh)
     ac_buffer_destroy(h->bh);
   if (h->buf.can_free)
@@ -18,6 +18,8 @@ limitations under the License.
 
 #include "another-c-library/ac_allocator.h"
 
+#include "lz4/xxhash.h"
+
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -39,6 +41,35 @@ bool ac_io_keep_first(ac_io_record_t *res, const ac_io_record_t *r,
   return true;
 }
 
+int ac_io_compare_uint64_t(const ac_io_record_t *p1, const ac_io_record_t *p2,
+                           void *tag) {
+  uint64_t *a = (uint64_t *)p1->record;
+  uint64_t *b = (uint64_t *)p2->record;
+  if (*a != *b)
+    return (*a < *b) ? -1 : 1;
+  return 0;
+}
+
+int ac_io_compare_uint32_t(const ac_io_record_t *p1, const ac_io_record_t *p2,
+                           void *tag) {
+  uint32_t *a = (uint32_t *)p1->record;
+  uint32_t *b = (uint32_t *)p2->record;
+  if (*a != *b)
+    return (*a < *b) ? -1 : 1;
+  return 0;
+}
+
+int ac_io_compare_bytes(const ac_io_record_t *p1, const ac_io_record_t *p2,
+                        void *tag) {
+  uint32_t len = p1->length < p2->length ? p1->length : p2->length;
+  int n = memcmp(p1->record, p2->record, len);
+  if (n)
+    return n;
+  if (p1->length != p2->length)
+    return (p1->length < p2->length) ? -1 : 1;
+  return 0;
+}
+
 size_t ac_io_hash_partition(const ac_io_record_t *r, size_t num_part,
                             void *arg) {
   size_t offs = arg ? (*(size_t *)arg) : 0;
@@ -46,6 +77,120 @@ size_t ac_io_hash_partition(const ac_io_record_t *r, size_t num_part,
   return hash % num_part;
 }
 
+struct ac_io_range_partition_s {
+  ac_io_compare_cb compare;
+  void *compare_arg;
+
+  ac_io_record_t *samples;
+  size_t num_samples;
+  size_t max_samples;
+  uint64_t num_seen;
+  uint64_t rand;
+
+  ac_io_record_t *splits;
+  size_t num_splits;
+  bool finished;
+};
+
+ac_io_range_partition_t *
+ac_io_range_partition_init(ac_io_compare_cb compare, void *compare_arg,
+                           size_t max_samples) {
+  ac_io_range_partition_t *h =
+      (ac_io_range_partition_t *)ac_calloc(sizeof(ac_io_range_partition_t));
+  h->compare = compare;
+  h->compare_arg = compare_arg;
+  h->max_samples = max_samples ? max_samples : 1;
+  h->samples =
+      (ac_io_record_t *)ac_malloc(sizeof(ac_io_record_t) * h->max_samples);
+  h->rand = 0x9E3779B97F4A7C15ULL;
+  return h;
+}
+
+static void set_sample(ac_io_record_t *dest, const ac_io_record_t *r) {
+  dest->record = (char *)ac_malloc(r->length + 1);
+  memcpy(dest->record, r->record, r->length);
+  dest->record[r->length] = 0;
+  dest->length = r->length;
+  dest->tag = r->tag;
+}
+
+void ac_io_range_partition_sample(ac_io_range_partition_t *h,
+                                  const ac_io_record_t *r) {
+  if (h->finished)
+    return;
+  h->num_seen++;
+  if (h->num_samples < h->max_samples) {
+    set_sample(h->samples + h->num_samples, r);
+    h->num_samples++;
+    return;
+  }
+  /* reservoir sampling, the nth key replaces a sample with probability
+     max_samples / n */
+  h->rand ^= h->rand << 13;
+  h->rand ^= h->rand >> 7;
+  h->rand ^= h->rand << 17;
+  uint64_t pos = h->rand % h->num_seen;
+  if (pos < h->max_samples) {
+    ac_free(h->samples[pos].record);
+    set_sample(h->samples + pos, r);
+  }
+}
+
+void ac_io_range_partition_finish(ac_io_range_partition_t *h,
+                                  size_t num_partitions) {
+  if (h->finished)
+    return;
+  h->finished = true;
+  if (num_partitions < 2 || !h->num_samples)
+    return;
+
+  ac_io_sort_records(h->samples, h->num_samples, h->compare, h->compare_arg);
+  h->num_splits = num_partitions - 1;
+  h->splits =
+      (ac_io_record_t *)ac_malloc(sizeof(ac_io_record_t) * h->num_splits);
+  for (size_t i = 0; i < h->num_splits; i++)
+    h->splits[i] = h->samples[((i + 1) * h->num_samples) / num_partitions];
+}
+
+bool ac_io_range_partition_finished(ac_io_range_partition_t *h) {
+  return h->finished;
+}
+
+ac_io_compare_cb ac_io_range_partition_compare(ac_io_range_partition_t *h,
+                                               void **compare_arg) {
+  if (compare_arg)
+    *compare_arg = h->compare_arg;
+  return h->compare;
+}
+
+size_t ac_io_range_partition(const ac_io_record_t *r, size_t num_part,
+                             void *tag) {
+  ac_io_range_partition_t *h = (ac_io_range_partition_t *)tag;
+  if (!h->finished)
+    ac_io_range_partition_finish(h, num_part);
+
+  /* the partition is the number of split points <= r */
+  size_t lo = 0;
+  size_t hi = h->num_splits;
+  while (lo < hi) {
+    size_t mid = (lo + hi) >> 1;
+    if (h->compare(h->splits + mid, r, h->compare_arg) <= 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo < num_part ? lo : num_part - 1;
+}
+
+void ac_io_range_partition_destroy(ac_io_range_partition_t *h) {
+  for (size_t i = 0; i < h->num_samples; i++)
+    ac_free(h->samples[i].record);
+  ac_free(h->samples);
+  if (h->splits)
+    ac_free(h->splits);
+  ac_free(h);
+}
+
 bool ac_io_extension(const char *filename, const char *extension) {
   if(!filename)
     return false;
@@ -145,6 +290,34 @@ time_t ac_io_modified(const char *filename) {
   return sb.st_mtime;
 }
 
+bool ac_io_hash_file(uint64_t *hash, const char *filename) {
+  if (!filename)
+    return false;
+  int fd = open(filename, O_RDONLY);
+  if (fd == -1)
+    return false;
+  XXH64_state_t state;
+  XXH64_reset(&state, 0);
+  size_t buffer_size = 1024 * 1024;
+  char *buffer = (char *)ac_malloc(buffer_size);
+  bool ok = true;
+  while (true) {
+    ssize_t n = read(fd, buffer, buffer_size);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      ok = false;
+    if (n <= 0)
+      break;
+    XXH64_update(&state, buffer, n);
+  }
+  ac_free(buffer);
+  close(fd);
+  if (ok)
+    *hash = XXH64_digest(&state);
+  return ok;
+}
+
 size_t ac_io_file_size(const char *filename) {
   if (!filename)
     return 0;
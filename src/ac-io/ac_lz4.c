@@ -209,6 +209,11 @@ uint32_t ac_lz4_compress_block(ac_lz4_t *l, const void *src, uint32_t src_len,
   return compressed_size + l->block_header_size;
 }
 
+void ac_lz4_content_checksum(ac_lz4_t *l, const void *src, uint32_t src_len) {
+  if (l->content_checksum)
+    (void)XXH32_update(&l->xxh, src, src_len);
+}
+
 bool ac_lz4_check_header(ac_lz4_header_t *r, void *header,
                          uint32_t header_size) {
   if (header_size != 7 || !r)
@@ -404,6 +409,8 @@ ac_lz4_t *_ac_lz4_init(int level, ac_lz4_block_size_t size, bool block_checksum,
   r->block_header_size = 4 + (block_checksum ? 4 : 0);
   r->header = header;
   r->header_size = 7;
+  if (content_checksum)
+    XXH32_reset(&(r->xxh), 0);
   if (level < LZ4HC_CLEVEL_MIN) {
     LZ4_initStream((LZ4_stream_t *)r->ctx, sizeof(LZ4_stream_t));
   } else {
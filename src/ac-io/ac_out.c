@@ -37,9 +37,37 @@ void ac_out_ext_options_fixed_reducer(ac_out_ext_options_t *h,
 
 typedef bool (*ac_out_write_cb)(ac_out_t *h, const void *d, size_t len);
 
+/* lz4 blocks compressed by a pool of threads.  jobs is a ring of 2 blocks per
+   thread.  The writer fills the block at tail, workers compress from
+   next_job, and the writer writes the finished blocks from head in order. */
+typedef struct {
+  char *src;
+  char *dest;
+  uint32_t src_len;
+  uint32_t dest_len;
+  bool done;
+} ac_out_lz4_job_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  ac_out_lz4_job_t *jobs;
+  size_t num_jobs;
+  size_t head;
+  size_t tail;
+  size_t next_job;
+  bool finished;
+
+  ac_lz4_t **lz4;
+  pthread_t *threads;
+  int num_threads;
+} ac_out_lz4_threads_t;
+
 const int AC_OUT_NORMAL_TYPE = 0;
 const int AC_OUT_PARTITIONED_TYPE = 1;
 const int AC_OUT_SORTED_TYPE = 2;
+const int AC_OUT_CB_TYPE = 3;
 
 struct ac_out_s {
   int type;
@@ -62,6 +90,7 @@ struct ac_out_s {
   gzFile gz;
 
   ac_lz4_t *lz4;
+  ac_out_lz4_threads_t *lz4_threads;
 
   unsigned char delimiter;
   uint32_t fixed;
@@ -234,6 +263,192 @@ static bool _ac_out_write_lz4(ac_out_t *h, const void *d, size_t len) {
   return true;
 }
 
+typedef struct {
+  ac_out_lz4_threads_t *t;
+  ac_lz4_t *lz4;
+} ac_out_lz4_worker_t;
+
+static void *_lz4_worker(void *arg) {
+  ac_out_lz4_threads_t *t = ((ac_out_lz4_worker_t *)arg)->t;
+  ac_lz4_t *lz4 = ((ac_out_lz4_worker_t *)arg)->lz4;
+  uint32_t dest_size = ac_lz4_compress_bound(ac_lz4_block_size(lz4)) + 8;
+  pthread_mutex_lock(&t->mutex);
+  while (true) {
+    while (t->next_job == t->tail && !t->finished)
+      pthread_cond_wait(&t->work_cond, &t->mutex);
+    if (t->next_job == t->tail)
+      break;
+    ac_out_lz4_job_t *job = t->jobs + (t->next_job % t->num_jobs);
+    t->next_job++;
+    pthread_mutex_unlock(&t->mutex);
+    job->dest_len =
+        ac_lz4_compress_block(lz4, job->src, job->src_len, job->dest, dest_size);
+    pthread_mutex_lock(&t->mutex);
+    job->done = true;
+    pthread_cond_signal(&t->done_cond);
+  }
+  pthread_mutex_unlock(&t->mutex);
+  return NULL;
+}
+
+/* first_block is the block embedded in ac_out_t so that it isn't wasted */
+static ac_out_lz4_threads_t *_lz4_threads_init(ac_out_options_t *options,
+                                               char *first_block) {
+  int num_threads = options->lz4_threads;
+  size_t num_jobs = num_threads * 2;
+  ac_out_lz4_threads_t *t = (ac_out_lz4_threads_t *)ac_calloc(
+      sizeof(*t) + (sizeof(ac_out_lz4_job_t) * num_jobs) +
+      ((sizeof(ac_lz4_t *) + sizeof(pthread_t) + sizeof(ac_out_lz4_worker_t)) *
+       num_threads));
+  t->jobs = (ac_out_lz4_job_t *)(t + 1);
+  t->num_jobs = num_jobs;
+  t->lz4 = (ac_lz4_t **)(t->jobs + num_jobs);
+  t->threads = (pthread_t *)(t->lz4 + num_threads);
+  ac_out_lz4_worker_t *workers = (ac_out_lz4_worker_t *)(t->threads + num_threads);
+  t->num_threads = num_threads;
+  pthread_mutex_init(&t->mutex, NULL);
+  pthread_cond_init(&t->work_cond, NULL);
+  pthread_cond_init(&t->done_cond, NULL);
+
+  for (int i = 0; i < num_threads; i++)
+    /* the content checksum is computed by the writer */
+    t->lz4[i] = ac_lz4_init(options->level, options->size,
+                            options->block_checksum, false);
+
+  uint32_t block_size = ac_lz4_block_size(t->lz4[0]);
+  uint32_t dest_size = ac_lz4_compress_bound(block_size) + 8;
+  for (size_t i = 0; i < num_jobs; i++) {
+    ac_out_lz4_job_t *job = t->jobs + i;
+    if (i)
+      job->src = (char *)ac_malloc(block_size);
+    else
+      job->src = first_block;
+    job->dest = (char *)ac_malloc(dest_size);
+  }
+
+  for (int i = 0; i < num_threads; i++) {
+    workers[i].t = t;
+    workers[i].lz4 = t->lz4[i];
+    pthread_create(t->threads + i, NULL, _lz4_worker, workers + i);
+  }
+  return t;
+}
+
+static void _lz4_threads_destroy(ac_out_lz4_threads_t *t) {
+  pthread_mutex_lock(&t->mutex);
+  t->finished = true;
+  pthread_cond_broadcast(&t->work_cond);
+  pthread_mutex_unlock(&t->mutex);
+  for (int i = 0; i < t->num_threads; i++) {
+    pthread_join(t->threads[i], NULL);
+    ac_lz4_destroy(t->lz4[i]);
+  }
+  for (size_t i = 0; i < t->num_jobs; i++) {
+    if (i)
+      ac_free(t->jobs[i].src);
+    ac_free(t->jobs[i].dest);
+  }
+  pthread_mutex_destroy(&t->mutex);
+  pthread_cond_destroy(&t->work_cond);
+  pthread_cond_destroy(&t->done_cond);
+  ac_free(t);
+}
+
+/* writes compressed blocks through buffer2 so that small blocks are batched */
+static bool _write_lz4_block(ac_out_t *h, const char *p, size_t len) {
+  if (h->buffer_pos2 + len > h->buffer_size2) {
+    if (!_write_to_fd(&(h->fd), h->buffer2, h->buffer_pos2))
+      return false;
+    h->buffer_pos2 = 0;
+    if (len > h->buffer_size2)
+      return _write_to_fd(&(h->fd), p, len);
+  }
+  memcpy(h->buffer2 + h->buffer_pos2, p, len);
+  h->buffer_pos2 += len;
+  return true;
+}
+
+/* Write the finished blocks at the head of the ring.  If wait_for is set,
+   keep going until that many blocks are outstanding. */
+static bool _write_lz4_blocks(ac_out_t *h, size_t wait_for) {
+  ac_out_lz4_threads_t *t = h->lz4_threads;
+  pthread_mutex_lock(&t->mutex);
+  while (t->head < t->tail) {
+    ac_out_lz4_job_t *job = t->jobs + (t->head % t->num_jobs);
+    if (!job->done) {
+      if (t->tail - t->head <= wait_for)
+        break;
+      pthread_cond_wait(&t->done_cond, &t->mutex);
+      continue;
+    }
+    pthread_mutex_unlock(&t->mutex);
+    if (!_write_lz4_block(h, job->dest, job->dest_len)) {
+      if (h->fd_owner)
+        close(h->fd);
+      h->fd = -1;
+      return false;
+    }
+    pthread_mutex_lock(&t->mutex);
+    job->done = false;
+    t->head++;
+  }
+  pthread_mutex_unlock(&t->mutex);
+  return true;
+}
+
+/* hand the current block to the workers and move to the next one */
+static bool _submit_lz4_block(ac_out_t *h) {
+  ac_out_lz4_threads_t *t = h->lz4_threads;
+  ac_out_lz4_job_t *job = t->jobs + (t->tail % t->num_jobs);
+  job->src_len = h->buffer_pos;
+  ac_lz4_content_checksum(h->lz4, job->src, job->src_len);
+  pthread_mutex_lock(&t->mutex);
+  t->tail++;
+  pthread_cond_signal(&t->work_cond);
+  pthread_mutex_unlock(&t->mutex);
+
+  if (!_write_lz4_blocks(h, t->num_jobs - 1))
+    return false;
+  h->buffer = t->jobs[t->tail % t->num_jobs].src;
+  h->buffer_pos = 0;
+  return true;
+}
+
+static bool _ac_out_write_lz4_threaded(ac_out_t *h, const void *d,
+                                       size_t len) {
+  if (!len) {
+    if (h->buffer_pos && !_submit_lz4_block(h))
+      return false;
+    if (!_write_lz4_blocks(h, 0))
+      return false;
+    char footer[8];
+    uint32_t n = ac_lz4_finish(h->lz4, footer);
+    if (!_write_lz4_block(h, footer, n) ||
+        !_write_to_fd(&(h->fd), h->buffer2, h->buffer_pos2)) {
+      if (h->fd_owner)
+        close(h->fd);
+      h->fd = -1;
+      return false;
+    }
+    h->buffer_pos2 = 0;
+    return true;
+  }
+
+  const char *p = (const char *)d;
+  while (h->buffer_pos + len >= h->buffer_size) {
+    size_t diff = h->buffer_size - h->buffer_pos;
+    memcpy(h->buffer + h->buffer_pos, p, diff);
+    h->buffer_pos += diff;
+    p += diff;
+    len -= diff;
+    if (!_submit_lz4_block(h))
+      return false;
+  }
+  memcpy(h->buffer + h->buffer_pos, p, len);
+  h->buffer_pos += len;
+  return true;
+}
+
 static bool _ac_out_write_gz(ac_out_t *h, const void *d, size_t len) {
   if (h->buffer_pos + len < h->buffer_size) {
     memcpy(h->buffer + h->buffer_pos, d, len);
@@ -343,6 +558,10 @@ static ac_out_t *_ac_out_init_lz4(const char *filename, int fd, bool fd_owner,
   h->buffer_pos2 = header_size;
   h->options = *options;
   h->write_d = _ac_out_write_lz4;
+  if (options->lz4_threads > 1) {
+    h->lz4_threads = _lz4_threads_init(options, h->buffer);
+    h->write_d = _ac_out_write_lz4_threaded;
+  }
   return h;
 }
 
@@ -492,6 +711,10 @@ void ac_out_options_lz4(ac_out_options_t *h, int level,
   h->content_checksum = content_checksum;
 }
 
+void ac_out_options_lz4_threads(ac_out_options_t *h, int num_threads) {
+  h->lz4_threads = num_threads;
+}
+
 void ac_out_ext_options_init(ac_out_ext_options_t *h) {
   memset(h, 0, sizeof(*h));
   // h->lz4_tmp = false;
@@ -519,6 +742,17 @@ void ac_out_ext_options_dont_compress_tmp(ac_out_ext_options_t *h) {
   h->lz4_tmp = false;
 }
 
+void ac_out_ext_options_io_uring(ac_out_ext_options_t *h, size_t num_blocks) {
+  h->io_uring = num_blocks;
+}
+
+void ac_out_ext_options_spill_check(ac_out_ext_options_t *h,
+                                    ac_out_spill_check_cb spill_check,
+                                    void *arg) {
+  h->spill_check = spill_check;
+  h->spill_check_arg = arg;
+}
+
 /* options for creating a partitioned output */
 void ac_out_ext_options_partition(ac_out_ext_options_t *h,
                                   ac_io_partition_cb part, void *arg) {
@@ -531,6 +765,19 @@ void ac_out_ext_options_num_partitions(ac_out_ext_options_t *h,
   h->num_partitions = num_partitions;
 }
 
+void ac_out_ext_options_range_partition(ac_out_ext_options_t *h,
+                                        ac_io_range_partition_t *rp) {
+  h->partition = ac_io_range_partition;
+  h->partition_arg = rp;
+  h->range_partition = NULL;
+  if (ac_io_range_partition_finished(rp))
+    return;
+  h->range_partition = rp;
+  h->sort_before_partitioning = true;
+  if (!h->compare)
+    h->compare = ac_io_range_partition_compare(rp, &h->compare_arg);
+}
+
 /* options for sorting the output */
 void ac_out_ext_options_compare(ac_out_ext_options_t *h,
                                 ac_io_compare_cb compare, void *arg) {
@@ -564,6 +811,13 @@ void ac_out_ext_options_intermediate_reducer(ac_out_ext_options_t *h,
   h->int_reducer_arg = arg;
 }
 
+void ac_out_ext_options_combine(ac_out_ext_options_t *h, ac_io_hash_cb hash,
+                                void *arg) {
+  h->combine = true;
+  h->combine_hash = hash;
+  h->combine_hash_arg = arg;
+}
+
 /* options for fixed output */
 void ac_out_ext_options_fixed_reducer(ac_out_ext_options_t *h,
                                       ac_io_fixed_reducer_cb reducer,
@@ -666,6 +920,40 @@ ac_out_t *ac_out_init(const char *filename, ac_out_options_t *options) {
   return _ac_out_init_(filename, -1, true, options);
 }
 
+typedef struct {
+  int type;
+  ac_out_options_t options;
+  ac_out_write_cb write_record;
+
+  ac_out_record_cb cb;
+  ac_out_close_cb close;
+  void *arg;
+} ac_out_cb_t;
+
+static bool write_cb_record(ac_out_t *hp, const void *d, size_t len) {
+  ac_out_cb_t *h = (ac_out_cb_t *)hp;
+  return h->cb(d, len, h->arg);
+}
+
+ac_out_t *ac_out_init_with_cb(ac_out_record_cb write_record,
+                              ac_out_close_cb close, void *arg) {
+  ac_out_cb_t *h = (ac_out_cb_t *)ac_calloc(sizeof(ac_out_cb_t));
+  h->type = AC_OUT_CB_TYPE;
+  ac_out_options_init(&(h->options));
+  h->write_record = write_cb_record;
+  h->cb = write_record;
+  h->close = close;
+  h->arg = arg;
+  return (ac_out_t *)h;
+}
+
+static void ac_out_cb_destroy(ac_out_t *hp) {
+  ac_out_cb_t *h = (ac_out_cb_t *)hp;
+  if (h->close)
+    h->close(h->arg);
+  ac_free(h);
+}
+
 ac_out_t *ac_out_init_with_fd(int fd, bool fd_owner,
                               ac_out_options_t *options) {
   return _ac_out_init_(NULL, fd, fd_owner, options);
@@ -713,6 +1001,10 @@ static void ac_out_ext_destroy(ac_out_t *hp);
 
 void _ac_out_destroy(ac_out_t *h) {
   ac_out_flush(h);
+  if (h->lz4_threads) {
+    _lz4_threads_destroy(h->lz4_threads);
+    h->lz4_threads = NULL;
+  }
   if (h->fd > -1 && h->fd_owner) {
     close(h->fd);
     h->fd = -1;
@@ -1035,6 +1327,12 @@ typedef struct extra_s {
   struct extra_s *next;
 } extra_t;
 
+/* index is the record's position in the buffer + 1 (0 is an empty slot) */
+typedef struct {
+  uint32_t hash;
+  uint32_t index;
+} combine_slot_t;
+
 typedef struct {
   int type;
   ac_out_options_t options;
@@ -1059,6 +1357,20 @@ typedef struct {
   extra_t *extras;
 
   int tag;
+  int sort_type;
+
+  /* bytes of the current buffer last reported to spill_check and the usage
+     at which to check again */
+  size_t used_reported;
+  size_t check_at;
+
+  /* open addressing table of the records in the current buffer when
+     combining */
+  combine_slot_t *combine_slots;
+  size_t combine_mask;
+  size_t combine_limit;
+  size_t combine_max_slots;
+  ac_buffer_t *combine_bh;
 
   ac_out_ext_options_t ext_options;
   ac_out_ext_options_t partition_options;
@@ -1117,14 +1429,123 @@ static inline void init_buffer(ac_out_buffer_t *b, size_t buffer_size) {
   clear_buffer(b);
 }
 
+/*
+  When the comparison is one of the built in orders, the buffer is radix sorted
+  instead of going through the comparison callback.  The key (or the first 8
+  bytes of the record in big endian order for ac_io_compare_bytes) is copied
+  next to the record so that each pass reads sequential memory.  Records which
+  share a prefix are finished with a comparison sort.  Like the rest of the
+  sort buffer, this doesn't count against buffer_size.
+*/
+enum { SORT_CALLBACK = 0, SORT_UINT32 = 1, SORT_UINT64 = 2, SORT_BYTES = 3 };
+
+#define RADIX_SORT_MIN_RECORDS 64
+
+typedef struct {
+  uint64_t key;
+  ac_io_record_t r;
+} sort_item_t;
+
+static int get_sort_type(ac_io_compare_cb compare) {
+  if (compare == ac_io_compare_uint32_t)
+    return SORT_UINT32;
+  else if (compare == ac_io_compare_uint64_t)
+    return SORT_UINT64;
+  else if (compare == ac_io_compare_bytes)
+    return SORT_BYTES;
+  return SORT_CALLBACK;
+}
+
+static inline uint64_t sort_key(ac_io_record_t *r, int sort_type) {
+  if (sort_type == SORT_UINT32)
+    return *(uint32_t *)r->record;
+  else if (sort_type == SORT_UINT64)
+    return *(uint64_t *)r->record;
+
+  uint64_t key = 0;
+  if (r->length >= sizeof(key))
+    memcpy(&key, r->record, sizeof(key));
+  else
+    memcpy(&key, r->record, r->length);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  key = __builtin_bswap64(key);
+#endif
+  return key;
+}
+
+static inline bool compare_sort_item(const sort_item_t *a,
+                                     const sort_item_t *b) {
+  return ac_io_compare_bytes(&a->r, &b->r, NULL) < 0;
+}
+
+static inline macro_sort(sort_items_by_bytes, sort_item_t, compare_sort_item);
+
+static void radix_sort_records(ac_io_record_t *r, size_t num_r,
+                               int sort_type) {
+  size_t num_bytes = sort_type == SORT_UINT32 ? 4 : 8;
+  size_t counts[8][256];
+  memset(counts, 0, sizeof(counts));
+
+  sort_item_t *items =
+      (sort_item_t *)ac_malloc(sizeof(sort_item_t) * num_r * 2);
+  sort_item_t *src = items, *dest = items + num_r;
+  for (size_t i = 0; i < num_r; i++) {
+    uint64_t key = sort_key(r + i, sort_type);
+    src[i].key = key;
+    src[i].r = r[i];
+    for (size_t j = 0; j < num_bytes; j++)
+      counts[j][(key >> (j << 3)) & 0xFF]++;
+  }
+
+  for (size_t j = 0; j < num_bytes; j++) {
+    size_t shift = j << 3;
+    size_t *count = counts[j];
+    /* skip the pass if every key has the same byte here */
+    if (count[(src[0].key >> shift) & 0xFF] == num_r)
+      continue;
+
+    size_t offs = 0;
+    for (size_t d = 0; d < 256; d++) {
+      size_t n = count[d];
+      count[d] = offs;
+      offs += n;
+    }
+    for (size_t i = 0; i < num_r; i++)
+      dest[count[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+    sort_item_t *tmp = src;
+    src = dest;
+    dest = tmp;
+  }
+
+  if (sort_type == SORT_BYTES) {
+    size_t i = 0;
+    while (i < num_r) {
+      size_t j = i + 1;
+      while (j < num_r && src[j].key == src[i].key)
+        j++;
+      if (j - i > 1)
+        sort_items_by_bytes(src + i, j - i);
+      i = j;
+    }
+  }
+
+  for (size_t i = 0; i < num_r; i++)
+    r[i] = src[i].r;
+  ac_free(items);
+}
+
 static ac_in_t *_in_from_buffer(ac_out_sorted_t *h, ac_out_buffer_t *b) {
   if (!b->num_records)
     return NULL;
 
   ac_io_record_t *r = (ac_io_record_t *)b->buffer;
   uint32_t num_r = b->num_records;
-  ac_io_sort_records(r, num_r, h->ext_options.int_compare,
-                     h->ext_options.int_compare_arg);
+  if (h->sort_type != SORT_CALLBACK && num_r >= RADIX_SORT_MIN_RECORDS)
+    radix_sort_records(r, num_r, h->sort_type);
+  else
+    ac_io_sort_records(r, num_r, h->ext_options.int_compare,
+                       h->ext_options.int_compare_arg);
 
   clear_buffer(b);
   return ac_in_records_init(r, num_r, &(h->file_options));
@@ -1160,7 +1581,9 @@ ac_out_t *ac_out_sorted_init(const char *filename, ac_out_options_t *options,
   h->ext_options = *ext_options;
   h->partition_options = *ext_options;
   h->partition_options.compare = NULL;
+  h->partition_options.range_partition = NULL;
   h->options = *options;
+  h->sort_type = get_sort_type(ext_options->int_compare);
 
   ac_in_options_init(&(h->file_options));
   if (ext_options->int_reducer)
@@ -1180,10 +1603,164 @@ ac_out_t *ac_out_sorted_init(const char *filename, ac_out_options_t *options,
     h->b = &(h->buf1);
     h->b2 = &(h->buf1);
   }
+
+  if (ext_options->combine && ext_options->int_reducer) {
+    if (!ext_options->combine_hash && h->sort_type == SORT_CALLBACK)
+      abort();
+    /* the table starts small and doubles as distinct keys are added, up to
+       enough slots that it stays under 3/4 full until the buffer is full of
+       the smallest records (a header and a zero terminator) */
+    size_t max_records = buffer_size / (sizeof(ac_io_record_t) + 1);
+    size_t max_slots = 1024;
+    while (max_slots - (max_slots >> 2) <= max_records)
+      max_slots <<= 1;
+    h->combine_max_slots = max_slots;
+    size_t num_slots = 1024;
+    h->combine_slots =
+        (combine_slot_t *)ac_calloc(sizeof(combine_slot_t) * num_slots);
+    h->combine_mask = num_slots - 1;
+    h->combine_limit = num_slots - (num_slots >> 2);
+    h->combine_bh = ac_buffer_init(256);
+  }
   h->write_record = write_sorted_record;
   return (ac_out_t *)h;
 }
 
+/*
+  When combining, each record in the buffer is also in an open addressing
+  table keyed by the low 32 bits of its hash.  A record whose key is already
+  in the table is reduced into the existing record rather than appended.
+*/
+static inline uint64_t combine_hash(ac_out_sorted_t *h,
+                                    const ac_io_record_t *r) {
+  if (h->ext_options.combine_hash)
+    return h->ext_options.combine_hash(r, h->ext_options.combine_hash_arg);
+  if (h->sort_type == SORT_UINT32)
+    return ac_lz4_hash64(r->record, sizeof(uint32_t));
+  else if (h->sort_type == SORT_UINT64)
+    return ac_lz4_hash64(r->record, sizeof(uint64_t));
+  return ac_lz4_hash64(r->record, r->length);
+}
+
+static combine_slot_t *find_combine_slot(ac_out_sorted_t *h,
+                                         const ac_io_record_t *r,
+                                         uint32_t hash) {
+  ac_io_record_t *records = (ac_io_record_t *)h->b->buffer;
+  combine_slot_t *slots = h->combine_slots;
+  size_t i = hash & h->combine_mask;
+  while (slots[i].index) {
+    if (slots[i].hash == hash &&
+        !h->ext_options.int_compare(records + slots[i].index - 1, r,
+                                    h->ext_options.int_compare_arg))
+      break;
+    i = (i + 1) & h->combine_mask;
+  }
+  return slots + i;
+}
+
+static void grow_combine_slots(ac_out_sorted_t *h) {
+  size_t num_slots = (h->combine_mask + 1) << 1;
+  combine_slot_t *old = h->combine_slots;
+  combine_slot_t *ep = old + h->combine_mask + 1;
+  combine_slot_t *slots =
+      (combine_slot_t *)ac_calloc(sizeof(combine_slot_t) * num_slots);
+  size_t mask = num_slots - 1;
+  for (combine_slot_t *s = old; s < ep; s++) {
+    if (!s->index)
+      continue;
+    size_t i = s->hash & mask;
+    while (slots[i].index)
+      i = (i + 1) & mask;
+    slots[i] = *s;
+  }
+  ac_free(old);
+  h->combine_slots = slots;
+  h->combine_mask = mask;
+  h->combine_limit = num_slots - (num_slots >> 2);
+}
+
+static void add_combine_slot(ac_out_sorted_t *h, uint32_t hash) {
+  if (h->b->num_records >= h->combine_limit &&
+      h->combine_mask + 1 < h->combine_max_slots)
+    grow_combine_slots(h);
+  combine_slot_t *slots = h->combine_slots;
+  size_t i = hash & h->combine_mask;
+  while (slots[i].index)
+    i = (i + 1) & h->combine_mask;
+  slots[i].hash = hash;
+  slots[i].index = h->b->num_records;
+}
+
+/* the reducer dropped the record, remove it from the table (shifting back
+   entries so that no probe sequence is broken) and fill its place in the
+   buffer with the last record */
+static void remove_combine_slot(ac_out_sorted_t *h, combine_slot_t *slot) {
+  combine_slot_t *slots = h->combine_slots;
+  size_t mask = h->combine_mask;
+  uint32_t index = slot->index;
+  size_t i = slot - slots;
+  size_t j = i;
+  while (true) {
+    j = (j + 1) & mask;
+    if (!slots[j].index)
+      break;
+    size_t home = slots[j].hash & mask;
+    if (((j - home) & mask) >= ((j - i) & mask)) {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+  slots[i].index = 0;
+
+  ac_io_record_t *records = (ac_io_record_t *)h->b->buffer;
+  uint32_t last = h->b->num_records;
+  if (index != last) {
+    records[index - 1] = records[last - 1];
+    uint32_t hash = (uint32_t)combine_hash(h, records + index - 1);
+    i = hash & mask;
+    while (slots[i].index != last)
+      i = (i + 1) & mask;
+    slots[i].index = index;
+  }
+  h->b->num_records--;
+  h->b->bp -= sizeof(ac_io_record_t);
+  if (!h->b->num_records)
+    clear_buffer(h->b);
+}
+
+/* returns false if the reduced record doesn't fit in the buffer */
+static bool combine_record(ac_out_sorted_t *h, combine_slot_t *slot,
+                           const ac_io_record_t *r) {
+  ac_io_record_t *existing = (ac_io_record_t *)h->b->buffer + slot->index - 1;
+  ac_io_record_t group[2];
+  group[0] = *existing;
+  group[1] = *r;
+
+  ac_io_record_t res;
+  ac_buffer_clear(h->combine_bh);
+  if (!h->ext_options.int_reducer(&res, group, 2, h->combine_bh,
+                                  h->ext_options.int_reducer_arg)) {
+    remove_combine_slot(h, slot);
+    return true;
+  }
+
+  if (res.length <= existing->length)
+    memmove(existing->record, res.record, res.length);
+  else {
+    char *ep = h->b->ep;
+    if (h->b->bp + res.length + 1 > ep)
+      return false;
+    ep--;
+    ep -= res.length;
+    memcpy(ep, res.record, res.length);
+    h->b->ep = ep;
+    existing->record = ep;
+  }
+  existing->record[res.length] = 0;
+  existing->length = res.length;
+  return true;
+}
+
 static inline void wait_on_thread(ac_out_sorted_t *h) {
   if (h->thread_started) {
     pthread_join(h->thread, NULL);
@@ -1221,6 +1798,8 @@ void check_for_merge(ac_out_sorted_t *h) {
   ac_in_options_t opts;
   ac_in_options_init(&opts);
   ac_in_options_format(&opts, ac_io_prefix());
+  if (h->ext_options.io_uring)
+    ac_in_options_io_uring(&opts, h->ext_options.io_uring);
   ac_in_t *in =
       ac_in_ext_init(h->ext_options.compare, h->ext_options.compare_arg, &opts);
   if (h->ext_options.reducer)
@@ -1255,9 +1834,21 @@ void *write_sorted_thread(void *arg) {
   return NULL;
 }
 
+static void report_buffer_written(ac_out_sorted_t *h) {
+  if (h->ext_options.spill_check && h->used_reported)
+    h->ext_options.spill_check(-(int64_t)h->used_reported,
+                               h->ext_options.spill_check_arg);
+  h->used_reported = 0;
+  h->check_at = 0;
+}
+
 void write_sorted(ac_out_sorted_t *h) {
   if (h->b->bp == h->b->buffer)
     return;
+  report_buffer_written(h);
+  if (h->combine_slots)
+    memset(h->combine_slots, 0,
+           sizeof(combine_slot_t) * (h->combine_mask + 1));
   wait_on_thread(h);
   if (h->ext_options.use_extra_thread) {
     ac_out_buffer_t *tmp = h->b;
@@ -1287,7 +1878,10 @@ ac_in_t *_ac_out_sorted_in(ac_out_t *hp) {
     return NULL;
 
   h->out_in_called = true;
+  report_buffer_written(h);
 
+  /* the first buffer may still be sorting (and not counted as written) */
+  wait_on_thread(h);
   if (!h->num_written && !h->num_group_written) {
     if (&(h->buf1) == h->b) {
       if (h->buf2.buffer) {
@@ -1329,6 +1923,8 @@ ac_in_t *_ac_out_sorted_in(ac_out_t *hp) {
   ac_in_options_init(&opts);
   ac_in_options_buffer_size(&opts, h->buf1.size / 10);
   ac_in_options_format(&opts, ac_io_prefix());
+  if (h->ext_options.io_uring)
+    ac_in_options_io_uring(&opts, h->ext_options.io_uring);
   ac_in_t *in =
       ac_in_ext_init(h->ext_options.compare, h->ext_options.compare_arg, &opts);
   if (h->ext_options.reducer)
@@ -1355,6 +1951,8 @@ ac_in_t *ac_out_in(ac_out_t *hp) {
     in = ac_out_partitioned_in(hp);
   else if (hp->type == AC_OUT_NORMAL_TYPE)
     in = ac_out_normal_in(hp);
+  else if (hp->type == AC_OUT_CB_TYPE)
+    ac_out_cb_destroy(hp);
   return in;
 }
 
@@ -1396,6 +1994,31 @@ bool write_sorted_record(ac_out_t *hp, const void *d, size_t len) {
     return false;
   ac_out_sorted_t *h = (ac_out_sorted_t *)hp;
 
+  if (h->ext_options.range_partition) {
+    ac_io_record_t sr;
+    sr.record = (char *)d;
+    sr.length = len;
+    sr.tag = h->tag;
+    ac_io_range_partition_sample(h->ext_options.range_partition, &sr);
+  }
+
+  uint32_t hash = 0;
+  if (h->combine_slots) {
+    ac_io_record_t r;
+    r.record = (char *)d;
+    r.length = len;
+    r.tag = h->tag;
+    hash = (uint32_t)combine_hash(h, &r);
+    combine_slot_t *slot = find_combine_slot(h, &r, hash);
+    if (slot->index) {
+      if (combine_record(h, slot, &r))
+        return true;
+      write_sorted(h);
+    } else if (h->b->num_records >= h->combine_limit &&
+               h->combine_mask + 1 >= h->combine_max_slots)
+      write_sorted(h);
+  }
+
   size_t length = len + sizeof(ac_io_record_t) + 5;
   char *bp = h->b->bp;
   if (bp + length > h->b->ep) {
@@ -1426,7 +2049,19 @@ bool write_sorted_record(ac_out_t *hp, const void *d, size_t len) {
   h->b->bp = bp;
   h->b->ep = ep;
   h->b->num_records++;
-
+  if (h->combine_slots)
+    add_combine_slot(h, hash);
+
+  if (h->ext_options.spill_check) {
+    size_t used = h->b->size - (ep - bp);
+    if (used >= h->check_at) {
+      h->check_at = used + (h->b->size >> 4);
+      int64_t change = (int64_t)used - (int64_t)h->used_reported;
+      h->used_reported = used;
+      if (h->ext_options.spill_check(change, h->ext_options.spill_check_arg))
+        write_sorted(h);
+    }
+  }
   return true;
 }
 
@@ -1508,6 +2143,10 @@ void ac_out_sorted_destroy(ac_out_t *hp) {
     ac_free(h->buf2.buffer);
     h->buf2.buffer = NULL;
   }
+  if (h->combine_slots) {
+    ac_free(h->combine_slots);
+    ac_buffer_destroy(h->combine_bh);
+  }
   ac_out_ext_remove_tmp_files(h->tmp_filename, h->filename,
                               h->ext_options.lz4_tmp);
   destroy_extra_ins(h);
@@ -1529,6 +2168,8 @@ static void ac_out_ext_destroy(ac_out_t *hp) {
     ac_out_partitioned_destroy(hp);
   else if (hp->type == AC_OUT_SORTED_TYPE)
     ac_out_sorted_destroy(hp);
+  else if (hp->type == AC_OUT_CB_TYPE)
+    ac_out_cb_destroy(hp);
   else
     abort();
 }
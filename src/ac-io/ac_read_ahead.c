@@ -0,0 +1,149 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_read_ahead.h"
+
+#include "another-c-library/ac_allocator.h"
+
+#include <pthread.h>
+#include <string.h>
+
+typedef struct {
+  char *data;
+  size_t length;
+} ac_read_ahead_slot_t;
+
+/* slots is a ring.  The thread fills tail while the consumer holds the slot
+   before head. */
+struct ac_read_ahead_s {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_t thread;
+  ac_read_ahead_slot_t *slots;
+  size_t num_slots;
+  size_t slot_size;
+  size_t head;
+  size_t tail;
+  bool eof;
+  bool stop;
+  bool consuming;
+
+  ac_read_ahead_cb fill;
+  void *arg;
+
+  /* the remainder of the current slot for ac_read_ahead_copy */
+  char *p;
+  char *ep;
+};
+
+static void *read_ahead_thread(void *arg) {
+  ac_read_ahead_t *h = (ac_read_ahead_t *)arg;
+  pthread_mutex_lock(&h->mutex);
+  while (true) {
+    /* one slot may be held by the consumer */
+    while (!h->stop && h->tail - h->head + h->consuming >= h->num_slots)
+      pthread_cond_wait(&h->cond, &h->mutex);
+    if (h->stop)
+      break;
+    ac_read_ahead_slot_t *slot = h->slots + (h->tail % h->num_slots);
+    pthread_mutex_unlock(&h->mutex);
+    int n = h->fill(h->arg, slot->data, h->slot_size);
+    pthread_mutex_lock(&h->mutex);
+    if (n <= 0) {
+      h->eof = true;
+      pthread_cond_broadcast(&h->cond);
+      break;
+    }
+    slot->length = n;
+    h->tail++;
+    pthread_cond_broadcast(&h->cond);
+  }
+  pthread_mutex_unlock(&h->mutex);
+  return NULL;
+}
+
+ac_read_ahead_t *ac_read_ahead_init(size_t num_slots, size_t slot_size,
+                                    ac_read_ahead_cb fill, void *arg) {
+  if (num_slots < 2)
+    num_slots = 2;
+  ac_read_ahead_t *h = (ac_read_ahead_t *)ac_calloc(
+      sizeof(*h) + (sizeof(ac_read_ahead_slot_t) * num_slots));
+  h->slots = (ac_read_ahead_slot_t *)(h + 1);
+  for (size_t i = 0; i < num_slots; i++)
+    h->slots[i].data = (char *)ac_malloc(slot_size);
+  h->num_slots = num_slots;
+  h->slot_size = slot_size;
+  h->fill = fill;
+  h->arg = arg;
+  pthread_mutex_init(&h->mutex, NULL);
+  pthread_cond_init(&h->cond, NULL);
+  pthread_create(&h->thread, NULL, read_ahead_thread, h);
+  return h;
+}
+
+char *ac_read_ahead_next(ac_read_ahead_t *h, size_t *len) {
+  pthread_mutex_lock(&h->mutex);
+  h->consuming = false;
+  pthread_cond_broadcast(&h->cond);
+  while (h->head == h->tail && !h->eof)
+    pthread_cond_wait(&h->cond, &h->mutex);
+  if (h->head == h->tail) {
+    pthread_mutex_unlock(&h->mutex);
+    *len = 0;
+    return NULL;
+  }
+  ac_read_ahead_slot_t *slot = h->slots + (h->head % h->num_slots);
+  h->head++;
+  h->consuming = true;
+  pthread_mutex_unlock(&h->mutex);
+  *len = slot->length;
+  return slot->data;
+}
+
+size_t ac_read_ahead_copy(ac_read_ahead_t *h, char *dest, size_t len) {
+  size_t r = 0;
+  while (r < len) {
+    if (h->p == h->ep) {
+      size_t n;
+      h->p = ac_read_ahead_next(h, &n);
+      if (!h->p) {
+        h->ep = NULL;
+        break;
+      }
+      h->ep = h->p + n;
+    }
+    size_t n = h->ep - h->p;
+    if (n > len - r)
+      n = len - r;
+    memcpy(dest + r, h->p, n);
+    h->p += n;
+    r += n;
+  }
+  return r;
+}
+
+void ac_read_ahead_destroy(ac_read_ahead_t *h) {
+  pthread_mutex_lock(&h->mutex);
+  h->stop = true;
+  pthread_cond_broadcast(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+  pthread_join(h->thread, NULL);
+  for (size_t i = 0; i < h->num_slots; i++)
+    ac_free(h->slots[i].data);
+  pthread_mutex_destroy(&h->mutex);
+  pthread_cond_destroy(&h->cond);
+  ac_free(h);
+}
@@ -0,0 +1,45 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_read_ahead_H
+#define _ac_read_ahead_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* A helper thread which calls fill to produce up to num_slots slots of
+   slot_size bytes ahead of the consumer.  It is used by ac_in_base and ac_in
+   to overlap reading and decompressing with processing records. */
+struct ac_read_ahead_s;
+typedef struct ac_read_ahead_s ac_read_ahead_t;
+
+/* fill should write up to len bytes to dest and return how many were
+   written.  Zero or less ends the stream. */
+typedef int (*ac_read_ahead_cb)(void *arg, char *dest, size_t len);
+
+ac_read_ahead_t *ac_read_ahead_init(size_t num_slots, size_t slot_size,
+                                    ac_read_ahead_cb fill, void *arg);
+
+/* Returns the next slot (waiting for it if necessary) or NULL at the end of
+   the stream.  The slot is valid until the next call. */
+char *ac_read_ahead_next(ac_read_ahead_t *h, size_t *len);
+
+/* copy up to len bytes into dest, fewer only at the end of the stream */
+size_t ac_read_ahead_copy(ac_read_ahead_t *h, char *dest, size_t len);
+
+void ac_read_ahead_destroy(ac_read_ahead_t *h);
+
+#endif
@@ -21,9 +21,14 @@ struct ac_task_state_link_s {
   ac_task_state_link_t *next;
   ac_task_state_link_t *previous;
   time_t completed;
+  /* number of dependencies which must still complete before this partition
+     becomes available (updated atomically once the threads are started) */
+  size_t pending;
 };
 
+/* the lists for a given partition are protected by the partition's mutex */
 struct ac_task_state_s {
+  pthread_mutex_t mutex;
   ac_task_state_link_t *completed_tasks;
   ac_task_state_link_t *available_tasks;
   ac_task_state_link_t *tasks_to_finish;
@@ -38,14 +43,39 @@ struct ac_schedule_allocs_s {
   ac_schedule_allocs_t *next;
 };
 
+struct ac_ram_lease_s;
+typedef struct ac_ram_lease_s ac_ram_lease_t;
+
+/* memory handed to a worker's input or output buffer (see lease_ram) */
+struct ac_ram_lease_s {
+  ac_schedule_t *scheduler;
+  size_t size;
+  /* bytes counted against the scheduler's ram_used */
+  size_t used;
+  ac_ram_lease_t *next;
+};
+
+/* Each thread owns a deque of available partitions.  The owner pushes and
+   pops from the bottom, other threads steal from the top when their own deque
+   is empty. */
+typedef struct {
+  pthread_mutex_t mutex;
+  ac_task_state_link_t **links;
+  size_t size;
+  size_t top;
+  size_t bottom;
+} schedule_deque_t;
+
 struct ac_schedule_thread_s {
   pthread_t thread;
   ac_schedule_t *scheduler;
   ac_pool_t *pool;
   ac_buffer_t *bh;
   ac_schedule_allocs_t *allocs;
+  ac_ram_lease_t *leases;
   size_t thread_id;
   size_t partition;
+  schedule_deque_t deque;
 };
 
 typedef struct {
@@ -95,6 +125,10 @@ struct ac_schedule_s {
 
   size_t num_available;
   size_t num_tasks_to_run;
+  size_t num_remaining;
+  size_t num_queued;
+  size_t num_idle;
+  /* mutex and cond are only used by idle threads waiting for work */
   pthread_mutex_t mutex;
   pthread_cond_t cond;
   size_t num_running;
@@ -110,11 +144,21 @@ struct ac_schedule_s {
 
   ac_task_t *head;
   ac_task_t *tail;
+  size_t num_links;
 
   size_t ram;
   size_t cpus;
   size_t disk_space;
 
+  /* ram_used is what the running workers hold (sort buffers report what they
+     actually use).  ram_mutex and ram_cond are only used by workers waiting
+     for memory before they start. */
+  pthread_mutex_t ram_mutex;
+  pthread_cond_t ram_cond;
+  size_t ram_used;
+  size_t num_leasing;
+  size_t num_waiting_for_ram;
+
   parsed_args_t parsed_args;
 };
 
@@ -153,6 +197,7 @@ struct ac_task_s {
 
   bool do_nothing;
   bool run_everytime;
+  bool fingerprint;
 
   ac_schedule_t *scheduler;
 
@@ -180,10 +225,52 @@ struct ac_task_s {
   bool *selected;
 
   ac_task_state_link_t *state_linkage;
+  size_t num_completed;
 
   ac_task_t *next;
 };
 
+/* A streamed output (AC_OUTPUT_STREAM) passes records from a partition of
+   the source to the same partition of the destination in blocks.  The
+   producer appends to cur and pushes it onto the list when full.  Once
+   max_queued bytes are waiting, the rest of the records go to the spill file
+   which the consumer reads after the list is drained.  The stream is freed by
+   whichever side releases it last. */
+#define STREAM_BLOCK_SIZE (256 * 1024)
+
+typedef struct ac_task_stream_block_s {
+  char *data;
+  size_t length;
+  struct ac_task_stream_block_s *next;
+} ac_task_stream_block_t;
+
+struct ac_task_stream_s {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  ac_task_stream_block_t *head;
+  ac_task_stream_block_t *tail;
+  size_t queued;
+  size_t max_queued;
+
+  /* only touched by the producer */
+  ac_out_t *out;
+  char *cur;
+  size_t cur_length;
+  size_t cur_size;
+  ac_out_t *spill;
+
+  char *spill_filename;
+  bool spilled;
+  bool spill_read;
+  ac_in_options_t in_options;
+
+  bool started;
+  bool opened;
+  bool closed;
+  bool dropped;
+  size_t refs;
+};
+
 static bool is_worker_selected(ac_worker_t *w) {
   if (w->task->selected && w->task->selected[w->partition])
     return true;
@@ -301,13 +388,278 @@ ac_worker_output_t *ac_worker_output(ac_worker_t *w, size_t pos) {
   return r;
 }
 
+static void release_stream(ac_task_stream_t *s) {
+  if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_SEQ_CST))
+    return;
+  ac_task_stream_block_t *b = s->head;
+  while (b) {
+    ac_task_stream_block_t *next = b->next;
+    ac_free(b->data);
+    ac_free(b);
+    b = next;
+  }
+  s->head = s->tail = NULL;
+  if (s->cur)
+    ac_free(s->cur);
+  s->cur = NULL;
+  if (s->spilled)
+    remove(s->spill_filename);
+  ac_free(s->spill_filename);
+  s->spill_filename = NULL;
+  pthread_mutex_destroy(&s->mutex);
+  pthread_cond_destroy(&s->cond);
+}
+
+static void push_stream_block(ac_task_stream_t *s) {
+  if (!s->cur)
+    return;
+  ac_task_stream_block_t *b =
+      (ac_task_stream_block_t *)ac_malloc(sizeof(*b));
+  b->data = s->cur;
+  b->length = s->cur_length;
+  b->next = NULL;
+  s->cur = NULL;
+  s->cur_length = 0;
+  pthread_mutex_lock(&s->mutex);
+  if (s->tail)
+    s->tail->next = b;
+  else
+    s->head = b;
+  s->tail = b;
+  pthread_cond_signal(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+}
+
+/* records are framed as in the prefix format so that each block can be read
+   back with ac_in_init_with_buffer */
+static bool stream_write_record(const void *d, size_t len, void *arg) {
+  ac_task_stream_t *s = (ac_task_stream_t *)arg;
+  if (__atomic_load_n(&s->dropped, __ATOMIC_SEQ_CST))
+    return true;
+  if (s->spill)
+    return ac_out_write_record(s->spill, d, len);
+
+  size_t needed = len + sizeof(uint32_t);
+  if (s->cur && s->cur_length + needed > s->cur_size)
+    push_stream_block(s);
+  if (!s->cur) {
+    size_t size = needed > STREAM_BLOCK_SIZE ? needed : STREAM_BLOCK_SIZE;
+    pthread_mutex_lock(&s->mutex);
+    bool fits = s->queued + size <= s->max_queued;
+    if (fits)
+      s->queued += size;
+    pthread_mutex_unlock(&s->mutex);
+    if (!fits) {
+      ac_out_options_t opts;
+      ac_out_options_init(&opts);
+      ac_out_options_format(&opts, ac_io_prefix());
+      s->spill = ac_out_init(s->spill_filename, &opts);
+      s->spilled = true;
+      return ac_out_write_record(s->spill, d, len);
+    }
+    /* ac_in_init_with_buffer terminates the buffer */
+    s->cur = (char *)ac_malloc(size + 1);
+    s->cur_size = size;
+    s->cur_length = 0;
+  }
+  uint32_t length = len;
+  memcpy(s->cur + s->cur_length, &length, sizeof(length));
+  memcpy(s->cur + s->cur_length + sizeof(length), d, len);
+  s->cur_length += needed;
+  return true;
+}
+
+static void stream_close(void *arg) {
+  ac_task_stream_t *s = (ac_task_stream_t *)arg;
+  push_stream_block(s);
+  if (s->spill)
+    ac_out_destroy(s->spill);
+  s->spill = NULL;
+  s->out = NULL;
+  pthread_mutex_lock(&s->mutex);
+  s->closed = true;
+  pthread_cond_broadcast(&s->cond);
+  pthread_mutex_unlock(&s->mutex);
+  release_stream(s);
+}
+
+static ac_in_t *next_stream_in(void *arg) {
+  ac_task_stream_t *s = (ac_task_stream_t *)arg;
+  pthread_mutex_lock(&s->mutex);
+  while (!s->head && !s->closed)
+    pthread_cond_wait(&s->cond, &s->mutex);
+  ac_task_stream_block_t *b = s->head;
+  if (b) {
+    s->head = b->next;
+    if (!s->head)
+      s->tail = NULL;
+  }
+  pthread_mutex_unlock(&s->mutex);
+
+  if (b) {
+    ac_in_options_t opts = s->in_options;
+    if (opts.buffer_size > b->length)
+      opts.buffer_size = b->length;
+    ac_in_t *in = ac_in_init_with_buffer(b->data, b->length, true, &opts);
+    pthread_mutex_lock(&s->mutex);
+    s->queued -= b->length > STREAM_BLOCK_SIZE ? b->length : STREAM_BLOCK_SIZE;
+    pthread_mutex_unlock(&s->mutex);
+    ac_free(b);
+    return in;
+  }
+  if (s->spilled && !s->spill_read) {
+    s->spill_read = true;
+    return ac_in_init(s->spill_filename, &s->in_options);
+  }
+  return NULL;
+}
+
+static ac_task_stream_t *input_stream(ac_worker_t *w, ac_worker_input_t *inp) {
+  if (!inp->src || !inp->src->streams || w->partition >= inp->src->num_partitions)
+    return NULL;
+  ac_task_stream_t *s = inp->src->streams + w->partition;
+  if (!__atomic_load_n(&s->started, __ATOMIC_SEQ_CST))
+    return NULL;
+  return s;
+}
+
+/* Workers lease the memory for their buffers when they open an input or
+   output.  A lease is ram_pct of the scheduler's ram divided by the number of
+   workers running at that moment, so a worker running alone grows into the
+   memory the others aren't using.  Leases are returned when the worker
+   finishes.  Sort buffers report what they actually hold and are written out
+   early once the workers together hold more than 7/8ths of the ram or other
+   workers are waiting for memory to start. */
+#define MIN_LEASE (64 * 1024)
+
+static size_t total_ram(ac_schedule_t *h) { return h->ram * 1024; }
+
+static bool is_ram_pressure(ac_schedule_t *h) {
+  size_t total = total_ram(h);
+  return __atomic_load_n(&h->num_waiting_for_ram, __ATOMIC_SEQ_CST) ||
+         __atomic_load_n(&h->ram_used, __ATOMIC_SEQ_CST) > total - (total >> 3);
+}
+
+/* always taking ram_mutex means a release can't slip in between a waiter
+   checking ram_used and waiting on ram_cond */
+static void wake_ram_waiters(ac_schedule_t *h) {
+  pthread_mutex_lock(&h->ram_mutex);
+  pthread_cond_broadcast(&h->ram_cond);
+  pthread_mutex_unlock(&h->ram_mutex);
+}
+
+/* sort buffers start out empty and report as they fill, everything else is
+   counted as used from the start */
+static ac_ram_lease_t *lease_ram(ac_worker_t *w, double pct, size_t max_size,
+                                 bool reports_usage) {
+  ac_schedule_t *h = w->task->scheduler;
+  ac_schedule_thread_t *t = w->schedule_thread;
+  size_t active = __atomic_load_n(&h->num_running, __ATOMIC_SEQ_CST);
+  if (active > h->cpus)
+    active = h->cpus;
+  if (active < 1)
+    active = 1;
+  size_t size = (size_t)((total_ram(h) * pct) / active);
+  if (max_size && size > max_size)
+    size = max_size;
+  if (size < MIN_LEASE)
+    size = MIN_LEASE;
+
+  /* runners may open outputs from their own threads */
+  ac_ram_lease_t *lease = (ac_ram_lease_t *)ac_calloc(sizeof(*lease));
+  lease->scheduler = h;
+  lease->size = size;
+  pthread_mutex_lock(&h->ram_mutex);
+  if (!reports_usage) {
+    lease->used = size;
+    __atomic_add_fetch(&h->ram_used, size, __ATOMIC_SEQ_CST);
+  }
+  if (!t->leases)
+    __atomic_add_fetch(&h->num_leasing, 1, __ATOMIC_SEQ_CST);
+  lease->next = t->leases;
+  t->leases = lease;
+  pthread_mutex_unlock(&h->ram_mutex);
+  return lease;
+}
+
+static bool lease_spill_check(int64_t change, void *arg) {
+  ac_ram_lease_t *lease = (ac_ram_lease_t *)arg;
+  ac_schedule_t *h = lease->scheduler;
+  __atomic_add_fetch(&lease->used, change, __ATOMIC_SEQ_CST);
+  __atomic_add_fetch(&h->ram_used, change, __ATOMIC_SEQ_CST);
+  if (change < 0) {
+    wake_ram_waiters(h);
+    return false;
+  }
+  return is_ram_pressure(h);
+}
+
+static void release_ram(ac_schedule_thread_t *t) {
+  ac_ram_lease_t *lease = t->leases;
+  if (!lease)
+    return;
+  ac_schedule_t *h = lease->scheduler;
+  pthread_mutex_lock(&h->ram_mutex);
+  lease = t->leases;
+  t->leases = NULL;
+  while (lease) {
+    ac_ram_lease_t *next = lease->next;
+    __atomic_sub_fetch(&h->ram_used, lease->used, __ATOMIC_SEQ_CST);
+    ac_free(lease);
+    lease = next;
+  }
+  __atomic_sub_fetch(&h->num_leasing, 1, __ATOMIC_SEQ_CST);
+  pthread_cond_broadcast(&h->ram_cond);
+  pthread_mutex_unlock(&h->ram_mutex);
+}
+
+/* A worker doesn't start while less than half of a cpu's share of the ram is
+   free, unless no other worker holds memory (so one can always run). */
+static void wait_for_ram(ac_worker_t *w) {
+  ac_schedule_t *h = w->task->scheduler;
+  size_t total = total_ram(h);
+  size_t needed = total / (h->cpus * 2);
+  pthread_mutex_lock(&h->ram_mutex);
+  while (__atomic_load_n(&h->num_leasing, __ATOMIC_SEQ_CST) &&
+         __atomic_load_n(&h->ram_used, __ATOMIC_SEQ_CST) + needed > total) {
+    __atomic_add_fetch(&h->num_waiting_for_ram, 1, __ATOMIC_SEQ_CST);
+    pthread_cond_wait(&h->ram_cond, &h->ram_mutex);
+    __atomic_sub_fetch(&h->num_waiting_for_ram, 1, __ATOMIC_SEQ_CST);
+  }
+  pthread_mutex_unlock(&h->ram_mutex);
+}
+
+bool ac_worker_ram_pressure(ac_worker_t *w) {
+  return is_ram_pressure(w->task->scheduler);
+}
+
+size_t ac_worker_lease_ram(ac_worker_t *w, double pct) {
+  return lease_ram(w, pct, 0, false)->size;
+}
+
 ac_out_t *ac_worker_out(ac_worker_t *w, size_t n) {
   ac_worker_output_t *o = ac_worker_output(w, n);
   if (!o)
     return NULL;
   size_t flags = o->flags;
   char *base_name = ac_worker_output_base(w, o);
-  ac_out_options_buffer_size(&(o->options), ac_worker_ram(w, o->ram_pct));
+  if (o->streams && o->streams[w->partition].started) {
+    ac_task_stream_t *s = o->streams + w->partition;
+    if (s->opened) {
+      printf("%s from %s is streamed and can only be opened once!  Exiting "
+             "early!\n",
+             base_name, w->task->task_name);
+      abort();
+    }
+    s->opened = true;
+    s->out = ac_out_init_with_cb(stream_write_record, stream_close, s);
+    return s->out;
+  }
+  ac_out_options_t options = o->options;
+  ac_out_ext_options_t ext_options;
+  bool sorted = o->ext_options.compare ? true : false;
+  ac_ram_lease_t *lease = lease_ram(w, o->ram_pct, 0, sorted);
+  ac_out_options_buffer_size(&options, lease->size);
   if (flags & AC_OUTPUT_SPLIT) {
     if (!o->ext_options.partition) {
       printf("%s from %s is configured\n  to be split, but does not specify a "
@@ -321,11 +673,13 @@ ac_out_t *ac_worker_out(ac_worker_t *w, size_t n) {
     else
       ac_out_ext_options_num_partitions(&(o->ext_options),
                                         o->task->scheduler->num_partitions);
-    return ac_out_ext_init(base_name, &(o->options), &(o->ext_options));
-  } else {
+  } else
     o->ext_options.partition = NULL;
-    return ac_out_ext_init(base_name, &(o->options), &(o->ext_options));
-  }
+
+  ext_options = o->ext_options;
+  if (sorted)
+    ac_out_ext_options_spill_check(&ext_options, lease_spill_check, lease);
+  return ac_out_ext_init(base_name, &options, &ext_options);
 }
 
 ac_worker_input_t *ac_worker_input(ac_worker_t *w, size_t pos) {
@@ -403,13 +757,35 @@ char *ac_worker_read(ac_worker_t *w, size_t *num_records, char **endp,
 
 ac_in_t *ac_worker_in(ac_worker_t *w, size_t n) {
   ac_worker_input_t *inp = ac_worker_input(w, n);
-  if (!inp || !inp->num_files)
+  if (!inp)
     return NULL;
 
   ac_in_t *in = NULL;
+  ac_task_stream_t *s = input_stream(w, inp);
+  if (s) {
+    ac_in_options_t opts = inp->options;
+    ac_in_options_buffer_size(&opts,
+                              lease_ram(w, inp->ram_pct, 0, false)->size);
+    ac_in_options_format(&opts, ac_io_prefix());
+    opts.gz = false;
+    opts.lz4 = false;
+    opts.tag = w->partition;
+    s->in_options = opts;
+    in = ac_in_init_from_cb(next_stream_in, s);
+    if (!in)
+      in = ac_in_empty();
+    if (inp->limit)
+      ac_in_limit(in, inp->limit);
+    return in;
+  }
+
+  if (!inp->num_files)
+    return NULL;
+
   if (inp->compare && inp->num_files > 1) {
-    ac_in_options_buffer_size(&(inp->options),
-                              ac_worker_ram(w, inp->ram_pct / inp->num_files));
+    ac_in_options_buffer_size(
+        &(inp->options),
+        lease_ram(w, inp->ram_pct, 0, false)->size / inp->num_files);
     in = ac_in_ext_init(inp->compare, inp->compare_arg, &(inp->options));
     if (inp->reducer)
       ac_in_ext_reducer(in, inp->reducer, inp->reducer_arg);
@@ -417,7 +793,9 @@ ac_in_t *ac_worker_in(ac_worker_t *w, size_t n) {
       ac_in_ext_add(in, ac_in_init(inp->files[i].filename, &(inp->options)),
                     inp->files[i].tag);
   } else {
-    ac_in_options_buffer_size(&(inp->options), ac_worker_ram(w, inp->ram_pct));
+    size_t max_size = inp->num_files > 1 ? 0 : inp->files[0].size;
+    ac_in_options_buffer_size(
+        &(inp->options), lease_ram(w, inp->ram_pct, max_size, false)->size);
     if (inp->num_files > 1)
       in = ac_in_init_from_list(inp->files, inp->num_files, &(inp->options));
     else {
@@ -485,10 +863,14 @@ ac_schedule_t *ac_schedule_init(int argc, char **args, size_t num_partitions,
 
   pthread_mutex_init(&(h->mutex), NULL);
   pthread_cond_init(&(h->cond), NULL);
+  pthread_mutex_init(&(h->ram_mutex), NULL);
+  pthread_cond_init(&(h->ram_cond), NULL);
 
   h->started_threads = false;
   h->num_partitions = num_partitions;
   h->state = (ac_task_state_t *)(h + 1);
+  for (size_t i = 0; i < num_partitions; i++)
+    pthread_mutex_init(&(h->state[i].mutex), NULL);
   h->ram = ram * 1024;
   h->cpus = cpus;
   h->disk_space = disk_space * 1024;
@@ -508,6 +890,17 @@ void ac_schedule_task_dir(ac_schedule_t *h, const char *task_dir) {
 }
 
 void ac_schedule_destroy(ac_schedule_t *h) {
+  if (h->threads) {
+    for (size_t i = 0; i < h->cpus; i++) {
+      if (h->threads[i].deque.links)
+        ac_free(h->threads[i].deque.links);
+      pthread_mutex_destroy(&(h->threads[i].deque.mutex));
+    }
+  }
+  for (size_t i = 0; i < h->num_partitions; i++)
+    pthread_mutex_destroy(&(h->state[i].mutex));
+  pthread_mutex_destroy(&(h->ram_mutex));
+  pthread_cond_destroy(&(h->ram_cond));
   ac_pool_destroy(h->tmp_pool);
   ac_pool_t *pool = h->pool;
   ac_pool_destroy(pool);
@@ -540,6 +933,7 @@ void ac_schedule_print(ac_schedule_t *h) {
 
 static void unlink_state(ac_schedule_t *h, ac_task_state_link_t *state,
                          size_t partition) {
+  pthread_mutex_lock(&(h->state[partition].mutex));
   if (state->previous) {
     state->previous->next = state->next;
     if (state->next)
@@ -557,13 +951,15 @@ static void unlink_state(ac_schedule_t *h, ac_task_state_link_t *state,
   }
   state->next = state->previous = NULL;
   if (!state->waiting_on_others && !state->completed)
-    h->num_available--;
+    __atomic_sub_fetch(&h->num_available, 1, __ATOMIC_SEQ_CST);
   else if (state->waiting_on_others)
-    h->num_tasks_to_run--;
+    __atomic_sub_fetch(&h->num_tasks_to_run, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&(h->state[partition].mutex));
 }
 
 static void link_state(ac_schedule_t *h, ac_task_state_link_t *state,
                        size_t partition) {
+  pthread_mutex_lock(&(h->state[partition].mutex));
   ac_task_state_link_t **root = &(h->state[partition].available_tasks);
   if (state->waiting_on_others)
     root = &(h->state[partition].tasks_to_finish);
@@ -577,14 +973,108 @@ static void link_state(ac_schedule_t *h, ac_task_state_link_t *state,
 
   *root = state;
   if (!state->waiting_on_others && !state->completed)
-    h->num_available++;
+    __atomic_add_fetch(&h->num_available, 1, __ATOMIC_SEQ_CST);
   else if (state->waiting_on_others)
-    h->num_tasks_to_run++;
+    __atomic_add_fetch(&h->num_tasks_to_run, 1, __ATOMIC_SEQ_CST);
+  pthread_mutex_unlock(&(h->state[partition].mutex));
 }
 
-static void mark_task_complete(ac_task_state_link_t *state_link,
+static void mark_task_complete(ac_schedule_thread_t *t,
+                               ac_task_state_link_t *state_link,
                                size_t partition, time_t when);
 static bool is_dependencies_complete(ac_task_t *task, size_t partition);
+static bool is_task_complete(ac_task_t *task);
+static bool is_worker_complete(ac_task_t *task, size_t partition);
+
+static void deque_push(schedule_deque_t *d, ac_task_state_link_t *link) {
+  pthread_mutex_lock(&d->mutex);
+  if (d->bottom - d->top == d->size) {
+    size_t size = d->size ? d->size * 2 : 64;
+    ac_task_state_link_t **links = (ac_task_state_link_t **)ac_malloc(
+        sizeof(ac_task_state_link_t *) * size);
+    for (size_t i = d->top; i < d->bottom; i++)
+      links[i - d->top] = d->links[i & (d->size - 1)];
+    if (d->links)
+      ac_free(d->links);
+    d->bottom -= d->top;
+    d->top = 0;
+    d->links = links;
+    d->size = size;
+  }
+  d->links[d->bottom & (d->size - 1)] = link;
+  __atomic_store_n(&d->bottom, d->bottom + 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&d->mutex);
+}
+
+static bool deque_empty(schedule_deque_t *d) {
+  return __atomic_load_n(&d->bottom, __ATOMIC_ACQUIRE) ==
+         __atomic_load_n(&d->top, __ATOMIC_ACQUIRE);
+}
+
+static ac_task_state_link_t *deque_pop(schedule_deque_t *d) {
+  ac_task_state_link_t *link = NULL;
+  if (deque_empty(d))
+    return NULL;
+  pthread_mutex_lock(&d->mutex);
+  if (d->bottom != d->top) {
+    link = d->links[(d->bottom - 1) & (d->size - 1)];
+    __atomic_store_n(&d->bottom, d->bottom - 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&d->mutex);
+  return link;
+}
+
+static ac_task_state_link_t *deque_steal(schedule_deque_t *d) {
+  ac_task_state_link_t *link = NULL;
+  if (deque_empty(d))
+    return NULL;
+  pthread_mutex_lock(&d->mutex);
+  if (d->bottom != d->top) {
+    link = d->links[d->top & (d->size - 1)];
+    __atomic_store_n(&d->top, d->top + 1, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&d->mutex);
+  return link;
+}
+
+static size_t link_partition(ac_task_state_link_t *link) {
+  return link - link->task->state_linkage;
+}
+
+/* Queue an available partition.  Partitions are queued on the thread which
+   made them available if it just finished the same partition (the inputs are
+   likely to still be cached), otherwise on the partition's home thread. */
+static void queue_link(ac_schedule_t *h, ac_schedule_thread_t *t,
+                       ac_task_state_link_t *link, size_t partition) {
+  if (!h->started_threads)
+    return;
+  ac_schedule_thread_t *dest = h->threads + (partition % h->cpus);
+  if (t && t->partition == partition)
+    dest = t;
+  deque_push(&dest->deque, link);
+  __atomic_add_fetch(&h->num_queued, 1, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&h->num_idle, __ATOMIC_SEQ_CST)) {
+    pthread_mutex_lock(&h->mutex);
+    pthread_cond_signal(&h->cond);
+    pthread_mutex_unlock(&h->mutex);
+  }
+}
+
+static ac_task_state_link_t *take_link(ac_schedule_thread_t *t) {
+  ac_schedule_t *h = t->scheduler;
+  ac_task_state_link_t *link = deque_pop(&t->deque);
+  for (size_t i = 1; !link && i < h->cpus; i++)
+    link = deque_steal(&h->threads[(t->thread_id + i) % h->cpus].deque);
+  if (link)
+    __atomic_sub_fetch(&h->num_queued, 1, __ATOMIC_SEQ_CST);
+  return link;
+}
+
+static void wake_all(ac_schedule_t *h) {
+  pthread_mutex_lock(&h->mutex);
+  pthread_cond_broadcast(&h->cond);
+  pthread_mutex_unlock(&h->mutex);
+}
 
 static ac_worker_t *take_worker(ac_schedule_t *scheduler, ac_pool_t *pool,
                                 ac_task_t *task, size_t partition) {
@@ -1154,6 +1644,30 @@ static void get_ack_time_for_task(ac_task_t *task) {
   }
 }
 
+static bool can_stream(ac_worker_output_t *o) {
+  if (!(o->flags & AC_OUTPUT_STREAM) || !(o->flags & AC_OUTPUT_PARTITION) ||
+      (o->flags & AC_OUTPUT_SPLIT))
+    return false;
+  if (!o->destinations || o->destinations->next)
+    return false;
+  if (o->ext_options.compare || o->ext_options.partition)
+    return false;
+  ac_task_t *dest = o->destinations->task;
+  if (dest->do_nothing || dest->num_partitions != o->num_partitions)
+    return false;
+  ac_worker_output_t *other = o->task->outputs;
+  while (other) {
+    ac_task_link_t *link = other == o ? NULL : other->destinations;
+    while (link) {
+      if (link->task == dest)
+        return false;
+      link = link->next;
+    }
+    other = other->next;
+  }
+  return true;
+}
+
 static void schedule_setup(ac_schedule_t *h) {
   if (!h->task_dir)
     h->task_dir = (char *)"tasks";
@@ -1202,6 +1716,51 @@ static void schedule_setup(ac_schedule_t *h) {
   }
   ac_buffer_destroy(bh);
 
+  n = h->head;
+  while (n) {
+    ac_worker_output_t *o = n->outputs;
+    while (o) {
+      if (can_stream(o))
+        o->streams = (ac_task_stream_t *)ac_pool_calloc(
+            h->pool, sizeof(ac_task_stream_t) * o->num_partitions);
+      o = o->next;
+    }
+    n = n->next;
+  }
+
+  /* Count the dependencies each partition is waiting on.  From here on, a
+     partition becomes available when its count drops to zero instead of
+     rechecking all of its dependencies. */
+  h->num_remaining = 0;
+  n = h->head;
+  while (n) {
+    for (size_t i = 0; i < n->num_partitions; i++) {
+      ac_task_state_link_t *state_link = n->state_linkage + i;
+      state_link->pending = 0;
+      if (state_link->completed)
+        continue;
+      h->num_remaining++;
+      ac_task_link_t *link = n->dependencies;
+      while (link) {
+        if (!is_task_complete(link->task))
+          state_link->pending++;
+        link = link->next;
+      }
+      link = n->partial_dependencies;
+      while (link) {
+        if (!is_worker_complete(link->task, i))
+          state_link->pending++;
+        link = link->next;
+      }
+      if (state_link->waiting_on_others != (state_link->pending > 0)) {
+        unlink_state(h, state_link, i);
+        state_link->waiting_on_others = state_link->pending > 0;
+        link_state(h, state_link, i);
+      }
+    }
+    n = n->next;
+  }
+
   time_t current_time = time(NULL);
   n = h->head;
   while (n) {
@@ -1211,7 +1770,7 @@ static void schedule_setup(ac_schedule_t *h) {
           ac_pool_clear(h->tmp_pool);
           ac_worker_t *w = take_worker(h, h->tmp_pool, n, i);
           if (w)
-            mark_task_complete(w->__link, i, current_time);
+            mark_task_complete(NULL, w->__link, i, current_time);
         }
       }
     }
@@ -1220,17 +1779,6 @@ static void schedule_setup(ac_schedule_t *h) {
   ac_pool_clear(h->tmp_pool);
 }
 
-static bool task_available(ac_task_t *task, size_t partition) {
-  ac_schedule_t *scheduler = task->scheduler;
-  ac_task_state_link_t *avail = available_tasks(scheduler, partition);
-  while (avail) {
-    if (avail->task == task)
-      return true;
-    avail = avail->next;
-  }
-  return false;
-}
-
 static bool is_schedule_running(ac_worker_t *w) {
   parsed_args_t *p = &(w->task->scheduler->parsed_args);
   if (p->dump || p->list || p->help)
@@ -1238,6 +1786,8 @@ static bool is_schedule_running(ac_worker_t *w) {
   return true;
 }
 
+static void write_fingerprints(ac_worker_t *w);
+
 static void write_ack(ac_worker_t *w) {
   if (!is_schedule_running(w))
     return;
@@ -1248,6 +1798,7 @@ static void write_ack(ac_worker_t *w) {
   // printf("%s\n", filename);
   FILE *out = fopen(filename, "wb");
   fclose(out);
+  write_fingerprints(w);
 }
 
 static void get_ack_time(ac_worker_t *w) {
@@ -1265,60 +1816,61 @@ static ac_worker_t *worker_complete(ac_worker_t *w, time_t when) {
   if (when > w->ack_time && when > 1)
     write_ack(w);
 
-  // ac_worker_t *next = NULL;
   ac_schedule_t *scheduler = w->task->scheduler;
-  pthread_mutex_lock(&(scheduler->mutex));
-  size_t num_available = scheduler->num_available;
   if (is_worker_selected(w)) {
-    scheduler->parsed_args.num_selected--;
-    if (!scheduler->parsed_args.num_selected)
-      scheduler->done = true;
-  }
-  mark_task_complete(w->__link, w->partition, when);
-  // if (w->next_task && take_available(w->next_task, w->partition))
-  //  next = take_worker(w->next_task, w->partition);
-  if ((!num_available && scheduler->num_available) || scheduler->done)
-    pthread_cond_broadcast(&scheduler->cond);
-  pthread_mutex_unlock(&(scheduler->mutex));
+    if (!__atomic_sub_fetch(&scheduler->parsed_args.num_selected, 1,
+                            __ATOMIC_SEQ_CST)) {
+      __atomic_store_n(&scheduler->done, true, __ATOMIC_SEQ_CST);
+      wake_all(scheduler);
+    }
+  }
+  mark_task_complete(w->schedule_thread, w->__link, w->partition, when);
   return NULL;
 }
 
+static bool is_schedule_done(ac_schedule_t *h) {
+  return __atomic_load_n(&h->done, __ATOMIC_SEQ_CST) ||
+         !__atomic_load_n(&h->num_remaining, __ATOMIC_SEQ_CST);
+}
+
 static ac_worker_t *get_next_worker(ac_schedule_thread_t *t) {
-  ac_pool_t *pool = t->pool;
-  ac_worker_t *w = NULL;
   ac_schedule_t *scheduler = t->scheduler;
-  // printf("Attempting to get task for %lu\n", t->thread_id);
-  pthread_mutex_lock(&(scheduler->mutex));
-  if (scheduler->done) {
+  ac_task_state_link_t *link = NULL;
+  __atomic_sub_fetch(&scheduler->num_running, 1, __ATOMIC_SEQ_CST);
+  while (!is_schedule_done(scheduler)) {
+    link = take_link(t);
+    if (link)
+      break;
+
+    /* num_idle is raised before num_queued is checked so that queue_link
+       either sees the idle thread or the thread sees the queued link. */
+    pthread_mutex_lock(&(scheduler->mutex));
+    __atomic_add_fetch(&scheduler->num_idle, 1, __ATOMIC_SEQ_CST);
+    if (!is_schedule_done(scheduler) &&
+        !__atomic_load_n(&scheduler->num_queued, __ATOMIC_SEQ_CST))
+      pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+    __atomic_sub_fetch(&scheduler->num_idle, 1, __ATOMIC_SEQ_CST);
     pthread_mutex_unlock(&(scheduler->mutex));
-    return NULL;
-  }
-  scheduler->num_running--;
-  while (!scheduler->done && !scheduler->num_available &&
-         scheduler->num_tasks_to_run)
-    pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
-
-  if (scheduler->num_available) {
-    for (size_t p = 0; p < scheduler->num_partitions; p++) {
-      size_t px = (p + t->partition) % scheduler->num_partitions;
-      w = take_worker(scheduler, pool, NULL, px);
-      if (w) {
-        scheduler->num_running++;
-        w->running = scheduler->num_running + scheduler->num_available;
-        if (w->running > scheduler->cpus)
-          w->running = scheduler->cpus;
-        break;
-      }
-    }
   }
-  pthread_mutex_unlock(&(scheduler->mutex));
-  if (w) {
-    w->thread_id = t->thread_id;
-    w->schedule_thread = t;
-  }
-  // if (!w) {
-  //  printf("failed to get task for %lu\n", t->thread_id);
-  // }
+  if (!link)
+    return NULL;
+
+  size_t partition = link_partition(link);
+  unlink_state(scheduler, link, partition);
+  ac_worker_t *w = (ac_worker_t *)ac_pool_calloc(t->pool, sizeof(ac_worker_t));
+  w->task = link->task;
+  w->partition = partition;
+  w->num_partitions = w->task->num_partitions;
+  w->ack_time = -1;
+  w->__link = link;
+  w->running =
+      __atomic_add_fetch(&scheduler->num_running, 1, __ATOMIC_SEQ_CST) +
+      __atomic_load_n(&scheduler->num_queued, __ATOMIC_SEQ_CST);
+  if (w->running > scheduler->cpus)
+    w->running = scheduler->cpus;
+  w->thread_id = t->thread_id;
+  w->schedule_thread = t;
+  t->partition = partition;
   return w;
 }
 
@@ -1327,7 +1879,8 @@ static bool run_worker(ac_worker_t *w) {
   size_t n = 0;
   ac_worker_input_t *inp = w->inputs;
   while (inp) {
-    if (inp->compare) {
+    /* a stream can only be read once */
+    if (inp->compare && !input_stream(w, inp)) {
       ac_in_t *in = ac_worker_in(w, n);
       ac_buffer_t *bh = ac_buffer_init(1000);
       ac_io_record_t cr;
@@ -1377,6 +1930,143 @@ time_t get_ack_time_for_task_and_partition(ac_task_t *task, size_t partition) {
   return ack_time > completed ? ack_time : completed;
 }
 
+/* Fingerprints are kept next to the ack file (<ack>.hash) with one line per
+   file in the form "<o|i> <xxhash64 in hex> <filename>".  Only tasks marked
+   with ac_task_fingerprint have one.  Their outputs are hashed after the
+   worker runs and the fingerprints of the inputs are recorded as they were at
+   the time. */
+static char *fingerprint_filename(ac_worker_t *w, ac_task_t *task,
+                                  size_t partition) {
+  return ac_pool_strdupf(w->worker_pool, "%s/%s_%lu.hash",
+                         task->scheduler->ack_dir, task->task_name, partition);
+}
+
+static bool find_fingerprint(uint64_t *hash, char *buf, size_t len, char type,
+                             const char *filename) {
+  if (!buf)
+    return false;
+  size_t filename_len = strlen(filename);
+  char *p = buf;
+  char *ep = buf + len;
+  while (p < ep) {
+    char *eol = (char *)memchr(p, '\n', ep - p);
+    if (!eol)
+      eol = ep;
+    if (p[0] == type && (size_t)(eol - p) == filename_len + 19 &&
+        !memcmp(p + 19, filename, filename_len)) {
+      *hash = strtoull(p + 2, NULL, 16);
+      return true;
+    }
+    p = eol + 1;
+  }
+  return false;
+}
+
+/* files from other tasks use the fingerprint the source recorded (fi->tag is
+   the source partition), other files are hashed */
+static bool input_fingerprint(ac_worker_t *w, ac_worker_input_t *inp,
+                              ac_io_file_info_t *fi, uint64_t *hash) {
+  if (!inp->src)
+    return ac_io_hash_file(hash, fi->filename);
+
+  size_t len = 0;
+  char *buf = ac_io_read_file(
+      &len, fingerprint_filename(w, inp->src->task, fi->tag));
+  bool found = find_fingerprint(hash, buf, len, 'o', fi->filename);
+  if (buf)
+    ac_free(buf);
+  return found;
+}
+
+static bool is_input_source(ac_worker_t *w, ac_task_t *task) {
+  ac_worker_input_t *inp = w->inputs;
+  while (inp) {
+    if (inp->src && inp->src->task == task)
+      return true;
+    inp = inp->next;
+  }
+  return false;
+}
+
+static bool inputs_unchanged(ac_worker_t *w) {
+  char *filename = fingerprint_filename(w, w->task, w->partition);
+  if (!ac_io_file_exists(filename))
+    return false;
+  size_t len = 0;
+  char *buf = ac_io_read_file(&len, filename);
+  bool unchanged = true;
+  ac_worker_input_t *inp = w->inputs;
+  while (inp && unchanged) {
+    for (size_t i = 0; i < inp->num_files && unchanged; i++) {
+      ac_io_file_info_t *fi = inp->files + i;
+      uint64_t prev = 0, cur = 0;
+      bool had = find_fingerprint(&prev, buf, len, 'i', fi->filename);
+      if (!fi->last_modified)
+        unchanged = !had;
+      else
+        unchanged = had && input_fingerprint(w, inp, fi, &cur) && prev == cur;
+    }
+    inp = inp->next;
+  }
+  if (buf)
+    ac_free(buf);
+  return unchanged;
+}
+
+static void append_fingerprint(ac_buffer_t *bh, char type, uint64_t hash,
+                               const char *filename) {
+  ac_buffer_appendf(bh, "%c %016" PRIx64 " %s\n", type, hash, filename);
+}
+
+static void write_fingerprints(ac_worker_t *w) {
+  /* a stale file would let consumers skip on outputs that have changed */
+  char *filename = fingerprint_filename(w, w->task, w->partition);
+  if (!w->task->fingerprint) {
+    remove(filename);
+    return;
+  }
+
+  ac_buffer_t *bh = ac_buffer_init(1024);
+  uint64_t hash;
+  ac_worker_output_t *o = w->outputs;
+  while (o) {
+    /* streamed outputs aren't written */
+    char *base = o->streams ? NULL : ac_worker_output_base(w, o);
+    if (base && (o->flags & AC_OUTPUT_SPLIT)) {
+      size_t num_partitions = o->destinations
+                                  ? o->destinations->task->num_partitions
+                                  : w->task->scheduler->num_partitions;
+      char *split = (char *)ac_pool_alloc(w->worker_pool, strlen(base) + 20);
+      for (size_t i = 0; i < num_partitions; i++) {
+        ac_out_partition_filename(split, base, i);
+        if (ac_io_hash_file(&hash, split))
+          append_fingerprint(bh, 'o', hash, split);
+      }
+    } else if (base && ac_io_hash_file(&hash, base))
+      append_fingerprint(bh, 'o', hash, base);
+    o = o->next;
+  }
+
+  ac_worker_input_t *inp = w->inputs;
+  while (inp) {
+    if (!input_stream(w, inp)) {
+      for (size_t i = 0; i < inp->num_files; i++) {
+        ac_io_file_info_t *fi = inp->files + i;
+        if (fi->last_modified && input_fingerprint(w, inp, fi, &hash))
+          append_fingerprint(bh, 'i', hash, fi->filename);
+      }
+    }
+    inp = inp->next;
+  }
+
+  FILE *out = fopen(filename, "wb");
+  if (out) {
+    fwrite(ac_buffer_data(bh), ac_buffer_length(bh), 1, out);
+    fclose(out);
+  }
+  ac_buffer_destroy(bh);
+}
+
 static bool task_run_per_args(ac_worker_t *w) {
   ac_schedule_t *scheduler = w->task->scheduler;
   if (scheduler->parsed_args.only_run_selected) {
@@ -1384,6 +2074,14 @@ static bool task_run_per_args(ac_worker_t *w) {
       return true;
     if (w->task->selected && w->task->selected[w->partition])
       return true;
+    /* a selected destination can't run without its streamed source */
+    ac_worker_output_t *o = w->task->outputs;
+    while (o) {
+      ac_task_t *dest = o->streams ? o->destinations->task : NULL;
+      if (dest && dest->selected && dest->selected[w->partition])
+        return true;
+      o = o->next;
+    }
     return false;
   }
   if (!scheduler->parsed_args.select_all &&
@@ -1392,10 +2090,71 @@ static bool task_run_per_args(ac_worker_t *w) {
   return true;
 }
 
+/* A streamed output is never written, so a destination which runs without
+   its source reads nothing.  The source runs unless the destination partition
+   is certain to be skipped, which can't be known while any of the
+   destination's other dependencies are still pending.  Inputs from outside of
+   the schedule aren't checked here, so their presence also counts. */
+static bool stream_destination_may_run(ac_worker_t *w, ac_task_t *dest) {
+  size_t partition = w->partition;
+  time_t ack_time = get_ack_time_for_task_and_partition(dest, partition);
+  if (ack_time < w->ack_time || dest->run_everytime)
+    return true;
+
+  parsed_args_t *args = &w->task->scheduler->parsed_args;
+  if (args->force && (args->select_all ||
+                      (dest->selected && dest->selected[partition])))
+    return true;
+
+  ac_task_link_t *link = dest->dependencies;
+  while (link) {
+    if (link->task != w->task) {
+      for (size_t i = 0; i < link->task->num_partitions; i++) {
+        if (!is_worker_complete(link->task, i) ||
+            get_ack_time_for_task_and_partition(link->task, i) > ack_time)
+          return true;
+      }
+    }
+    link = link->next;
+  }
+  link = dest->partial_dependencies;
+  while (link) {
+    if (link->task != w->task &&
+        (!is_worker_complete(link->task, partition) ||
+         get_ack_time_for_task_and_partition(link->task, partition) >
+             ack_time))
+      return true;
+    link = link->next;
+  }
+
+  ac_worker_input_t *inp = dest->inputs;
+  while (inp) {
+    if (!inp->src)
+      return true;
+    inp = inp->next;
+  }
+  return false;
+}
+
 static bool worker_needs_to_run(ac_worker_t *w) {
   if (w->ack_time == 0)
     return true;
 
+  /* the records of a started stream only exist while the source runs, and a
+     source must run again if its destination didn't finish reading it */
+  ac_worker_input_t *inp = w->inputs;
+  while (inp) {
+    if (input_stream(w, inp))
+      return true;
+    inp = inp->next;
+  }
+  ac_worker_output_t *o = w->task->outputs;
+  while (o) {
+    if (o->streams && stream_destination_may_run(w, o->destinations->task))
+      return true;
+    o = o->next;
+  }
+
   if (w->task->run_everytime)
     return true;
 
@@ -1406,13 +2165,21 @@ static bool worker_needs_to_run(ac_worker_t *w) {
       return true;
   }
 
+  /* for fingerprinted tasks, newer inputs (or dependencies which produce them)
+     only cause a rerun if their fingerprints differ from the ones this worker
+     last ran with.  Other dependencies always cause a rerun since their
+     effect can't be seen. */
+  bool newer_inputs = false;
   ac_task_t *task = w->task;
   ac_task_link_t *link = task->dependencies;
   while (link) {
     for (size_t i = 0; i < link->task->num_partitions; i++) {
       time_t ack_time = get_ack_time_for_task_and_partition(link->task, i);
-      if (ack_time > w->ack_time)
-        return true;
+      if (ack_time > w->ack_time) {
+        if (!is_input_source(w, link->task))
+          return true;
+        newer_inputs = true;
+      }
     }
     link = link->next;
   }
@@ -1420,8 +2187,11 @@ static bool worker_needs_to_run(ac_worker_t *w) {
   while (link) {
     time_t ack_time =
         get_ack_time_for_task_and_partition(link->task, w->partition);
-    if (ack_time > w->ack_time)
-      return true;
+    if (ack_time > w->ack_time) {
+      if (!is_input_source(w, link->task))
+        return true;
+      newer_inputs = true;
+    }
     link = link->next;
   }
 
@@ -1430,11 +2200,13 @@ static bool worker_needs_to_run(ac_worker_t *w) {
     while (n) {
       for (size_t i = 0; i < n->num_files; i++) {
         if (n->files[i].last_modified > w->ack_time)
-          return true;
+          newer_inputs = true;
       }
       n = n->next;
     }
   }
+  if (newer_inputs)
+    return !w->task->fingerprint || !inputs_unchanged(w);
   return false;
 }
 
@@ -1444,9 +2216,9 @@ static void destroy_worker(ac_worker_t *w) {
 }
 
 static void mark_as_done(ac_schedule_t *scheduler) {
-  pthread_mutex_unlock(&(scheduler->mutex));
+  pthread_mutex_lock(&(scheduler->mutex));
   if (!scheduler->done) {
-    scheduler->done = true;
+    __atomic_store_n(&scheduler->done, true, __ATOMIC_SEQ_CST);
     pthread_cond_broadcast(&scheduler->cond);
   }
   pthread_mutex_unlock(&(scheduler->mutex));
@@ -1657,6 +2429,7 @@ void debug_task(ac_schedule_thread_t *h) {
 
   setup_worker(w);
   run_worker(w);
+  release_ram(h);
   destroy_worker(w);
   ac_pool_destroy(pool);
   ac_pool_destroy(tmp_pool);
@@ -1664,6 +2437,65 @@ void debug_task(ac_schedule_thread_t *h) {
   ac_buffer_destroy(w->bh);
 }
 
+static void dependency_complete(ac_schedule_thread_t *t,
+                                ac_task_state_link_t *state_link,
+                                size_t partition, time_t when);
+
+/* Streamed outputs release their destination partition as the source starts
+   so that both run at the same time. */
+static void start_streams(ac_worker_t *w) {
+  ac_worker_output_t *o = w->task->outputs;
+  while (o) {
+    if (o->streams) {
+      ac_task_stream_t *s = o->streams + w->partition;
+      pthread_mutex_init(&s->mutex, NULL);
+      pthread_cond_init(&s->cond, NULL);
+      s->max_queued = ac_worker_ram(w, o->ram_pct);
+      if (s->max_queued < STREAM_BLOCK_SIZE)
+        s->max_queued = STREAM_BLOCK_SIZE;
+      s->spill_filename = ac_strdup(_ac_worker_output_base(w, o, "_spill"));
+      s->refs = 2;
+      __atomic_store_n(&s->started, true, __ATOMIC_SEQ_CST);
+      ac_task_t *dest = o->destinations->task;
+      dependency_complete(w->schedule_thread,
+                          dest->state_linkage + w->partition, w->partition,
+                          time(NULL));
+    }
+    o = o->next;
+  }
+}
+
+/* close streams which the runner didn't open or didn't destroy */
+static void close_streams(ac_worker_t *w) {
+  ac_worker_output_t *o = w->task->outputs;
+  while (o) {
+    if (o->streams) {
+      ac_task_stream_t *s = o->streams + w->partition;
+      if (s->started && !s->closed) {
+        if (s->out)
+          ac_out_destroy(s->out);
+        else
+          stream_close(s);
+      }
+    }
+    o = o->next;
+  }
+}
+
+/* the destination releases its streams whether it ran or not, anything still
+   being written to them is dropped */
+static void release_streams(ac_worker_t *w) {
+  ac_worker_input_t *inp = w->inputs;
+  while (inp) {
+    ac_task_stream_t *s = input_stream(w, inp);
+    if (s) {
+      __atomic_store_n(&s->dropped, true, __ATOMIC_SEQ_CST);
+      release_stream(s);
+    }
+    inp = inp->next;
+  }
+}
+
 void *schedule_thread(void *arg) {
   ac_schedule_thread_t *t = (ac_schedule_thread_t *)arg;
   t->pool = ac_pool_init(65536);
@@ -1687,10 +2519,17 @@ void *schedule_thread(void *arg) {
 
     if (worker_needs_to_run(w)) {
       if (!task_run_per_args(w)) {
+        release_streams(w);
         worker_complete(w, w->ack_time ? w->ack_time : 1);
       } else {
+        wait_for_ram(w);
         setup_worker(w);
-        if (!run_worker(w)) {
+        start_streams(w);
+        bool ok = run_worker(w);
+        close_streams(w);
+        release_streams(w);
+        release_ram(t);
+        if (!ok) {
           destroy_worker(w);
           break;
         }
@@ -1703,8 +2542,10 @@ void *schedule_thread(void *arg) {
         worker_complete(w, time(NULL));
         destroy_worker(w);
       }
-    } else
+    } else {
+      release_streams(w);
       worker_complete(w, w->ack_time ? w->ack_time : 1);
+    }
   }
   ac_pool_destroy(t->pool);
   ac_pool_destroy(tmp_pool);
@@ -2438,6 +3279,19 @@ void ac_schedule_run(ac_schedule_t *h, ac_worker_cb on_complete) {
     ac_schedule_thread_t *a = h->threads + i;
     a->thread_id = i;
     a->scheduler = h;
+    a->partition = i;
+    pthread_mutex_init(&(a->deque.mutex), NULL);
+  }
+
+  /* seed each thread's deque with the partitions that are already available,
+     later partitions are queued as their dependencies complete */
+  h->started_threads = true;
+  for (size_t i = 0; i < h->num_partitions; i++) {
+    ac_task_state_link_t *avail = available_tasks(h, i);
+    while (avail) {
+      queue_link(h, NULL, avail, i);
+      avail = avail->next;
+    }
   }
 
   if (h->parsed_args.debug_task) {
@@ -2520,6 +3374,7 @@ ac_task_t *ac_schedule_task(ac_schedule_t *h, const char *task_name,
 }
 
 void ac_task_run_everytime(ac_task_t *task) { task->run_everytime = true; }
+void ac_task_fingerprint(ac_task_t *task) { task->fingerprint = true; }
 void ac_task_do_nothing(ac_task_t *task) { task->do_nothing = true; }
 
 static bool is_task_complete(ac_task_t *task) {
@@ -2629,21 +3484,39 @@ bool ac_task_partial_dependency(ac_task_t *task, const char *dependency) {
   return _ac_task_dependency(task, dependency, true);
 }
 
-static void check_task(ac_schedule_t *scheduler,
-                       ac_task_state_link_t *state_link, size_t partition,
-                       time_t when) {
-  if (state_link->waiting_on_others &&
-      is_dependencies_complete(state_link->task, partition)) {
-    unlink_state(scheduler, state_link, partition);
-    state_link->waiting_on_others = false;
-    if (state_link->task->do_nothing)
-      mark_task_complete(state_link, partition, when);
-    else
-      link_state(scheduler, state_link, partition);
+static void dependency_complete(ac_schedule_thread_t *t,
+                                ac_task_state_link_t *state_link,
+                                size_t partition, time_t when) {
+  if (state_link->completed ||
+      __atomic_sub_fetch(&state_link->pending, 1, __ATOMIC_SEQ_CST))
+    return;
+
+  ac_schedule_t *scheduler = state_link->task->scheduler;
+  unlink_state(scheduler, state_link, partition);
+  state_link->waiting_on_others = false;
+  if (state_link->task->do_nothing)
+    mark_task_complete(t, state_link, partition, when);
+  else {
+    link_state(scheduler, state_link, partition);
+    queue_link(scheduler, t, state_link, partition);
   }
 }
 
-static void mark_task_complete(ac_task_state_link_t *state_link,
+/* the destination of a started stream was already released by start_streams */
+static bool is_streaming_to(ac_task_t *task, ac_task_t *dest,
+                            size_t partition) {
+  ac_worker_output_t *o = task->outputs;
+  while (o) {
+    if (o->streams && o->destinations->task == dest &&
+        __atomic_load_n(&o->streams[partition].started, __ATOMIC_SEQ_CST))
+      return true;
+    o = o->next;
+  }
+  return false;
+}
+
+static void mark_task_complete(ac_schedule_thread_t *t,
+                               ac_task_state_link_t *state_link,
                                size_t partition, time_t when) {
   ac_task_t *task = state_link->task;
   ac_schedule_t *scheduler = task->scheduler;
@@ -2651,42 +3524,37 @@ static void mark_task_complete(ac_task_state_link_t *state_link,
   state_link->completed = when;
   link_state(scheduler, state_link, partition);
 
-  bool partially_complete = false;
-  for (size_t i = 0; i < task->num_partitions; i++) {
-    if (!task->state_linkage[i].completed) {
-      partially_complete = true;
-      break;
-    }
-  }
+  bool task_complete = __atomic_add_fetch(&task->num_completed, 1,
+                                          __ATOMIC_SEQ_CST) ==
+                       task->num_partitions;
 
-  if (!partially_complete) {
+  if (task_complete) {
     ac_task_link_t *link = task->reverse_dependencies;
     while (link) {
-      for (size_t i = 0; i < link->task->num_partitions; i++) {
-        ac_task_state_link_t *state_link = link->task->state_linkage + i;
-        check_task(scheduler, state_link, i, when);
-      }
-      link = link->next;
-    }
-    link = task->reverse_partial_dependencies;
-    while (link) {
-      for (size_t i = 0; i < link->task->num_partitions; i++) {
-        ac_task_state_link_t *state_link = link->task->state_linkage + i;
-        check_task(scheduler, state_link, i, when);
-      }
+      for (size_t i = 0; i < link->task->num_partitions; i++)
+        dependency_complete(t, link->task->state_linkage + i, i, when);
       link = link->next;
     }
-  } else {
-    ac_task_link_t *link = task->reverse_partial_dependencies;
-    while (link) {
-      size_t i = partition;
-      if (i < link->task->num_partitions) {
-        ac_task_state_link_t *state_link = link->task->state_linkage + i;
-        check_task(scheduler, state_link, i, when);
-      }
-      link = link->next;
+  }
+
+  /* partitions beyond the dependency's partitions depend on partition 0 */
+  ac_task_link_t *link = task->reverse_partial_dependencies;
+  while (link) {
+    if (partition < link->task->num_partitions &&
+        !is_streaming_to(task, link->task, partition))
+      dependency_complete(t, link->task->state_linkage + partition, partition,
+                          when);
+    if (partition == 0) {
+      for (size_t i = task->num_partitions; i < link->task->num_partitions;
+           i++)
+        dependency_complete(t, link->task->state_linkage + i, i, when);
     }
+    link = link->next;
   }
+
+  if (!__atomic_sub_fetch(&scheduler->num_remaining, 1, __ATOMIC_SEQ_CST) &&
+      scheduler->started_threads)
+    wake_all(scheduler);
 }
 
 const char *ac_task_name(ac_task_t *task) { return task->task_name; }
@@ -0,0 +1,473 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "ac_uring.h"
+
+#include "another-c-library/ac_allocator.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define AC_HAVE_IO_URING
+#endif
+#endif
+
+#ifdef AC_HAVE_IO_URING
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define AC_URING_ENTRIES 256
+#define AC_URING_SUBMIT_BATCH 16
+
+/*
+  The ring is used without liburing.  Reads are queued into the submission
+  queue as slots are consumed and are only submitted once enough are pending,
+  when a reader would otherwise stall, or when a reader has to wait.  The
+  ring is shared by every file opened on the thread and is protected by a
+  mutex because an ac_in may be consumed on another thread (read ahead).
+*/
+typedef struct ac_uring_s ac_uring_t;
+
+/* a slot is READY when a read completes and FILLED once it holds slot_size
+   bytes or the rest of the file */
+enum { SLOT_FREE = 0, SLOT_QUEUED = 1, SLOT_READY = 2, SLOT_FILLED = 3 };
+
+typedef struct {
+  ac_uring_file_t *file;
+  char *data;
+  size_t length;
+  struct iovec iov;
+  off_t offset;
+  uint64_t seq;
+  int state;
+  int res;
+} ac_uring_slot_t;
+
+struct ac_uring_file_s {
+  ac_uring_t *ring;
+  int fd;
+  off_t offset;
+  bool eof;
+  int error;
+  size_t in_flight;
+  size_t num_slots;
+  size_t slot_size;
+  size_t head;
+  size_t pos;
+  ac_uring_slot_t *slots;
+};
+
+struct ac_uring_s {
+  pthread_mutex_t mutex;
+  int fd;
+  size_t refs;
+
+  /* set if io_uring_enter fails, after which nothing more is submitted and
+     reads which weren't submitted are done with pread */
+  int error;
+
+  /* queued counts every sqe written, submitted every sqe handed to the
+     kernel, the difference is pending */
+  uint64_t queued;
+  uint64_t submitted;
+  size_t in_flight;
+
+  unsigned sq_entries;
+  unsigned cq_entries;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr;
+  void *cq_ptr;
+  size_t sq_len;
+  size_t cq_len;
+  size_t sqes_len;
+};
+
+static void ring_destroy(ac_uring_t *r) {
+  if (r->sqes)
+    munmap(r->sqes, r->sqes_len);
+  if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+    munmap(r->cq_ptr, r->cq_len);
+  if (r->sq_ptr)
+    munmap(r->sq_ptr, r->sq_len);
+  close(r->fd);
+  pthread_mutex_destroy(&r->mutex);
+  ac_free(r);
+}
+
+static void *ring_mmap(int fd, size_t len, off_t offset) {
+  void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                 fd, offset);
+  return p == MAP_FAILED ? NULL : p;
+}
+
+static ac_uring_t *ring_init() {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  int fd = syscall(__NR_io_uring_setup, AC_URING_ENTRIES, &p);
+  if (fd < 0)
+    return NULL;
+
+  ac_uring_t *r = (ac_uring_t *)ac_calloc(sizeof(ac_uring_t));
+  pthread_mutex_init(&r->mutex, NULL);
+  r->fd = fd;
+  r->sq_entries = p.sq_entries;
+  r->cq_entries = p.cq_entries;
+  r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && r->cq_len > r->sq_len)
+    r->sq_len = r->cq_len;
+
+  r->sq_ptr = ring_mmap(fd, r->sq_len, IORING_OFF_SQ_RING);
+  if (!r->sq_ptr)
+    goto fail;
+  if (single_mmap)
+    r->cq_ptr = r->sq_ptr;
+  else if (!(r->cq_ptr = ring_mmap(fd, r->cq_len, IORING_OFF_CQ_RING)))
+    goto fail;
+  r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = (struct io_uring_sqe *)ring_mmap(fd, r->sqes_len, IORING_OFF_SQES);
+  if (!r->sqes)
+    goto fail;
+
+  char *sq = (char *)r->sq_ptr;
+  r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+  r->sq_array = (unsigned *)(sq + p.sq_off.array);
+  char *cq = (char *)r->cq_ptr;
+  r->cq_head = (unsigned *)(cq + p.cq_off.head);
+  r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return r;
+
+fail:
+  ring_destroy(r);
+  return NULL;
+}
+
+static void ring_release(ac_uring_t *r) {
+  pthread_mutex_lock(&r->mutex);
+  r->refs--;
+  bool last = r->refs == 0;
+  pthread_mutex_unlock(&r->mutex);
+  if (last)
+    ring_destroy(r);
+}
+
+static pthread_once_t thread_ring_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_ring_key;
+static bool io_uring_unavailable = false; /* accessed atomically */
+
+static void release_thread_ring(void *arg) { ring_release((ac_uring_t *)arg); }
+
+static void create_thread_ring_key() {
+  pthread_key_create(&thread_ring_key, release_thread_ring);
+}
+
+/* the thread holds a reference until it exits */
+static ac_uring_t *thread_ring() {
+  if (__atomic_load_n(&io_uring_unavailable, __ATOMIC_ACQUIRE))
+    return NULL;
+  pthread_once(&thread_ring_once, create_thread_ring_key);
+  ac_uring_t *r = (ac_uring_t *)pthread_getspecific(thread_ring_key);
+  if (!r) {
+    r = ring_init();
+    if (!r) {
+      __atomic_store_n(&io_uring_unavailable, true, __ATOMIC_RELEASE);
+      return NULL;
+    }
+    r->refs = 1;
+    pthread_setspecific(thread_ring_key, r);
+  }
+  return r;
+}
+
+/* completions are matched to slots through user_data */
+static void reap(ac_uring_t *r) {
+  unsigned head = *r->cq_head;
+  unsigned tail = __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE);
+  unsigned mask = *r->cq_mask;
+  while (head != tail) {
+    struct io_uring_cqe *cqe = r->cqes + (head & mask);
+    ac_uring_slot_t *s = (ac_uring_slot_t *)(uintptr_t)cqe->user_data;
+    s->res = cqe->res;
+    s->state = SLOT_READY;
+    s->file->in_flight--;
+    r->in_flight--;
+    head++;
+  }
+  __atomic_store_n(r->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/* submit everything pending and wait for at least min_complete completions.
+   Once the ring has failed, reads already submitted still complete, so this
+   only reaps (yielding if waiting). */
+static void enter(ac_uring_t *r, unsigned min_complete) {
+  while (!r->error) {
+    unsigned to_submit = r->queued - r->submitted;
+    int n = syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+                    min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (n >= 0) {
+      r->submitted += n;
+      if ((unsigned)n == to_submit)
+        break;
+      continue;
+    }
+    if (errno == EINTR)
+      continue;
+    if (errno == EAGAIN || errno == EBUSY) {
+      reap(r);
+      continue;
+    }
+    /* other errors won't go away, new files fall back to read() */
+    r->error = errno;
+    __atomic_store_n(&io_uring_unavailable, true, __ATOMIC_RELEASE);
+  }
+  reap(r);
+  if (r->error && min_complete)
+    sched_yield();
+}
+
+static void read_slot(ac_uring_slot_t *s) {
+  ac_uring_file_t *f = s->file;
+  ssize_t n;
+  do {
+    n = pread(f->fd, s->data + s->length, f->slot_size - s->length,
+              s->offset + s->length);
+  } while (n < 0 && errno == EINTR);
+  s->res = n < 0 ? -errno : (int)n;
+  s->state = SLOT_READY;
+}
+
+/* a queued read that the kernel never saw */
+static inline bool unsubmitted(ac_uring_t *r, ac_uring_slot_t *s) {
+  return s->state == SLOT_QUEUED && s->seq >= r->submitted;
+}
+
+static void complete_unsubmitted(ac_uring_t *r, ac_uring_slot_t *s) {
+  read_slot(s);
+  s->file->in_flight--;
+  r->in_flight--;
+}
+
+/* reads the part of the slot which isn't filled yet */
+static void submit_read(ac_uring_t *r, ac_uring_slot_t *s) {
+  ac_uring_file_t *f = s->file;
+  /* never have more reads outstanding than completions fit in the cq */
+  while (!r->error && r->in_flight >= r->cq_entries)
+    enter(r, 1);
+  if (!r->error && r->queued - r->submitted >= r->sq_entries)
+    enter(r, 0);
+  if (r->error) {
+    read_slot(s);
+    return;
+  }
+
+  unsigned tail = *r->sq_tail;
+  unsigned idx = tail & *r->sq_mask;
+  struct io_uring_sqe *sqe = r->sqes + idx;
+  memset(sqe, 0, sizeof(*sqe));
+  s->iov.iov_base = s->data + s->length;
+  s->iov.iov_len = f->slot_size - s->length;
+  sqe->opcode = IORING_OP_READV;
+  sqe->fd = f->fd;
+  sqe->addr = (uintptr_t)&s->iov;
+  sqe->len = 1;
+  sqe->off = s->offset + s->length;
+  sqe->user_data = (uintptr_t)s;
+  r->sq_array[idx] = idx;
+  __atomic_store_n(r->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  f->in_flight++;
+  s->state = SLOT_QUEUED;
+  s->seq = r->queued;
+  r->queued++;
+  r->in_flight++;
+}
+
+static void queue_read(ac_uring_t *r, ac_uring_slot_t *s) {
+  ac_uring_file_t *f = s->file;
+  s->offset = f->offset;
+  s->length = 0;
+  f->offset += f->slot_size;
+  submit_read(r, s);
+}
+
+/* Waits for the slot to be filled.  A short read is resubmitted for the rest
+   of the slot as it may not be at the end of the file, only a read of zero
+   bytes is.  A failed read is kept in the file's error. */
+static void fill_slot(ac_uring_t *r, ac_uring_slot_t *s) {
+  ac_uring_file_t *f = s->file;
+  while (s->state != SLOT_FILLED) {
+    while (s->state != SLOT_READY) {
+      if (r->error && unsubmitted(r, s))
+        complete_unsubmitted(r, s);
+      else
+        enter(r, 1);
+    }
+    if (s->res < 0) {
+      f->error = -s->res;
+      return;
+    }
+    s->length += s->res;
+    if (s->res == 0)
+      f->eof = true;
+    if (s->res == 0 || s->length == f->slot_size)
+      s->state = SLOT_FILLED;
+    else
+      submit_read(r, s);
+  }
+}
+
+ac_uring_file_t *ac_uring_file_init(int fd, off_t offset, size_t num_slots,
+                                    size_t slot_size) {
+  if (num_slots < 2)
+    num_slots = 2;
+  if (slot_size > 0x7FFFFFFF)
+    return NULL;
+  ac_uring_t *r = thread_ring();
+  if (!r)
+    return NULL;
+
+  ac_uring_file_t *h = (ac_uring_file_t *)ac_calloc(
+      sizeof(ac_uring_file_t) + (sizeof(ac_uring_slot_t) * num_slots) +
+      (slot_size * num_slots));
+  h->ring = r;
+  h->fd = fd;
+  h->offset = offset;
+  h->num_slots = num_slots;
+  h->slot_size = slot_size;
+  h->slots = (ac_uring_slot_t *)(h + 1);
+  char *p = (char *)(h->slots + num_slots);
+  for (size_t i = 0; i < num_slots; i++) {
+    h->slots[i].file = h;
+    h->slots[i].data = p;
+    p += slot_size;
+  }
+
+  pthread_mutex_lock(&r->mutex);
+  r->refs++;
+  for (size_t i = 0; i < num_slots; i++)
+    queue_read(r, h->slots + i);
+  enter(r, 0);
+  pthread_mutex_unlock(&r->mutex);
+  return h;
+}
+
+ssize_t ac_uring_file_copy(ac_uring_file_t *h, char *dest, size_t len) {
+  ac_uring_t *r = h->ring;
+  size_t copied = 0;
+  while (copied < len && !h->error) {
+    ac_uring_slot_t *s = h->slots + h->head;
+    pthread_mutex_lock(&r->mutex);
+    if (s->state == SLOT_FREE) {
+      pthread_mutex_unlock(&r->mutex);
+      break;
+    }
+    fill_slot(r, s);
+    pthread_mutex_unlock(&r->mutex);
+    if (h->error)
+      break;
+
+    size_t n = s->length - h->pos;
+    if (n > len - copied)
+      n = len - copied;
+    memcpy(dest + copied, s->data + h->pos, n);
+    copied += n;
+    h->pos += n;
+    if (h->pos < s->length)
+      break;
+
+    pthread_mutex_lock(&r->mutex);
+    s->state = SLOT_FREE;
+    if (!h->eof)
+      queue_read(r, s);
+    pthread_mutex_unlock(&r->mutex);
+    h->head++;
+    if (h->head == h->num_slots)
+      h->head = 0;
+    h->pos = 0;
+    if (h->eof)
+      break;
+  }
+
+  /* submit if enough reads are pending or if the next slot of this file
+     hasn't been submitted yet */
+  pthread_mutex_lock(&r->mutex);
+  ac_uring_slot_t *s = h->slots + h->head;
+  if (r->queued - r->submitted >= AC_URING_SUBMIT_BATCH ||
+      (s->state == SLOT_QUEUED && s->seq >= r->submitted))
+    enter(r, 0);
+  pthread_mutex_unlock(&r->mutex);
+  if (h->error) {
+    errno = h->error;
+    return -1;
+  }
+  return copied;
+}
+
+void ac_uring_file_destroy(ac_uring_file_t *h) {
+  ac_uring_t *r = h->ring;
+  pthread_mutex_lock(&r->mutex);
+  if (r->error) {
+    for (size_t i = 0; i < h->num_slots; i++) {
+      ac_uring_slot_t *s = h->slots + i;
+      if (unsubmitted(r, s)) {
+        s->state = SLOT_FREE;
+        h->in_flight--;
+        r->in_flight--;
+      }
+    }
+  }
+  while (h->in_flight)
+    enter(r, 1);
+  pthread_mutex_unlock(&r->mutex);
+  ring_release(r);
+  ac_free(h);
+}
+
+#else
+
+ac_uring_file_t *ac_uring_file_init(int fd, off_t offset, size_t num_slots,
+                                    size_t slot_size) {
+  return NULL;
+}
+
+ssize_t ac_uring_file_copy(ac_uring_file_t *h, char *dest, size_t len) {
+  return 0;
+}
+
+void ac_uring_file_destroy(ac_uring_file_t *h) {}
+
+#endif
@@ -0,0 +1,42 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_uring_H
+#define _ac_uring_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Reads a file with io_uring, keeping up to num_slots reads of slot_size bytes
+   in flight.  All of the files opened by a thread share one ring, so reads
+   which are queued by different inputs of a merge are submitted together. */
+struct ac_uring_file_s;
+typedef struct ac_uring_file_s ac_uring_file_t;
+
+/* Starts reading fd at offset.  Returns NULL if io_uring isn't available, in
+   which case the caller should keep using read(). */
+ac_uring_file_t *ac_uring_file_init(int fd, off_t offset, size_t num_slots,
+                                    size_t slot_size);
+
+/* copy up to len bytes into dest, fewer only at the end of the file.  Returns
+   -1 with errno set once a read has failed. */
+ssize_t ac_uring_file_copy(ac_uring_file_t *h, char *dest, size_t len);
+
+/* waits for outstanding reads, does not close fd */
+void ac_uring_file_destroy(ac_uring_file_t *h);
+
+#endif
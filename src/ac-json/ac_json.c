@@ -25,6 +25,8 @@ limitations under the License.
 #include <stdio.h>
 #include <string.h>
 
+#include "ac_json_scan.h"
+
 #define AC_JSON_NATURAL_NUMBER_CASE                                            \
   '1' : case '2' : case '3' : case '4' : case '5' : case '6' : case '7'        \
       : case '8' : case '9'
@@ -101,6 +103,7 @@ limitations under the License.
 #define AC_JSON_DECIMAL_NUMBER goto decimal_number
 #endif
 
+
 static void ac_json_dump_object_to_buffer(ac_buffer_t *bh, _ac_jsono_t *a);
 static void ac_json_dump_array_to_buffer(ac_buffer_t *bh, _ac_jsona_t *a);
 
@@ -609,6 +612,7 @@ start_key:;
     key = p;
     goto get_end_of_key;
   case AC_JSON_SPACE_CASE:
+    p = ac_json_skip_space(p, ep);
     AC_JSON_START_KEY;
   case '}':
     // if (mode == AC_JSON_RDONLY)
@@ -635,8 +639,7 @@ start_key:;
   };
 
 get_end_of_key:;
-  while (p < ep && *p != '\"')
-    p++;
+  p = ac_json_find_quote(p, ep);
   if (p < ep) {
     if (p[-1] == '\\') {
         // if odd number of \, then skip "
@@ -815,8 +818,7 @@ start_key_object:;
   };
 
 keyed_start_string:;
-  while (p < ep && *p != '\"')
-    p++;
+  p = ac_json_find_quote(p, ep);
   if (p >= ep) {
     AC_JSON_BAD_CHARACTER;
   }
@@ -881,7 +883,7 @@ look_for_key:;
     }
 
   case AC_JSON_SPACE_CASE:
-    p++;
+    p = ac_json_skip_space(p + 1, ep);
     ch = *p;
     goto look_for_key;
   default:
@@ -928,6 +930,7 @@ start_value:;
     data_type = AC_JSON_STRING;
     AC_JSON_START_STRING;
   case AC_JSON_SPACE_CASE:
+    p = ac_json_skip_space(p, ep);
     AC_JSON_START_VALUE;
   case '{':
     anode = (ac_jsona_t *)ac_pool_calloc(pool, sizeof(ac_jsona_t) +
@@ -1115,8 +1118,7 @@ start_value:;
   };
 
 start_string:;
-  while (p < ep && *p != '\"')
-    p++;
+  p = ac_json_find_quote(p, ep);
   if (p >= ep) {
     AC_JSON_BAD_CHARACTER;
   }
@@ -1188,7 +1190,7 @@ look_for_next_object:;
       goto look_for_next_object;
     }
   case AC_JSON_SPACE_CASE:
-    p++;
+    p = ac_json_skip_space(p + 1, ep);
     ch = *p;
     goto look_for_next_object;
   default:
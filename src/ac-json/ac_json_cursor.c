@@ -0,0 +1,327 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#include "another-c-library/ac_json_cursor.h"
+
+#include "another-c-library/ac_allocator.h"
+#include "another-c-library/ac_pool.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ac_json_scan.h"
+
+typedef struct {
+  uint32_t node;
+  uint32_t last;
+} open_t;
+
+typedef struct {
+  ac_json_cursor_t *nodes;
+  uint32_t num_nodes;
+  uint32_t size;
+
+  open_t *stack;
+  uint32_t depth;
+  uint32_t stack_size;
+} builder_t;
+
+static inline ac_json_cursor_t *new_node(builder_t *b, char *key) {
+  if (b->num_nodes == b->size) {
+    b->size *= 2;
+    b->nodes = (ac_json_cursor_t *)ac_realloc(
+        b->nodes, sizeof(ac_json_cursor_t) * b->size);
+  }
+  if (b->depth) {
+    open_t *o = b->stack + b->depth - 1;
+    b->nodes[o->node].length++;
+    o->last = b->num_nodes;
+  }
+  ac_json_cursor_t *n = b->nodes + b->num_nodes;
+  b->num_nodes++;
+  n->key = key;
+  n->value = NULL;
+  n->length = 0;
+  n->last = 0;
+  n->skip = 1;
+  return n;
+}
+
+static inline void open_node(builder_t *b) {
+  if (b->depth == b->stack_size) {
+    b->stack_size = b->stack_size ? b->stack_size * 2 : 16;
+    b->stack =
+        (open_t *)ac_realloc(b->stack, sizeof(open_t) * b->stack_size);
+  }
+  b->stack[b->depth].node = b->num_nodes - 1;
+  b->stack[b->depth].last = 0;
+  b->depth++;
+}
+
+static inline void close_node(builder_t *b) {
+  b->depth--;
+  open_t *o = b->stack + b->depth;
+  ac_json_cursor_t *n = b->nodes + o->node;
+  n->skip = b->num_nodes - o->node;
+  if (n->length)
+    b->nodes[o->last].last = 1;
+}
+
+/* returns the closing quote of the string starting at p or ep */
+static inline char *find_string_end(char *p, char *ep) {
+  char *s = p;
+  while (true) {
+    p = ac_json_find_quote(p, ep);
+    if (p >= ep)
+      return ep;
+    char *bp = p;
+    while (bp > s && bp[-1] == '\\')
+      bp--;
+    if (((p - bp) & 1) == 0)
+      return p;
+    p++;
+  }
+}
+
+/* most values are separated by at most a single space */
+static inline char *skip_space(char *p, char *ep) {
+  if (p < ep && !ac_json_is_space(*p))
+    return p;
+  if (p + 1 < ep && !ac_json_is_space(p[1]))
+    return p + 1;
+  return ac_json_skip_space(p, ep);
+}
+
+static inline bool is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+/* Numbers are not zero terminated until the whole document is indexed as
+   the character after the number is needed to continue. */
+static inline char *parse_number(ac_json_cursor_t *n, char *p, char *ep) {
+  char *s = p;
+  if (*p == '-')
+    p++;
+  if (p >= ep || !is_digit(*p))
+    return NULL;
+  n->type = AC_JSON_NUMBER;
+  if (*p == '0')
+    p++;
+  else {
+    while (p < ep && is_digit(*p))
+      p++;
+  }
+  if (p < ep && *p == '.') {
+    p++;
+    if (p >= ep || !is_digit(*p))
+      return NULL;
+    while (p < ep && is_digit(*p))
+      p++;
+    n->type = AC_JSON_DECIMAL;
+  }
+  if (p < ep && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < ep && (*p == '-' || *p == '+'))
+      p++;
+    if (p >= ep || !is_digit(*p))
+      return NULL;
+    while (p < ep && is_digit(*p))
+      p++;
+    n->type = AC_JSON_DECIMAL;
+  }
+  n->value = s;
+  n->length = p - s;
+  if (n->type == AC_JSON_NUMBER && p - s == (*s == '-' ? 2 : 1) &&
+      p[-1] == '0') {
+    n->type = AC_JSON_ZERO;
+    n->value = (char *)"0";
+    n->length = 1;
+  }
+  return p;
+}
+
+static inline char *parse_literal(ac_json_cursor_t *n, char *p, char *ep,
+                                  const char *literal, size_t length,
+                                  uint16_t type) {
+  if ((size_t)(ep - p) < length || memcmp(p, literal, length))
+    return NULL;
+  n->type = type;
+  n->value = (char *)literal;
+  n->length = length;
+  return p + length;
+}
+
+static inline char *parse_key(char **key, char *p, char *ep) {
+  if (p >= ep || *p != '\"')
+    return NULL;
+  p++;
+  char *e = find_string_end(p, ep);
+  if (e >= ep)
+    return NULL;
+  *e = 0;
+  *key = p;
+  p = skip_space(e + 1, ep);
+  if (p >= ep || *p != ':')
+    return NULL;
+  return skip_space(p + 1, ep);
+}
+
+ac_json_cursor_t *ac_json_cursor_init(ac_pool_t *pool, char *p, char *ep) {
+  builder_t b;
+  memset(&b, 0, sizeof(b));
+  /* roughly one value per 32 bytes of json is typical */
+  b.size = ((ep - p) >> 5) + 16;
+  b.nodes = (ac_json_cursor_t *)ac_malloc(sizeof(ac_json_cursor_t) * b.size);
+  char *key = NULL;
+  ac_json_cursor_t *res = NULL;
+
+  p = skip_space(p, ep);
+  while (true) {
+    /* a value is expected at p */
+    if (p >= ep)
+      goto done;
+    ac_json_cursor_t *n = new_node(&b, key);
+    key = NULL;
+    char ch = *p;
+    char *e;
+    switch (ch) {
+    case '{':
+    case '[':
+      n->type = ch == '{' ? AC_JSON_OBJECT : AC_JSON_ARRAY;
+      open_node(&b);
+      p = skip_space(p + 1, ep);
+      if (p >= ep)
+        goto done;
+      if (*p == (ch == '{' ? '}' : ']'))
+        break;
+      if (ch == '{') {
+        p = parse_key(&key, p, ep);
+        if (!p)
+          goto done;
+      }
+      continue;
+    case '\"':
+      p++;
+      e = find_string_end(p, ep);
+      if (e >= ep)
+        goto done;
+      *e = 0;
+      n->type = AC_JSON_STRING;
+      n->value = p;
+      n->length = e - p;
+      p = e + 1;
+      break;
+    case 't':
+      p = parse_literal(n, p, ep, "true", 4, AC_JSON_TRUE);
+      break;
+    case 'f':
+      p = parse_literal(n, p, ep, "false", 5, AC_JSON_FALSE);
+      break;
+    case 'n':
+      if (ep - p > 6 && p[1] == 'b') {
+        /* binary extension, see ac_json_dump */
+        p += 2;
+        n->type = AC_JSON_BINARY;
+        memcpy(&n->length, p, sizeof(uint32_t));
+        p += 4;
+        if (n->length >= (size_t)(ep - p))
+          goto done;
+        n->value = p;
+        p += n->length;
+      } else
+        p = parse_literal(n, p, ep, "null", 4, AC_JSON_NULL);
+      break;
+    default:
+      p = parse_number(n, p, ep);
+      break;
+    }
+    if (!p)
+      goto done;
+
+    /* after a value, close objects and arrays until a comma is found */
+    while (true) {
+      if (!b.depth) {
+        /* the root has no siblings */
+        b.nodes[0].last = 1;
+        res = (ac_json_cursor_t *)ac_pool_dup(
+            pool, b.nodes, sizeof(ac_json_cursor_t) * b.num_nodes);
+        goto done;
+      }
+      p = skip_space(p, ep);
+      if (p >= ep)
+        goto done;
+      ac_json_cursor_t *parent = b.nodes + b.stack[b.depth - 1].node;
+      if (*p == ',') {
+        p = skip_space(p + 1, ep);
+        if (parent->type == AC_JSON_OBJECT) {
+          p = parse_key(&key, p, ep);
+          if (!p)
+            goto done;
+        }
+        break;
+      }
+      if (*p != (parent->type == AC_JSON_OBJECT ? '}' : ']'))
+        goto done;
+      close_node(&b);
+      p++;
+    }
+  }
+
+done:
+  if (res) {
+    ac_json_cursor_t *n = res;
+    ac_json_cursor_t *en = res + b.num_nodes;
+    while (n < en) {
+      if (n->type == AC_JSON_NUMBER || n->type == AC_JSON_DECIMAL)
+        n->value[n->length] = 0;
+      n++;
+    }
+  }
+  ac_free(b.nodes);
+  if (b.stack)
+    ac_free(b.stack);
+  return res;
+}
+
+static ac_json_t *cursor_json(ac_pool_t *pool, ac_json_cursor_t *c) {
+  ac_json_t *j;
+  ac_json_cursor_t *n = ac_json_cursor_first(c);
+  if (c->type == AC_JSON_OBJECT) {
+    j = ac_jsono(pool);
+    while (n) {
+      ac_jsono_append(j, n->key, cursor_json(pool, n), false);
+      n = ac_json_cursor_next(n);
+    }
+  } else if (c->type == AC_JSON_ARRAY) {
+    j = ac_jsona(pool);
+    while (n) {
+      ac_jsona_append(j, cursor_json(pool, n));
+      n = ac_json_cursor_next(n);
+    }
+  } else {
+    j = (ac_json_t *)ac_pool_alloc(pool, sizeof(ac_json_t));
+    j->type = c->type;
+    j->length = c->length;
+    j->parent = NULL;
+    j->value = c->value;
+  }
+  return j;
+}
+
+ac_json_t *ac_json_cursor_json(ac_pool_t *pool, ac_json_cursor_t *c) {
+  if (!c)
+    return NULL;
+  return cursor_json(pool, c);
+}
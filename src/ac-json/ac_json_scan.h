@@ -0,0 +1,101 @@
+/*
+Copyright 2019 Andy Curtis
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+#ifndef _ac_json_scan_H
+#define _ac_json_scan_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#if !defined(AC_JSON_NO_SIMD) && defined(__AVX2__)
+#include <immintrin.h>
+#define AC_JSON_AVX2
+#elif !defined(AC_JSON_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define AC_JSON_SSE2
+#endif
+
+/* Strings and whitespace make up most of the bytes in a typical document, so
+   the parser scans them a block at a time.  Blocks never extend past ep, the
+   remainder is checked a byte at a time.  Define AC_JSON_NO_SIMD to always use
+   the byte at a time loops. */
+static inline char *ac_json_find_quote(char *p, char *ep) {
+#if defined(AC_JSON_AVX2)
+  const __m256i quote = _mm256_set1_epi8('\"');
+  while (p + 32 <= ep) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    uint32_t mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+#elif defined(AC_JSON_SSE2)
+  const __m128i quote = _mm_set1_epi8('\"');
+  while (p + 16 <= ep) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, quote));
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p < ep && *p != '\"')
+    p++;
+  return p;
+}
+
+static inline bool ac_json_is_space(char ch) {
+  return ch == 32 || ch == 9 || ch == 13 || ch == 10;
+}
+
+static inline char *ac_json_skip_space(char *p, char *ep) {
+#if defined(AC_JSON_AVX2)
+  const __m256i space = _mm256_set1_epi8(32);
+  const __m256i tab = _mm256_set1_epi8(9);
+  const __m256i cr = _mm256_set1_epi8(13);
+  const __m256i lf = _mm256_set1_epi8(10);
+  while (p + 32 <= ep) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)p);
+    __m256i ws = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, space), _mm256_cmpeq_epi8(v, tab)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+    uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ws);
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 32;
+  }
+#elif defined(AC_JSON_SSE2)
+  const __m128i space = _mm_set1_epi8(32);
+  const __m128i tab = _mm_set1_epi8(9);
+  const __m128i cr = _mm_set1_epi8(13);
+  const __m128i lf = _mm_set1_epi8(10);
+  while (p + 16 <= ep) {
+    __m128i v = _mm_loadu_si128((const __m128i *)p);
+    __m128i ws = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, tab)),
+        _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+    uint32_t mask = (~(uint32_t)_mm_movemask_epi8(ws)) & 0xFFFF;
+    if (mask)
+      return p + __builtin_ctz(mask);
+    p += 16;
+  }
+#endif
+  while (p < ep && ac_json_is_space(*p))
+    p++;
+  return p;
+}
+
+#endif
@@ -1,41 +1,305 @@
 #include "another-c-library/ac-search/ac_bit_set.h"
 
+#include <string.h>
+
+#if !defined(AC_BIT_SET_NO_SIMD) && defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define AC_BIT_SET_X86
+#endif
+
 struct ac_bit_set_s {
     uint64_t *items;
     uint64_t *ep;
     uint64_t last_mask;
 };
 
-void ac_bit_set_not(ac_bit_set_t *dest, ac_bit_set_t *to_not) {
-    uint64_t *p = dest->items;
-    uint64_t *p2 = to_not->items;
-    uint64_t *ep = dest->ep;
-    while(p < ep) {
-        *p = *p & (~*p2);
-        p++;
-        p2++;
+/*
+    The boolean operations and counts run over the words with AVX-512 or AVX2
+    when the cpu supports them (checked once at runtime, so the library
+    doesn't need to be built with -mavx2).  Define AC_BIT_SET_NO_SIMD to
+    always use the scalar loops.  The and kernels return non-zero if any bit
+    is still set so that ac_bit_set_and_many can skip sources once a block is
+    empty.
+*/
+#define SIMD_SCALAR 0
+#define SIMD_AVX2 1
+#define SIMD_AVX512 2
+
+/* ac_bit_set_and_many/or_many work through the sets this many words at a
+   time so the block of dest stays in L1 while every source is applied */
+#define BLOCK_WORDS 512
+
+static uint64_t and_words_scalar(uint64_t *a, const uint64_t *b, size_t n) {
+    uint64_t any = 0;
+    for(size_t i=0; i<n; i++) {
+        a[i] &= b[i];
+        any |= a[i];
     }
+    return any;
 }
 
-void ac_bit_set_or(ac_bit_set_t *dest, ac_bit_set_t *to_or) {
-    uint64_t *p = dest->items;
-    uint64_t *p2 = to_or->items;
-    uint64_t *ep = dest->ep;
-    while(p < ep) {
-        *p = *p | *p2;
-        p++;
-        p2++;
+static void or_words_scalar(uint64_t *a, const uint64_t *b, size_t n) {
+    for(size_t i=0; i<n; i++)
+        a[i] |= b[i];
+}
+
+static void not_words_scalar(uint64_t *a, const uint64_t *b, size_t n) {
+    for(size_t i=0; i<n; i++)
+        a[i] &= ~b[i];
+}
+
+static uint64_t count_words_scalar(const uint64_t *a, size_t n) {
+    uint64_t count = 0;
+    for(size_t i=0; i<n; i++)
+        count += __builtin_popcountll(a[i]);
+    return count;
+}
+
+static uint64_t and_count_words_scalar(uint64_t *a, const uint64_t *b, size_t n) {
+    uint64_t count = 0;
+    for(size_t i=0; i<n; i++) {
+        a[i] &= b[i];
+        count += __builtin_popcountll(a[i]);
+    }
+    return count;
+}
+
+#ifdef AC_BIT_SET_X86
+__attribute__((target("avx2")))
+static uint64_t and_words_avx2(uint64_t *a, const uint64_t *b, size_t n) {
+    __m256i any = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+4 <= n; i += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(a+i)),
+                                     _mm256_loadu_si256((const __m256i *)(b+i)));
+        _mm256_storeu_si256((__m256i *)(a+i), v);
+        any = _mm256_or_si256(any, v);
+    }
+    return (!_mm256_testz_si256(any, any)) | and_words_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void or_words_avx2(uint64_t *a, const uint64_t *b, size_t n) {
+    size_t i = 0;
+    for(; i+4 <= n; i += 4) {
+        __m256i v = _mm256_or_si256(_mm256_loadu_si256((const __m256i *)(a+i)),
+                                    _mm256_loadu_si256((const __m256i *)(b+i)));
+        _mm256_storeu_si256((__m256i *)(a+i), v);
     }
+    or_words_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static void not_words_avx2(uint64_t *a, const uint64_t *b, size_t n) {
+    size_t i = 0;
+    for(; i+4 <= n; i += 4) {
+        __m256i v = _mm256_andnot_si256(_mm256_loadu_si256((const __m256i *)(b+i)),
+                                        _mm256_loadu_si256((const __m256i *)(a+i)));
+        _mm256_storeu_si256((__m256i *)(a+i), v);
+    }
+    not_words_scalar(a+i, b+i, n-i);
+}
+
+/* per 64 bit lane popcount using a nibble lookup table (Mula's method) */
+__attribute__((target("avx2")))
+static inline __m256i popcount_avx2(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo),
+                                     _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t sum_avx2(__m256i v) {
+    return (uint64_t)_mm256_extract_epi64(v, 0) + (uint64_t)_mm256_extract_epi64(v, 1) +
+           (uint64_t)_mm256_extract_epi64(v, 2) + (uint64_t)_mm256_extract_epi64(v, 3);
+}
+
+__attribute__((target("avx2")))
+static uint64_t count_words_avx2(const uint64_t *a, size_t n) {
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+4 <= n; i += 4)
+        total = _mm256_add_epi64(total, popcount_avx2(_mm256_loadu_si256((const __m256i *)(a+i))));
+    return sum_avx2(total) + count_words_scalar(a+i, n-i);
+}
+
+__attribute__((target("avx2")))
+static uint64_t and_count_words_avx2(uint64_t *a, const uint64_t *b, size_t n) {
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i+4 <= n; i += 4) {
+        __m256i v = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)(a+i)),
+                                     _mm256_loadu_si256((const __m256i *)(b+i)));
+        _mm256_storeu_si256((__m256i *)(a+i), v);
+        total = _mm256_add_epi64(total, popcount_avx2(v));
+    }
+    return sum_avx2(total) + and_count_words_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx512f")))
+static uint64_t and_words_avx512(uint64_t *a, const uint64_t *b, size_t n) {
+    __m512i any = _mm512_setzero_si512();
+    size_t i = 0;
+    for(; i+8 <= n; i += 8) {
+        __m512i v = _mm512_and_si512(_mm512_loadu_si512(a+i), _mm512_loadu_si512(b+i));
+        _mm512_storeu_si512(a+i, v);
+        any = _mm512_or_si512(any, v);
+    }
+    return (_mm512_test_epi64_mask(any, any) != 0) | and_words_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx512f")))
+static void or_words_avx512(uint64_t *a, const uint64_t *b, size_t n) {
+    size_t i = 0;
+    for(; i+8 <= n; i += 8)
+        _mm512_storeu_si512(a+i, _mm512_or_si512(_mm512_loadu_si512(a+i), _mm512_loadu_si512(b+i)));
+    or_words_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx512f")))
+static void not_words_avx512(uint64_t *a, const uint64_t *b, size_t n) {
+    size_t i = 0;
+    for(; i+8 <= n; i += 8)
+        _mm512_storeu_si512(a+i, _mm512_andnot_si512(_mm512_loadu_si512(b+i), _mm512_loadu_si512(a+i)));
+    not_words_scalar(a+i, b+i, n-i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint64_t count_words_avx512(const uint64_t *a, size_t n) {
+    __m512i total = _mm512_setzero_si512();
+    size_t i = 0;
+    for(; i+8 <= n; i += 8)
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(a+i)));
+    return _mm512_reduce_add_epi64(total) + count_words_scalar(a+i, n-i);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static uint64_t and_count_words_avx512(uint64_t *a, const uint64_t *b, size_t n) {
+    __m512i total = _mm512_setzero_si512();
+    size_t i = 0;
+    for(; i+8 <= n; i += 8) {
+        __m512i v = _mm512_and_si512(_mm512_loadu_si512(a+i), _mm512_loadu_si512(b+i));
+        _mm512_storeu_si512(a+i, v);
+        total = _mm512_add_epi64(total, _mm512_popcnt_epi64(v));
+    }
+    return _mm512_reduce_add_epi64(total) + and_count_words_scalar(a+i, b+i, n-i);
+}
+#endif
+
+#ifdef AC_BIT_SET_X86
+static int simd_level = -1;
+
+static int get_simd_level(void) {
+    int level = __atomic_load_n(&simd_level, __ATOMIC_RELAXED);
+    if(level >= 0)
+        return level;
+    level = SIMD_SCALAR;
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+        level = SIMD_AVX512;
+    else if(__builtin_cpu_supports("avx2"))
+        level = SIMD_AVX2;
+    __atomic_store_n(&simd_level, level, __ATOMIC_RELAXED);
+    return level;
+}
+#endif
+
+static uint64_t and_words(uint64_t *a, const uint64_t *b, size_t n) {
+#ifdef AC_BIT_SET_X86
+    int level = get_simd_level();
+    if(level == SIMD_AVX512)
+        return and_words_avx512(a, b, n);
+    else if(level == SIMD_AVX2)
+        return and_words_avx2(a, b, n);
+#endif
+    return and_words_scalar(a, b, n);
+}
+
+static void or_words(uint64_t *a, const uint64_t *b, size_t n) {
+#ifdef AC_BIT_SET_X86
+    int level = get_simd_level();
+    if(level == SIMD_AVX512)
+        or_words_avx512(a, b, n);
+    else if(level == SIMD_AVX2)
+        or_words_avx2(a, b, n);
+    else
+#endif
+        or_words_scalar(a, b, n);
+}
+
+static void not_words(uint64_t *a, const uint64_t *b, size_t n) {
+#ifdef AC_BIT_SET_X86
+    int level = get_simd_level();
+    if(level == SIMD_AVX512)
+        not_words_avx512(a, b, n);
+    else if(level == SIMD_AVX2)
+        not_words_avx2(a, b, n);
+    else
+#endif
+        not_words_scalar(a, b, n);
+}
+
+static uint64_t count_words(const uint64_t *a, size_t n) {
+#ifdef AC_BIT_SET_X86
+    int level = get_simd_level();
+    if(level == SIMD_AVX512)
+        return count_words_avx512(a, n);
+    else if(level == SIMD_AVX2)
+        return count_words_avx2(a, n);
+#endif
+    return count_words_scalar(a, n);
+}
+
+static uint64_t and_count_words(uint64_t *a, const uint64_t *b, size_t n) {
+#ifdef AC_BIT_SET_X86
+    int level = get_simd_level();
+    if(level == SIMD_AVX512)
+        return and_count_words_avx512(a, b, n);
+    else if(level == SIMD_AVX2)
+        return and_count_words_avx2(a, b, n);
+#endif
+    return and_count_words_scalar(a, b, n);
+}
+
+void ac_bit_set_not(ac_bit_set_t *dest, ac_bit_set_t *to_not) {
+    not_words(dest->items, to_not->items, dest->ep - dest->items);
+}
+
+void ac_bit_set_or(ac_bit_set_t *dest, ac_bit_set_t *to_or) {
+    or_words(dest->items, to_or->items, dest->ep - dest->items);
 }
 
 void ac_bit_set_and(ac_bit_set_t *dest, ac_bit_set_t *to_and) {
-    uint64_t *p = dest->items;
-    uint64_t *p2 = to_and->items;
-    uint64_t *ep = dest->ep;
-    while(p < ep) {
-        *p = *p & *p2;
-        p++;
-        p2++;
+    and_words(dest->items, to_and->items, dest->ep - dest->items);
+}
+
+uint32_t ac_bit_set_and_count(ac_bit_set_t *dest, ac_bit_set_t *to_and) {
+    return and_count_words(dest->items, to_and->items, dest->ep - dest->items);
+}
+
+void ac_bit_set_and_many(ac_bit_set_t *dest, ac_bit_set_t **to_and, uint32_t num_to_and) {
+    size_t num_words = dest->ep - dest->items;
+    for(size_t start=0; start<num_words; start += BLOCK_WORDS) {
+        size_t n = num_words - start < BLOCK_WORDS ? num_words - start : BLOCK_WORDS;
+        /* once a block is empty the remaining sets can't change it */
+        for(uint32_t i=0; i<num_to_and; i++) {
+            if(!and_words(dest->items + start, to_and[i]->items + start, n))
+                break;
+        }
+    }
+}
+
+void ac_bit_set_or_many(ac_bit_set_t *dest, ac_bit_set_t **to_or, uint32_t num_to_or) {
+    size_t num_words = dest->ep - dest->items;
+    for(size_t start=0; start<num_words; start += BLOCK_WORDS) {
+        size_t n = num_words - start < BLOCK_WORDS ? num_words - start : BLOCK_WORDS;
+        for(uint32_t i=0; i<num_to_or; i++)
+            or_words(dest->items + start, to_or[i]->items + start, n);
     }
 }
 
@@ -70,9 +334,19 @@ ac_bit_set_t *ac_bit_set_copy(ac_pool_t *pool, ac_bit_set_t *src) {
     ac_bit_set_t *h = (ac_bit_set_t *)ac_pool_calloc(pool, sizeof(*h));
     h->items = (uint64_t *)ac_pool_dup(pool, src->items, sizeof(uint64_t) * (src->ep-src->items));
     h->ep = h->items + (src->ep-src->items);
+    h->last_mask = src->last_mask;
     return h;
 }
 
+uint32_t ac_bit_set_num_items(ac_bit_set_t *h) {
+    return ((h->ep-h->items-1) << 6) + __builtin_popcountll(h->last_mask);
+}
+
+uint64_t *ac_bit_set_words(ac_bit_set_t *h, uint32_t *num_words) {
+    *num_words = h->ep-h->items;
+    return h->items;
+}
+
 ac_bit_set_t * ac_bit_set_init(ac_pool_t *pool, uint32_t num_items) {
     uint32_t n=num_items & 63;
     uint64_t mask = 0;
@@ -117,35 +391,16 @@ void ac_bit_set_boolean(ac_bit_set_t *h, uint32_t id, bool v) {
 }
 
 uint32_t ac_bit_set_count(ac_bit_set_t *h) {
-    uint64_t *p = h->items;
-    uint64_t *ep = h->ep;
-    unsigned int count = 0;
-    while(p < ep) {
-        uint64_t n = *p++;
-        // Brian Kernighan’s Algorithm
-        while (n) {
-            n &= (n - 1);
-            count++;
-        }
-    }
-    return count;
+    return count_words(h->items, h->ep - h->items);
 }
 
 uint32_t ac_bit_set_count_and_zero(ac_bit_set_t *h) {
-    uint64_t *p = h->items;
-    uint64_t *ep = h->ep;
-    unsigned int count = 0;
-    while(p < ep) {
-        uint64_t n = *p;
-        if(n) {
-            // Brian Kernighan’s Algorithm
-            while (n) {
-                n &= (n - 1);
-                count++;
-            }
-            *p = 0;
-        }
-        p++;
+    size_t num_words = h->ep - h->items;
+    uint64_t count = 0;
+    for(size_t start=0; start<num_words; start += BLOCK_WORDS) {
+        size_t n = num_words - start < BLOCK_WORDS ? num_words - start : BLOCK_WORDS;
+        count += count_words(h->items + start, n);
+        memset(h->items + start, 0, sizeof(uint64_t) * n);
     }
     return count;
 }
@@ -0,0 +1,946 @@
+#include "another-c-library/ac-search/ac_roaring_bit_set.h"
+
+#include <string.h>
+
+#define ARRAY_CONTAINER 0
+#define BITMAP_CONTAINER 1
+#define RUN_CONTAINER 2
+
+/* an array container holds at most this many values, past that a bitmap is
+   smaller */
+#define ARRAY_MAX 4096
+#define BITMAP_WORDS 1024
+#define CONTAINER_BITS 65536
+
+/*
+    Each container holds the low 16 bits of the ids which share the upper 16
+    bits (key).  values is a sorted array of ids for array containers and
+    (start, length-1) pairs for run containers.  words is kept once allocated
+    so that a container which moves between types doesn't keep allocating
+    from the pool.
+*/
+typedef struct {
+    uint16_t *values;
+    uint64_t *words;
+    uint32_t size;
+    uint32_t cardinality;
+    uint32_t num_runs;
+    uint16_t key;
+    uint8_t type;
+} container_t;
+
+struct ac_roaring_bit_set_s {
+    ac_pool_t *pool;
+    container_t *containers;
+    uint32_t num_containers;
+    uint32_t size;
+    uint32_t num_items;
+};
+
+static inline uint32_t popcount64(uint64_t n) {
+    return __builtin_popcountll(n);
+}
+
+static inline uint32_t ctz64(uint64_t n) {
+    return __builtin_ctzll(n);
+}
+
+static
+uint32_t array_lower_bound(const uint16_t *a, uint32_t n, uint16_t v) {
+    uint32_t lo = 0, hi = n;
+    while(lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        if(a[mid] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* index of the run which holds v or the next run after v */
+static
+uint32_t run_lower_bound(const uint16_t *runs, uint32_t num_runs, uint16_t v) {
+    uint32_t lo = 0, hi = num_runs;
+    while(lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        if((uint32_t)runs[mid*2] + runs[mid*2+1] < v)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* first set bit at or after from, CONTAINER_BITS if none */
+static
+uint32_t words_next_set(const uint64_t *words, uint32_t from) {
+    if(from >= CONTAINER_BITS)
+        return CONTAINER_BITS;
+    uint32_t i = from >> 6;
+    uint64_t w = words[i] & (~0ULL << (from & 63));
+    while(!w) {
+        i++;
+        if(i == BITMAP_WORDS)
+            return CONTAINER_BITS;
+        w = words[i];
+    }
+    return (i << 6) + ctz64(w);
+}
+
+static
+uint32_t words_next_clear(const uint64_t *words, uint32_t from) {
+    if(from >= CONTAINER_BITS)
+        return CONTAINER_BITS;
+    uint32_t i = from >> 6;
+    uint64_t w = ~words[i] & (~0ULL << (from & 63));
+    while(!w) {
+        i++;
+        if(i == BITMAP_WORDS)
+            return CONTAINER_BITS;
+        w = ~words[i];
+    }
+    return (i << 6) + ctz64(w);
+}
+
+/* set bits [start, end] */
+static
+void words_set_range(uint64_t *words, uint32_t start, uint32_t end) {
+    uint32_t sw = start >> 6, ew = end >> 6;
+    uint64_t smask = ~0ULL << (start & 63);
+    uint64_t emask = ~0ULL >> (63 - (end & 63));
+    if(sw == ew) {
+        words[sw] |= smask & emask;
+        return;
+    }
+    words[sw] |= smask;
+    for(uint32_t i=sw+1; i<ew; i++)
+        words[i] = ~0ULL;
+    words[ew] |= emask;
+}
+
+static
+bool container_has(container_t *c, uint16_t v) {
+    if(c->type == ARRAY_CONTAINER) {
+        uint32_t pos = array_lower_bound(c->values, c->cardinality, v);
+        return pos < c->cardinality && c->values[pos] == v;
+    }
+    else if(c->type == BITMAP_CONTAINER)
+        return (c->words[v >> 6] & (1ULL << (v & 63))) != 0;
+    uint32_t pos = run_lower_bound(c->values, c->num_runs, v);
+    return pos < c->num_runs && c->values[pos*2] <= v;
+}
+
+static
+void container_to_words(container_t *c, uint64_t *words) {
+    if(c->type == BITMAP_CONTAINER) {
+        if(words != c->words)
+            memcpy(words, c->words, sizeof(uint64_t) * BITMAP_WORDS);
+        return;
+    }
+    memset(words, 0, sizeof(uint64_t) * BITMAP_WORDS);
+    if(c->type == ARRAY_CONTAINER) {
+        for(uint32_t i=0; i<c->cardinality; i++)
+            words[c->values[i] >> 6] |= 1ULL << (c->values[i] & 63);
+    }
+    else {
+        for(uint32_t i=0; i<c->num_runs; i++)
+            words_set_range(words, c->values[i*2],
+                            (uint32_t)c->values[i*2] + c->values[i*2+1]);
+    }
+}
+
+/* make room for size values, keep copies the current values (if any) */
+static
+void container_reserve(ac_roaring_bit_set_t *h, container_t *c, uint32_t size, bool keep) {
+    if(c->size >= size)
+        return;
+    uint32_t new_size = c->size ? c->size * 2 : 4;
+    while(new_size < size)
+        new_size *= 2;
+    uint16_t *values = (uint16_t *)ac_pool_alloc(h->pool, sizeof(uint16_t) * new_size);
+    if(keep && c->type != BITMAP_CONTAINER) {
+        uint32_t n = c->type == ARRAY_CONTAINER ? c->cardinality : c->num_runs*2;
+        if(n)
+            memcpy(values, c->values, sizeof(uint16_t) * n);
+    }
+    c->values = values;
+    c->size = new_size;
+}
+
+/* store words in c using whichever container type is smallest.  words may
+   not point to c->words. */
+static
+void container_from_words(ac_roaring_bit_set_t *h, container_t *c, const uint64_t *words) {
+    uint32_t cardinality = 0, num_runs = 0;
+    uint64_t prev = 0;
+    for(uint32_t i=0; i<BITMAP_WORDS; i++) {
+        uint64_t w = words[i];
+        cardinality += popcount64(w);
+        num_runs += popcount64(w & ~((w << 1) | (prev >> 63)));
+        prev = w;
+    }
+    c->cardinality = cardinality;
+    if(!cardinality) {
+        c->type = ARRAY_CONTAINER;
+        return;
+    }
+
+    uint32_t array_bytes = cardinality <= ARRAY_MAX ? cardinality * 2 : 0xFFFFFFFF;
+    uint32_t run_bytes = num_runs * 4;
+    uint32_t bitmap_bytes = BITMAP_WORDS * 8;
+    if(run_bytes < array_bytes && run_bytes < bitmap_bytes) {
+        c->type = RUN_CONTAINER;
+        container_reserve(h, c, num_runs*2, false);
+        c->num_runs = num_runs;
+        uint16_t *runs = c->values;
+        uint32_t pos = words_next_set(words, 0);
+        while(pos < CONTAINER_BITS) {
+            uint32_t end = words_next_clear(words, pos);
+            *runs++ = pos;
+            *runs++ = end - pos - 1;
+            pos = words_next_set(words, end);
+        }
+    }
+    else if(array_bytes <= bitmap_bytes) {
+        c->type = ARRAY_CONTAINER;
+        container_reserve(h, c, cardinality, false);
+        uint16_t *values = c->values;
+        for(uint32_t i=0; i<BITMAP_WORDS; i++) {
+            uint64_t w = words[i];
+            while(w) {
+                *values++ = (i << 6) + ctz64(w);
+                w &= w - 1;
+            }
+        }
+    }
+    else {
+        c->type = BITMAP_CONTAINER;
+        if(!c->words)
+            c->words = (uint64_t *)ac_pool_alloc(h->pool, sizeof(uint64_t) * BITMAP_WORDS);
+        memcpy(c->words, words, sizeof(uint64_t) * BITMAP_WORDS);
+    }
+}
+
+/* number of ids in the container for key (the last container may be
+   partial) */
+static
+uint32_t container_limit(ac_roaring_bit_set_t *h, uint32_t key) {
+    uint32_t base = key << 16;
+    if(h->num_items - base >= CONTAINER_BITS)
+        return CONTAINER_BITS;
+    return h->num_items - base;
+}
+
+static
+void set_full(ac_roaring_bit_set_t *h, container_t *c, uint32_t limit) {
+    c->type = RUN_CONTAINER;
+    container_reserve(h, c, 2, false);
+    c->values[0] = 0;
+    c->values[1] = limit - 1;
+    c->num_runs = 1;
+    c->cardinality = limit;
+}
+
+/* binary search for key, returns -(insert position+1) if not found */
+static
+int32_t find_container(ac_roaring_bit_set_t *h, uint16_t key) {
+    uint32_t lo = 0, hi = h->num_containers;
+    while(lo < hi) {
+        uint32_t mid = (lo + hi) >> 1;
+        if(h->containers[mid].key < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo < h->num_containers && h->containers[lo].key == key)
+        return lo;
+    return -(int32_t)lo - 1;
+}
+
+static
+void reserve_containers(ac_roaring_bit_set_t *h, uint32_t size) {
+    if(h->size >= size)
+        return;
+    uint32_t new_size = (h->size+1)*2;
+    if(new_size < size)
+        new_size = size;
+    container_t *containers =
+        (container_t *)ac_pool_alloc(h->pool, sizeof(container_t) * new_size);
+    if(h->num_containers)
+        memcpy(containers, h->containers, sizeof(container_t) * h->num_containers);
+    h->containers = containers;
+    h->size = new_size;
+}
+
+static
+container_t *insert_container(ac_roaring_bit_set_t *h, uint32_t pos, uint16_t key) {
+    reserve_containers(h, h->num_containers+1);
+    container_t *c = h->containers + pos;
+    memmove(c+1, c, sizeof(container_t) * (h->num_containers - pos));
+    h->num_containers++;
+    memset(c, 0, sizeof(*c));
+    c->key = key;
+    c->type = ARRAY_CONTAINER;
+    return c;
+}
+
+static
+void remove_container(ac_roaring_bit_set_t *h, uint32_t pos) {
+    container_t *c = h->containers + pos;
+    memmove(c, c+1, sizeof(container_t) * (h->num_containers - pos - 1));
+    h->num_containers--;
+}
+
+ac_roaring_bit_set_t * ac_roaring_bit_set_init(ac_pool_t *pool, uint32_t num_items) {
+    ac_roaring_bit_set_t *h = (ac_roaring_bit_set_t *)ac_pool_calloc(pool, sizeof(*h));
+    h->pool = pool;
+    h->num_items = num_items;
+    return h;
+}
+
+bool ac_roaring_bit_set(ac_roaring_bit_set_t *h, uint32_t id) {
+    int32_t pos = find_container(h, id >> 16);
+    if(pos < 0)
+        return false;
+    return container_has(h->containers + pos, id & 0xFFFF);
+}
+
+void ac_roaring_bit_set_set(ac_roaring_bit_set_t *h, uint32_t id) {
+    if(id >= h->num_items)
+        return;
+    uint16_t low = id & 0xFFFF;
+    int32_t pos = find_container(h, id >> 16);
+    container_t *c;
+    if(pos < 0)
+        c = insert_container(h, -pos - 1, id >> 16);
+    else
+        c = h->containers + pos;
+
+    if(c->type == ARRAY_CONTAINER && c->cardinality < ARRAY_MAX) {
+        uint32_t i = array_lower_bound(c->values, c->cardinality, low);
+        if(i < c->cardinality && c->values[i] == low)
+            return;
+        container_reserve(h, c, c->cardinality+1, true);
+        memmove(c->values+i+1, c->values+i, sizeof(uint16_t) * (c->cardinality-i));
+        c->values[i] = low;
+        c->cardinality++;
+    }
+    else if(c->type == BITMAP_CONTAINER) {
+        uint64_t bit = 1ULL << (low & 63);
+        if(!(c->words[low >> 6] & bit)) {
+            c->words[low >> 6] |= bit;
+            c->cardinality++;
+        }
+    }
+    else if(!container_has(c, low)) {
+        uint64_t words[BITMAP_WORDS];
+        container_to_words(c, words);
+        words[low >> 6] |= 1ULL << (low & 63);
+        container_from_words(h, c, words);
+    }
+}
+
+void ac_roaring_bit_set_unset(ac_roaring_bit_set_t *h, uint32_t id) {
+    uint16_t low = id & 0xFFFF;
+    int32_t pos = find_container(h, id >> 16);
+    if(pos < 0)
+        return;
+    container_t *c = h->containers + pos;
+    if(c->type == ARRAY_CONTAINER) {
+        uint32_t i = array_lower_bound(c->values, c->cardinality, low);
+        if(i == c->cardinality || c->values[i] != low)
+            return;
+        memmove(c->values+i, c->values+i+1, sizeof(uint16_t) * (c->cardinality-i-1));
+        c->cardinality--;
+    }
+    else if(c->type == BITMAP_CONTAINER && c->cardinality > ARRAY_MAX+1) {
+        uint64_t bit = 1ULL << (low & 63);
+        if(c->words[low >> 6] & bit) {
+            c->words[low >> 6] &= ~bit;
+            c->cardinality--;
+        }
+    }
+    else if(container_has(c, low)) {
+        uint64_t words[BITMAP_WORDS];
+        container_to_words(c, words);
+        words[low >> 6] &= ~(1ULL << (low & 63));
+        container_from_words(h, c, words);
+    }
+    if(!c->cardinality)
+        remove_container(h, pos);
+}
+
+void ac_roaring_bit_set_boolean(ac_roaring_bit_set_t *h, uint32_t id, bool v) {
+    if(v)
+        ac_roaring_bit_set_set(h, id);
+    else
+        ac_roaring_bit_set_unset(h, id);
+}
+
+static
+void copy_container(ac_roaring_bit_set_t *h, container_t *dest, container_t *src) {
+    memset(dest, 0, sizeof(*dest));
+    dest->key = src->key;
+    dest->type = src->type;
+    dest->cardinality = src->cardinality;
+    dest->num_runs = src->num_runs;
+    if(src->type == BITMAP_CONTAINER)
+        dest->words = (uint64_t *)ac_pool_dup(h->pool, src->words, sizeof(uint64_t) * BITMAP_WORDS);
+    else {
+        uint32_t n = src->type == ARRAY_CONTAINER ? src->cardinality : src->num_runs*2;
+        dest->values = (uint16_t *)ac_pool_dup(h->pool, src->values, sizeof(uint16_t) * n);
+        dest->size = n;
+    }
+}
+
+ac_roaring_bit_set_t *ac_roaring_bit_set_copy(ac_pool_t *pool, ac_roaring_bit_set_t *src) {
+    ac_roaring_bit_set_t *h = ac_roaring_bit_set_init(pool, src->num_items);
+    reserve_containers(h, src->num_containers);
+    for(uint32_t i=0; i<src->num_containers; i++)
+        copy_container(h, h->containers+i, src->containers+i);
+    h->num_containers = src->num_containers;
+    return h;
+}
+
+/* keep the array values for which test(other, value) == keep */
+static
+void filter_array(container_t *c, container_t *other, bool keep) {
+    uint16_t *wp = c->values;
+    for(uint32_t i=0; i<c->cardinality; i++) {
+        if(container_has(other, c->values[i]) == keep)
+            *wp++ = c->values[i];
+    }
+    c->cardinality = wp - c->values;
+}
+
+static
+void and_container(ac_roaring_bit_set_t *h, container_t *c, container_t *other) {
+    if(c->type == ARRAY_CONTAINER) {
+        filter_array(c, other, true);
+        return;
+    }
+    if(other->type == ARRAY_CONTAINER) {
+        uint16_t values[ARRAY_MAX];
+        uint32_t n = 0;
+        for(uint32_t i=0; i<other->cardinality; i++) {
+            if(container_has(c, other->values[i]))
+                values[n++] = other->values[i];
+        }
+        c->type = ARRAY_CONTAINER;
+        c->cardinality = n;
+        if(n) {
+            container_reserve(h, c, n, false);
+            memcpy(c->values, values, sizeof(uint16_t) * n);
+        }
+        return;
+    }
+    uint64_t words[BITMAP_WORDS], other_words[BITMAP_WORDS];
+    container_to_words(c, words);
+    container_to_words(other, other_words);
+    for(uint32_t i=0; i<BITMAP_WORDS; i++)
+        words[i] &= other_words[i];
+    container_from_words(h, c, words);
+}
+
+static
+void or_container(ac_roaring_bit_set_t *h, container_t *c, container_t *other) {
+    if(c->type == ARRAY_CONTAINER && other->type == ARRAY_CONTAINER &&
+       c->cardinality + other->cardinality <= ARRAY_MAX) {
+        uint16_t values[ARRAY_MAX];
+        uint16_t *a = c->values, *ea = a + c->cardinality;
+        uint16_t *b = other->values, *eb = b + other->cardinality;
+        uint32_t n = 0;
+        while(a < ea && b < eb) {
+            if(*a < *b)
+                values[n++] = *a++;
+            else if(*b < *a)
+                values[n++] = *b++;
+            else {
+                values[n++] = *a++;
+                b++;
+            }
+        }
+        while(a < ea)
+            values[n++] = *a++;
+        while(b < eb)
+            values[n++] = *b++;
+        container_reserve(h, c, n, false);
+        memcpy(c->values, values, sizeof(uint16_t) * n);
+        c->cardinality = n;
+        return;
+    }
+    uint64_t words[BITMAP_WORDS], other_words[BITMAP_WORDS];
+    container_to_words(c, words);
+    container_to_words(other, other_words);
+    for(uint32_t i=0; i<BITMAP_WORDS; i++)
+        words[i] |= other_words[i];
+    container_from_words(h, c, words);
+}
+
+static
+void not_container(ac_roaring_bit_set_t *h, container_t *c, container_t *other) {
+    if(c->type == ARRAY_CONTAINER) {
+        filter_array(c, other, false);
+        return;
+    }
+    uint64_t words[BITMAP_WORDS], other_words[BITMAP_WORDS];
+    container_to_words(c, words);
+    container_to_words(other, other_words);
+    for(uint32_t i=0; i<BITMAP_WORDS; i++)
+        words[i] &= ~other_words[i];
+    container_from_words(h, c, words);
+}
+
+void ac_roaring_bit_set_and(ac_roaring_bit_set_t *dest, ac_roaring_bit_set_t *to_and) {
+    container_t *wp = dest->containers;
+    container_t *p = dest->containers;
+    container_t *ep = p + dest->num_containers;
+    container_t *p2 = to_and->containers;
+    container_t *ep2 = p2 + to_and->num_containers;
+    while(p < ep && p2 < ep2) {
+        if(p->key < p2->key)
+            p++;
+        else if(p2->key < p->key)
+            p2++;
+        else {
+            and_container(dest, p, p2);
+            if(p->cardinality) {
+                if(wp != p)
+                    *wp = *p;
+                wp++;
+            }
+            p++;
+            p2++;
+        }
+    }
+    dest->num_containers = wp - dest->containers;
+}
+
+void ac_roaring_bit_set_not(ac_roaring_bit_set_t *dest, ac_roaring_bit_set_t *to_not) {
+    container_t *wp = dest->containers;
+    container_t *p = dest->containers;
+    container_t *ep = p + dest->num_containers;
+    container_t *p2 = to_not->containers;
+    container_t *ep2 = p2 + to_not->num_containers;
+    while(p < ep) {
+        while(p2 < ep2 && p2->key < p->key)
+            p2++;
+        if(p2 < ep2 && p2->key == p->key)
+            not_container(dest, p, p2);
+        if(p->cardinality) {
+            if(wp != p)
+                *wp = *p;
+            wp++;
+        }
+        p++;
+    }
+    dest->num_containers = wp - dest->containers;
+}
+
+void ac_roaring_bit_set_or(ac_roaring_bit_set_t *dest, ac_roaring_bit_set_t *to_or) {
+    uint32_t num_new = 0;
+    container_t *p = dest->containers;
+    container_t *ep = p + dest->num_containers;
+    container_t *p2 = to_or->containers;
+    container_t *ep2 = p2 + to_or->num_containers;
+    while(p2 < ep2) {
+        if(((uint32_t)p2->key << 16) >= dest->num_items)
+            break;
+        while(p < ep && p->key < p2->key)
+            p++;
+        if(p == ep || p->key != p2->key)
+            num_new++;
+        p2++;
+    }
+    ep2 = p2;
+
+    /* merge from the back so that the containers can be updated in place */
+    reserve_containers(dest, dest->num_containers + num_new);
+    container_t *wp = dest->containers + dest->num_containers + num_new;
+    p = dest->containers + dest->num_containers;
+    p2 = ep2;
+    while(p2 > to_or->containers) {
+        if(p > dest->containers && p[-1].key > p2[-1].key) {
+            p--;
+            wp--;
+            *wp = *p;
+        }
+        else if(p > dest->containers && p[-1].key == p2[-1].key) {
+            p--;
+            p2--;
+            wp--;
+            *wp = *p;
+            or_container(dest, wp, p2);
+        }
+        else {
+            p2--;
+            wp--;
+            copy_container(dest, wp, p2);
+        }
+    }
+    dest->num_containers += num_new;
+}
+
+static
+void complement_containers(ac_roaring_bit_set_t *h, bool keep) {
+    uint32_t num_keys = h->num_items ? ((h->num_items-1) >> 16) + 1 : 0;
+    container_t *containers = h->containers;
+    uint32_t num_containers = keep ? h->num_containers : 0;
+    h->containers = NULL;
+    h->num_containers = 0;
+    h->size = 0;
+    reserve_containers(h, num_keys);
+
+    container_t *p = containers;
+    container_t *ep = p + num_containers;
+    container_t *wp = h->containers;
+    for(uint32_t key=0; key<num_keys; key++) {
+        uint32_t limit = container_limit(h, key);
+        if(p < ep && p->key == key) {
+            uint64_t words[BITMAP_WORDS];
+            container_to_words(p, words);
+            for(uint32_t i=0; i<BITMAP_WORDS; i++)
+                words[i] = ~words[i];
+            if(limit < CONTAINER_BITS) {
+                memset(words + (limit >> 6) + 1, 0,
+                       sizeof(uint64_t) * (BITMAP_WORDS - (limit >> 6) - 1));
+                words[limit >> 6] &= (1ULL << (limit & 63)) - 1;
+            }
+            *wp = *p;
+            container_from_words(h, wp, words);
+            p++;
+            if(!wp->cardinality)
+                continue;
+        }
+        else {
+            memset(wp, 0, sizeof(*wp));
+            wp->key = key;
+            set_full(h, wp, limit);
+        }
+        wp++;
+    }
+    h->num_containers = wp - h->containers;
+}
+
+void ac_roaring_bit_set_complement(ac_roaring_bit_set_t *h) {
+    complement_containers(h, true);
+}
+
+void ac_roaring_bit_set_true(ac_roaring_bit_set_t *h) {
+    complement_containers(h, false);
+}
+
+void ac_roaring_bit_set_false(ac_roaring_bit_set_t *h) {
+    h->num_containers = 0;
+}
+
+void ac_roaring_bit_set_optimize(ac_roaring_bit_set_t *h) {
+    uint64_t words[BITMAP_WORDS];
+    for(uint32_t i=0; i<h->num_containers; i++) {
+        container_to_words(h->containers+i, words);
+        container_from_words(h, h->containers+i, words);
+    }
+}
+
+uint32_t ac_roaring_bit_set_count(ac_roaring_bit_set_t *h) {
+    uint32_t count = 0;
+    for(uint32_t i=0; i<h->num_containers; i++)
+        count += h->containers[i].cardinality;
+    return count;
+}
+
+/* first value >= low in c, CONTAINER_BITS if none */
+static
+uint32_t container_next(container_t *c, uint32_t low) {
+    if(c->type == ARRAY_CONTAINER) {
+        uint32_t pos = array_lower_bound(c->values, c->cardinality, low);
+        return pos < c->cardinality ? c->values[pos] : CONTAINER_BITS;
+    }
+    else if(c->type == BITMAP_CONTAINER)
+        return words_next_set(c->words, low);
+    uint32_t pos = run_lower_bound(c->values, c->num_runs, low);
+    if(pos == c->num_runs)
+        return CONTAINER_BITS;
+    return c->values[pos*2] > low ? c->values[pos*2] : low;
+}
+
+uint32_t ac_roaring_bit_set_first(ac_roaring_bit_set_t *h) {
+    if(!h->num_containers)
+        return 0;
+    container_t *c = h->containers;
+    return ((uint32_t)c->key << 16) + container_next(c, 0);
+}
+
+struct ac_roaring_bit_set_cursor_s;
+typedef struct ac_roaring_bit_set_cursor_s ac_roaring_bit_set_cursor_t;
+
+struct ac_roaring_bit_set_cursor_s {
+    ac_cursor_t cursor;
+    ac_roaring_bit_set_t *bit_set;
+    uint32_t container;
+};
+
+/* find the first id >= id, starting from the current container */
+static
+uint32_t advance_roaring_bit_set_from(ac_roaring_bit_set_cursor_t *c, uint32_t id) {
+    ac_roaring_bit_set_t *h = c->bit_set;
+    uint32_t key = id >> 16;
+    uint32_t low = id & 0xFFFF;
+    uint32_t i = c->container;
+    while(i < h->num_containers && h->containers[i].key < key)
+        i++;
+    while(i < h->num_containers) {
+        container_t *ct = h->containers + i;
+        if(ct->key > key)
+            low = 0;
+        uint32_t v = container_next(ct, low);
+        if(v < CONTAINER_BITS) {
+            c->container = i;
+            c->cursor.current = ((uint32_t)ct->key << 16) + v;
+            return c->cursor.current;
+        }
+        i++;
+    }
+    c->container = i;
+    return ac_cursor_empty(&c->cursor);
+}
+
+static
+uint32_t advance_roaring_bit_set(ac_roaring_bit_set_cursor_t *c)
+{
+    return advance_roaring_bit_set_from(c, c->cursor.current+1);
+}
+
+static
+uint32_t advance_roaring_bit_set_to(ac_roaring_bit_set_cursor_t *c, uint32_t id)
+{
+    if(c->cursor.current >= id)
+        return c->cursor.current;
+    return advance_roaring_bit_set_from(c, id);
+}
+
+ac_cursor_t *ac_roaring_bit_set_open_cursor(ac_pool_t *pool, ac_roaring_bit_set_t *h) {
+    ac_roaring_bit_set_cursor_t *r = ac_pool_calloc(pool, sizeof(*r));
+    ac_cursor_t *c = (ac_cursor_t *)r;
+    r->bit_set = h;
+    c->pool = pool;
+    c->type = NORMAL_CURSOR;
+    c->advance = (ac_cursor_advance_cb)advance_roaring_bit_set;
+    c->advance_to = (ac_cursor_advance_to_cb)advance_roaring_bit_set_to;
+    c->advance(c);
+    ac_cursor_reset(c);
+    return c;
+}
+
+/* copy the 64k bits of a dense set which correspond to key */
+static
+void bit_set_slice(uint64_t *words, ac_bit_set_t *bs, uint32_t key) {
+    uint32_t num_words;
+    uint64_t *src = ac_bit_set_words(bs, &num_words);
+    uint32_t start = key * BITMAP_WORDS;
+    uint32_t n = 0;
+    if(start < num_words) {
+        n = num_words - start;
+        if(n > BITMAP_WORDS)
+            n = BITMAP_WORDS;
+        memcpy(words, src + start, sizeof(uint64_t) * n);
+    }
+    memset(words + n, 0, sizeof(uint64_t) * (BITMAP_WORDS - n));
+}
+
+static
+bool bit_set_has(uint64_t *words, uint32_t num_words, uint32_t id) {
+    return (id >> 6) < num_words && (words[id >> 6] & (1ULL << (id & 63)));
+}
+
+void ac_roaring_bit_set_and_bit_set(ac_roaring_bit_set_t *dest, ac_bit_set_t *to_and) {
+    uint32_t num_words;
+    uint64_t *src = ac_bit_set_words(to_and, &num_words);
+    container_t *wp = dest->containers;
+    container_t *p = dest->containers;
+    container_t *ep = p + dest->num_containers;
+    for(; p < ep; p++) {
+        uint32_t base = (uint32_t)p->key << 16;
+        if(p->type == ARRAY_CONTAINER) {
+            uint16_t *vp = p->values;
+            for(uint32_t i=0; i<p->cardinality; i++) {
+                if(bit_set_has(src, num_words, base + p->values[i]))
+                    *vp++ = p->values[i];
+            }
+            p->cardinality = vp - p->values;
+        }
+        else {
+            uint64_t words[BITMAP_WORDS], other_words[BITMAP_WORDS];
+            container_to_words(p, words);
+            bit_set_slice(other_words, to_and, p->key);
+            for(uint32_t i=0; i<BITMAP_WORDS; i++)
+                words[i] &= other_words[i];
+            container_from_words(dest, p, words);
+        }
+        if(p->cardinality) {
+            if(wp != p)
+                *wp = *p;
+            wp++;
+        }
+    }
+    dest->num_containers = wp - dest->containers;
+}
+
+void ac_roaring_bit_set_not_bit_set(ac_roaring_bit_set_t *dest, ac_bit_set_t *to_not) {
+    uint32_t num_words;
+    uint64_t *src = ac_bit_set_words(to_not, &num_words);
+    container_t *wp = dest->containers;
+    container_t *p = dest->containers;
+    container_t *ep = p + dest->num_containers;
+    for(; p < ep; p++) {
+        uint32_t base = (uint32_t)p->key << 16;
+        if(p->type == ARRAY_CONTAINER) {
+            uint16_t *vp = p->values;
+            for(uint32_t i=0; i<p->cardinality; i++) {
+                if(!bit_set_has(src, num_words, base + p->values[i]))
+                    *vp++ = p->values[i];
+            }
+            p->cardinality = vp - p->values;
+        }
+        else {
+            uint64_t words[BITMAP_WORDS], other_words[BITMAP_WORDS];
+            container_to_words(p, words);
+            bit_set_slice(other_words, to_not, p->key);
+            for(uint32_t i=0; i<BITMAP_WORDS; i++)
+                words[i] &= ~other_words[i];
+            container_from_words(dest, p, words);
+        }
+        if(p->cardinality) {
+            if(wp != p)
+                *wp = *p;
+            wp++;
+        }
+    }
+    dest->num_containers = wp - dest->containers;
+}
+
+void ac_roaring_bit_set_or_bit_set(ac_roaring_bit_set_t *dest, ac_bit_set_t *to_or) {
+    uint32_t num_words;
+    uint64_t *src = ac_bit_set_words(to_or, &num_words);
+    uint32_t num_keys = dest->num_items ? ((dest->num_items-1) >> 16) + 1 : 0;
+    uint32_t src_keys = (num_words + BITMAP_WORDS - 1) / BITMAP_WORDS;
+    if(num_keys > src_keys)
+        num_keys = src_keys;
+    uint32_t pos = 0;
+    for(uint32_t key=0; key<num_keys; key++) {
+        uint32_t start = key * BITMAP_WORDS;
+        uint32_t end = start + BITMAP_WORDS < num_words ? start + BITMAP_WORDS : num_words;
+        while(start < end && !src[start])
+            start++;
+        if(start == end)
+            continue;
+
+        uint64_t words[BITMAP_WORDS], other_words[BITMAP_WORDS];
+        bit_set_slice(other_words, to_or, key);
+        uint32_t limit = container_limit(dest, key);
+        if(limit < CONTAINER_BITS) {
+            memset(other_words + (limit >> 6) + 1, 0,
+                   sizeof(uint64_t) * (BITMAP_WORDS - (limit >> 6) - 1));
+            other_words[limit >> 6] &= (1ULL << (limit & 63)) - 1;
+        }
+        while(pos < dest->num_containers && dest->containers[pos].key < key)
+            pos++;
+        container_t *c;
+        if(pos < dest->num_containers && dest->containers[pos].key == key)
+            c = dest->containers + pos;
+        else
+            c = insert_container(dest, pos, key);
+        container_to_words(c, words);
+        for(uint32_t i=0; i<BITMAP_WORDS; i++)
+            words[i] |= other_words[i];
+        container_from_words(dest, c, words);
+        if(!c->cardinality)
+            remove_container(dest, pos);
+    }
+}
+
+void ac_bit_set_and_roaring(ac_bit_set_t *dest, ac_roaring_bit_set_t *to_and) {
+    uint32_t num_words;
+    uint64_t *words = ac_bit_set_words(dest, &num_words);
+    container_t *p = to_and->containers;
+    container_t *ep = p + to_and->num_containers;
+    uint64_t other_words[BITMAP_WORDS];
+    for(uint32_t start=0; start<num_words; start += BITMAP_WORDS) {
+        uint32_t key = start / BITMAP_WORDS;
+        uint32_t n = num_words - start < BITMAP_WORDS ? num_words - start : BITMAP_WORDS;
+        while(p < ep && p->key < key)
+            p++;
+        if(p == ep || p->key != key) {
+            memset(words + start, 0, sizeof(uint64_t) * n);
+            continue;
+        }
+        container_to_words(p, other_words);
+        for(uint32_t i=0; i<n; i++)
+            words[start+i] &= other_words[i];
+    }
+}
+
+void ac_bit_set_not_roaring(ac_bit_set_t *dest, ac_roaring_bit_set_t *to_not) {
+    uint32_t num_words;
+    uint64_t *words = ac_bit_set_words(dest, &num_words);
+    for(uint32_t i=0; i<to_not->num_containers; i++) {
+        container_t *c = to_not->containers + i;
+        uint32_t start = c->key * BITMAP_WORDS;
+        if(start >= num_words)
+            break;
+        if(c->type == ARRAY_CONTAINER) {
+            for(uint32_t j=0; j<c->cardinality; j++) {
+                uint32_t id = start * 64 + c->values[j];
+                if((id >> 6) < num_words)
+                    words[id >> 6] &= ~(1ULL << (id & 63));
+            }
+            continue;
+        }
+        uint64_t other_words[BITMAP_WORDS];
+        container_to_words(c, other_words);
+        uint32_t n = num_words - start < BITMAP_WORDS ? num_words - start : BITMAP_WORDS;
+        for(uint32_t j=0; j<n; j++)
+            words[start+j] &= ~other_words[j];
+    }
+}
+
+void ac_bit_set_or_roaring(ac_bit_set_t *dest, ac_roaring_bit_set_t *to_or) {
+    uint32_t num_words;
+    uint64_t *words = ac_bit_set_words(dest, &num_words);
+    uint32_t num_items = ac_bit_set_num_items(dest);
+    for(uint32_t i=0; i<to_or->num_containers; i++) {
+        container_t *c = to_or->containers + i;
+        uint32_t start = c->key * BITMAP_WORDS;
+        if(start >= num_words)
+            break;
+        if(c->type == ARRAY_CONTAINER) {
+            for(uint32_t j=0; j<c->cardinality; j++) {
+                uint32_t id = start * 64 + c->values[j];
+                if(id < num_items)
+                    words[id >> 6] |= 1ULL << (id & 63);
+            }
+            continue;
+        }
+        uint64_t other_words[BITMAP_WORDS];
+        container_to_words(c, other_words);
+        uint32_t n = num_words - start < BITMAP_WORDS ? num_words - start : BITMAP_WORDS;
+        for(uint32_t j=0; j<n; j++)
+            words[start+j] |= other_words[j];
+    }
+    /* don't set bits past num_items */
+    if(num_words)
+        words[num_words-1] &= (1ULL << (num_items & 63)) - 1;
+}
+
+ac_roaring_bit_set_t *ac_roaring_bit_set_from_bit_set(ac_pool_t *pool, ac_bit_set_t *src) {
+    ac_roaring_bit_set_t *h = ac_roaring_bit_set_init(pool, ac_bit_set_num_items(src));
+    ac_roaring_bit_set_or_bit_set(h, src);
+    return h;
+}
+
+ac_bit_set_t *ac_roaring_bit_set_to_bit_set(ac_pool_t *pool, ac_roaring_bit_set_t *src) {
+    ac_bit_set_t *h = ac_bit_set_init(pool, src->num_items);
+    ac_bit_set_or_roaring(h, src);
+    return h;
+}
@@ -317,10 +317,15 @@ typedef struct ac_s_term_s ac_s_term_t;
 struct ac_s_term_s {
     macro_map_t node;
     ac_block_t *groups;
+    /* parallel to groups, the most word positions of any id in the group.
+       These are only raised (erasing an id leaves them alone), so they are
+       upper bounds for skipping groups in ac_s_top_n. */
+    uint16_t *group_max;
     uint32_t num_groups;
     uint32_t num_ids;
     uint32_t bytes;
     uint32_t max_bytes;
+    uint16_t max_frequency;
 };
 
 uint32_t total_bytes = 0;
@@ -498,6 +503,73 @@ static ac_block_t *remove_group(ac_s_t *h, ac_block_t *match, ac_block_t *groups
 
 
 
+/* the number of word positions in data passed to ac_s_insert (data[0] holds
+   the flags which copy_data stores beside the sub_id, see advance_pos_id) */
+static uint16_t data_frequency(const uint8_t *data, uint32_t len)
+{
+    if (!len)
+        return 0;
+    uint32_t v = data[0];
+    const uint8_t *p = data + 1;
+    if (v & 0x8)
+        p += (*p) + 1;
+    v &= 0x7;
+    uint32_t bytes;
+    if (v < 7)
+        bytes = v;
+    else if (*p > 1)
+        bytes = *p;
+    else if (*p == 0)
+        bytes = *(uint16_t *)(p + 1);
+    else
+        bytes = *(uint32_t *)(p + 1);
+    bytes /= sizeof(uint16_t);
+    return bytes < 0xFFFF ? bytes : 0xFFFF;
+}
+
+/* num_groups is the count after the group at pos was inserted */
+static void group_max_insert(ac_s_t *h, ac_s_term_t *term, uint32_t pos, uint32_t num_groups, uint16_t v)
+{
+    uint16_t *group_max = term->group_max;
+    uint32_t old_size = (num_groups - 1) * sizeof(uint16_t);
+    uint32_t size = num_groups * sizeof(uint16_t);
+    if (!old_size || get_block_id(old_size) != get_block_id(size)) {
+        group_max = (uint16_t *)ac_s_alloc(h, get_block_id(size));
+        if (old_size) {
+            memcpy(group_max, term->group_max, pos * sizeof(uint16_t));
+            memcpy(group_max + pos + 1, term->group_max + pos, old_size - (pos * sizeof(uint16_t)));
+            ac_s_release(h, term->group_max, old_size);
+        }
+    }
+    else if (pos + 1 < num_groups)
+        memmove(group_max + pos + 1, group_max + pos, (num_groups - pos - 1) * sizeof(uint16_t));
+    group_max[pos] = v;
+    term->group_max = group_max;
+}
+
+/* num_groups is the count after the group at pos was removed */
+static void group_max_remove(ac_s_t *h, ac_s_term_t *term, uint32_t pos, uint32_t num_groups)
+{
+    uint16_t *group_max = term->group_max;
+    uint32_t old_size = (num_groups + 1) * sizeof(uint16_t);
+    uint32_t size = num_groups * sizeof(uint16_t);
+    if (!size) {
+        ac_s_release(h, group_max, old_size);
+        term->group_max = NULL;
+        return;
+    }
+    if (get_block_id(old_size) != get_block_id(size)) {
+        group_max = (uint16_t *)ac_s_alloc(h, get_block_id(size));
+        memcpy(group_max, term->group_max, pos * sizeof(uint16_t));
+        memcpy(group_max + pos, term->group_max + pos + 1, size - (pos * sizeof(uint16_t)));
+        ac_s_release(h, term->group_max, old_size);
+        term->group_max = group_max;
+    }
+    else if (pos < num_groups)
+        memmove(group_max + pos, group_max + pos + 1, (num_groups - pos) * sizeof(uint16_t));
+}
+
+
 static uint8_t *find_id_in_block(uint8_t **nextp, uint8_t *block, uint8_t *ep, uint32_t id) {
     uint32_t _id = 0;
     uint8_t *bp = block;
@@ -598,12 +670,14 @@ ac_block_t *_ac_s_remove(ac_s_t *h, ac_s_term_t *term, ac_block_t *groups, uint3
         return groups;
 
     uint32_t sub_id = ac_s_get_sub_id(id);
+    uint32_t pos = match - groups;
     if (match->type != 0)
     {
-        if (remove_id_from_group(h, term, match, sub_id))
-            return remove_group(h, match, groups, num_groups);
-        else
-            return groups;
+        if (remove_id_from_group(h, term, match, sub_id)) {
+            groups = remove_group(h, match, groups, num_groups);
+            group_max_remove(h, term, pos, *num_groups);
+        }
+        return groups;
     }
     else
     {
@@ -617,7 +691,9 @@ ac_block_t *_ac_s_remove(ac_s_t *h, ac_s_term_t *term, ac_block_t *groups, uint3
         term->num_ids--;
         term->bytes -= (bytes+1);
         total_bytes -= (bytes+1);
-        return remove_group(h, match, groups, num_groups);
+        groups = remove_group(h, match, groups, num_groups);
+        group_max_remove(h, term, pos, *num_groups);
+        return groups;
     }
 }
 
@@ -788,7 +864,7 @@ void update_group_with_data(ac_s_t *h, ac_s_term_t *term, ac_block_t *match, uin
         uint32_t new_size = block_size + len + 1 - len2;
         uint32_t new_block_id = get_block_id(new_size);
         if (old_block_id == new_block_id) {
-            memmove(next, mp+len+1, ep-next);
+            memmove(mp+len+1, next, ep-next);
             copy_data(mp, sub_id, data, len);
             (*(uint32_t *)(match->block)) = new_size - sizeof(uint32_t);
         }
@@ -819,7 +895,7 @@ void update_group_with_data(ac_s_t *h, ac_s_term_t *term, ac_block_t *match, uin
             }
             else {
                 match->type = 1;
-                uint8_t *bp = (uint8_t *)ac_s_alloc(h, ac_s_get_block_id(len + 1 + 4));
+                bp = (uint8_t *)ac_s_alloc(h, ac_s_get_block_id(len + 1 + 4));
                 (*(uint32_t *)(bp)) = len + 1;
                 match->block = bp;
                 bp += sizeof(uint32_t);
@@ -843,8 +919,7 @@ void update_group_with_data(ac_s_t *h, ac_s_term_t *term, ac_block_t *match, uin
             }
             else {
                 copy_data(bp, sub_id, data, len);
-                bp += len + 1;
-                memcpy(bp, mp, len2);
+                memcpy(bp + len + 1, mp, len2);
             }
             term->num_ids++;
             term->bytes += len + 1;
@@ -858,15 +933,25 @@ static ac_block_t *_ac_s_add(ac_s_t *h, ac_s_term_t *term, ac_block_t *groups, u
     if(term->max_bytes < len-1)
         term->max_bytes = len-1;
 
+    uint16_t frequency = data_frequency(data, len);
+    if(term->max_frequency < frequency)
+        term->max_frequency = frequency;
+
     uint32_t group_id = ac_s_get_group_id(id);
     ac_block_t *match = find_block(groups, *num_groups, group_id);
     if (!match || match->group != group_id) {
         // insert new group with data/len
-        return insert_new_group_with_data(h, term, match, groups, num_groups, id, data, len);
+        uint32_t pos = match ? match - groups : *num_groups;
+        groups = insert_new_group_with_data(h, term, match, groups, num_groups, id, data, len);
+        group_max_insert(h, term, pos, *num_groups, frequency);
+        return groups;
     }
     else {
         // update current group
         update_group_with_data(h, term, match, id, data, len);
+        uint32_t pos = match - groups;
+        if(term->group_max[pos] < frequency)
+            term->group_max[pos] = frequency;
         return groups;
     }
 }
@@ -1414,6 +1499,9 @@ struct and_cursor_s {
     ac_s_cursor_t **cursors;
     uint32_t num_cursors;
     uint32_t cursor_size;
+
+    /* cursors ordered by their estimated number of ids (fewest first) */
+    ac_s_cursor_t **order;
 };
 
 void and_add_to_cursor( and_cursor_t *dest, ac_s_cursor_t *src ) {
@@ -1430,13 +1518,41 @@ void and_add_to_cursor( and_cursor_t *dest, ac_s_cursor_t *src ) {
     dest->num_cursors++;
 }
 
+static uint32_t estimate_ids(ac_s_cursor_t *c);
+
+/*
+    The rarest cursor proposes each candidate and the others are asked to
+    advance_to it in order of increasing size, so most candidates are
+    rejected by a short list before the long lists are touched.  The order
+    is kept separately from cursors because ac_s_sub_cursors (and the phrase
+    cursor) rely on the order the cursors were added in.
+*/
+static
+void order_and_cursors(and_cursor_t *c) {
+    uint32_t n = c->num_cursors;
+    c->order = (ac_s_cursor_t **)ac_pool_alloc(c->cursor.pool, (sizeof(ac_s_cursor_t *) + sizeof(uint32_t)) * (n+1));
+    uint32_t *sizes = (uint32_t *)(c->order + n + 1);
+    for(uint32_t i=0; i<n; i++) {
+        ac_s_cursor_t *cur = c->cursors[i];
+        uint32_t size = estimate_ids(cur);
+        uint32_t j = i;
+        while(j > 0 && sizes[j-1] > size) {
+            c->order[j] = c->order[j-1];
+            sizes[j] = sizes[j-1];
+            j--;
+        }
+        c->order[j] = cur;
+        sizes[j] = size;
+    }
+}
 
 uint32_t advance_and_cursor(and_cursor_t *c)
 {
+    ac_s_cursor_t **order = c->order;
     uint32_t i=1;
-    uint32_t id = c->cursors[0]->advance(c->cursors[0]);
+    uint32_t id = order[0]->advance(order[0]);
     while(id && i < c->num_cursors) {
-        uint32_t id2 = c->cursors[i]->advance_to(c->cursors[i], id);
+        uint32_t id2 = order[i]->advance_to(order[i], id);
         if(id==id2)
             i++;
         else {
@@ -1455,9 +1571,10 @@ uint32_t advance_and_cursor_to(and_cursor_t *c, uint32_t id)
     if (id <= c->cursor.current)
         return c->cursor.current;
 
+    ac_s_cursor_t **order = c->order;
     uint32_t i=0;
     while(id && i < c->num_cursors) {
-        uint32_t id2 = c->cursors[i]->advance_to(c->cursors[i], id);
+        uint32_t id2 = order[i]->advance_to(order[i], id);
         if(id==id2)
             i++;
         else {
@@ -1472,13 +1589,33 @@ uint32_t advance_and_cursor_to(and_cursor_t *c, uint32_t id)
     return id;
 }
 
+uint32_t advance_and_cursor_init(and_cursor_t *c)
+{
+    if(!c->num_cursors)
+        return ac_s_empty_cursor(&c->cursor);
+    order_and_cursors(c);
+    c->cursor.advance = (ac_s_advance_cb)advance_and_cursor;
+    c->cursor.advance_to = (ac_s_advance_to_cb)advance_and_cursor_to;
+    return advance_and_cursor(c);
+}
+
+uint32_t advance_and_cursor_to_init(and_cursor_t *c, uint32_t id)
+{
+    if(!c->num_cursors)
+        return ac_s_empty_cursor(&c->cursor);
+    order_and_cursors(c);
+    c->cursor.advance = (ac_s_advance_cb)advance_and_cursor;
+    c->cursor.advance_to = (ac_s_advance_to_cb)advance_and_cursor_to;
+    return advance_and_cursor_to(c, id);
+}
+
 ac_s_cursor_t *ac_s_init_and_cursor(ac_pool_t *pool) {
     uint32_t num_cursors = 2;
     and_cursor_t *r = (and_cursor_t *)ac_pool_calloc(pool, sizeof(and_cursor_t));
     r->cursor.pool = pool;
     r->cursor.type = 10; 
-    r->cursor.advance = (ac_s_advance_cb)advance_and_cursor;
-    r->cursor.advance_to = (ac_s_advance_to_cb)advance_and_cursor_to;
+    r->cursor.advance = (ac_s_advance_cb)advance_and_cursor_init;
+    r->cursor.advance_to = (ac_s_advance_to_cb)advance_and_cursor_to_init;
     r->cursor.add_to_cursor = (ac_s_add_to_cursor_cb)and_add_to_cursor;
     r->cursors = (ac_s_cursor_t **)ac_pool_alloc(pool, sizeof(ac_s_cursor_t *) * num_cursors);
     r->num_cursors = 0;
@@ -1788,6 +1925,34 @@ static inline void advance_group(block_cursor_t *sc)
     sc->cur++;
 }
 
+/* first group >= group_id at or after cur.  Steps of 1, 2, 4, ... bound the
+   group before a binary search so that nearby targets (the common case when
+   leapfrogging with a similar list) stay cheap and distant ones cost
+   O(log distance). */
+static inline ac_block_t *gallop_group(ac_block_t *cur, ac_block_t *eg, uint32_t group_id)
+{
+    ac_block_t *low = cur;
+    ac_block_t *high = cur;
+    size_t step = 1;
+    while(high < eg && high->group < group_id) {
+        low = high + 1;
+        if((size_t)(eg - high) <= step) {
+            high = eg;
+            break;
+        }
+        high += step;
+        step <<= 1;
+    }
+    while (low < high) {
+        ac_block_t *mid = low + ((high-low) >> 1);
+        if(group_id > mid->group)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
 uint32_t ac_s_empty_cursor(ac_s_cursor_t *c) {
     c->advance_to = advance_empty_cursor_to;
     c->advance = advance_empty_cursor;
@@ -1819,7 +1984,8 @@ uint32_t advance_block_cursor_to(ac_s_cursor_t *c, uint32_t id)
         return c->current;
     block_cursor_t *sc = (block_cursor_t *)c;
     uint32_t gid = id & 0x7fff000;
-    while(sc->gid < gid) {
+    if(sc->gid < gid) {
+        sc->cur = gallop_group(sc->cur, sc->eg, gid >> 12);
         if (sc->cur >= sc->eg)
             return ac_s_empty_cursor(c);
         advance_group(sc);
@@ -1857,6 +2023,12 @@ uint32_t advance_block_cursor_to(ac_s_cursor_t *c, uint32_t id)
     return c->current;
 }
 
+/* cursors from h->cb (or ac_search_builder) may also be type 1, only those
+   made by _init_term_cursor are block cursors with an ac_s_term_t */
+static inline bool is_block_cursor(ac_s_cursor_t *c) {
+    return c->type == 1 && c->advance_to == (ac_s_advance_to_cb)advance_block_cursor_to;
+}
+
 uint32_t post_reset_advance(ac_s_cursor_t *c) {
     c->advance = c->_advance;
     return c->current;
@@ -1942,6 +2114,38 @@ ac_s_cursor_t *ac_s_init_term_cursor(ac_pool_t *pool, ac_s_t *h, ac_token_t *tok
 }
 
 
+/* estimated number of ids a cursor will return, used to order and cursors */
+static uint32_t estimate_ids(ac_s_cursor_t *c) {
+    if(c->type == 0)
+        return 0;
+    else if(is_block_cursor(c))
+        return ((block_cursor_t *)c)->term->num_ids;
+    else if(c->type == 11 || c->type == 12) {
+        or_cursor_t *r = (or_cursor_t *)c;
+        uint64_t total = 0;
+        for(uint32_t i=0; i<r->num_cursors; i++)
+            total += estimate_ids(r->cursors[i]);
+        return total < 0xFFFFFFFF ? total : 0xFFFFFFFF;
+    }
+    else if(c->type == 10) {
+        /* and and phrase cursors share the layout of cursors/num_cursors */
+        and_cursor_t *r = (and_cursor_t *)c;
+        uint32_t min = 0xFFFFFFFF;
+        for(uint32_t i=0; i<r->num_cursors; i++) {
+            uint32_t size = estimate_ids(r->cursors[i]);
+            if(size < min)
+                min = size;
+        }
+        return min;
+    }
+    else if(c->type == 13)
+        return estimate_ids(((not_cursor_t *)c)->pos);
+    else if(c->type == 2)
+        return estimate_ids(((filter_cursor_t *)c)->c);
+    /* custom cursors are unknown, try them last */
+    return 0xFFFFFFFF;
+}
+
 ac_s_cursor_t ** ac_s_sub_cursors(ac_s_cursor_t *c, uint32_t *num_sub ) {
     if(c->type == 11 || c->type == 12) {
         or_cursor_t *r = (or_cursor_t *)c;
@@ -1962,6 +2166,164 @@ ac_s_cursor_t ** ac_s_sub_cursors(ac_s_cursor_t *c, uint32_t *num_sub ) {
 }
 
 
+/* sum of the scores of the term cursors which are on id, used for queries
+   which ac_s_top_n cannot prune */
+static double score_term_cursors(ac_s_cursor_t *c, uint32_t id, ac_s_score_cb score, void *arg) {
+    if(is_block_cursor(c))
+        return c->current == id ? score(c, ((block_cursor_t *)c)->term->num_ids, arg) : 0.0;
+    else if(c->type == 1)
+        return c->current == id ? score(c, 0, arg) : 0.0;
+    else if(c->type == 13)
+        return score_term_cursors(((not_cursor_t *)c)->pos, id, score, arg);
+    else if(c->type == 2)
+        return score_term_cursors(((filter_cursor_t *)c)->c, id, score, arg);
+
+    double r = 0.0;
+    uint32_t num_sub = 0;
+    ac_s_cursor_t **sub = ac_s_sub_cursors(c, &num_sub);
+    for(uint32_t i=0; i<num_sub; i++)
+        r += score_term_cursors(sub[i], id, score, arg);
+    return r;
+}
+
+typedef struct {
+    block_cursor_t *c;
+    double max_score;
+} ranked_term_t;
+
+static void sort_ranked_terms(ranked_term_t *terms, uint32_t *num_terms) {
+    uint32_t n = 0;
+    for(uint32_t i=0; i<*num_terms; i++) {
+        if(!terms[i].c->cursor.current)
+            continue;
+        ranked_term_t t = terms[i];
+        uint32_t j = n;
+        while(j > 0 && terms[j-1].c->cursor.current > t.c->cursor.current) {
+            terms[j] = terms[j-1];
+            j--;
+        }
+        terms[j] = t;
+        n++;
+    }
+    *num_terms = n;
+}
+
+/* bound on the score of any id in group_id without moving the cursor */
+static double group_max_score(ranked_term_t *t, uint32_t group_id, ac_s_max_score_cb max_score, void *arg) {
+    block_cursor_t *sc = t->c;
+    ac_block_t *g = gallop_group(sc->cur - 1, sc->eg, group_id);
+    if(g >= sc->eg || g->group != group_id)
+        return 0.0;
+    return max_score(sc->term->group_max[g - sc->groups], sc->term->num_ids, arg);
+}
+
+/* of terms[0..num), the one which bounds the score the most */
+static ranked_term_t *best_ranked_term(ranked_term_t *terms, uint32_t num) {
+    ranked_term_t *r = terms;
+    for(uint32_t i=1; i<num; i++)
+        if(terms[i].max_score > r->max_score)
+            r = terms + i;
+    return r;
+}
+
+void ac_s_top_n(ac_top_n_t *top, ac_s_cursor_t *c, ac_s_score_cb score, ac_s_max_score_cb max_score, void *arg) {
+    ac_s_cursor_t **cursors = NULL;
+    uint32_t num_cursors = 0;
+    if(is_block_cursor(c)) {
+        cursors = &c;
+        num_cursors = 1;
+    }
+    else if(c->type == 11 || c->type == 12) {
+        or_cursor_t *oc = (or_cursor_t *)c;
+        cursors = oc->cursors;
+        num_cursors = oc->num_cursors;
+        for(uint32_t i=0; i<num_cursors; i++) {
+            if(!is_block_cursor(cursors[i]) && cursors[i]->type != 0) {
+                cursors = NULL;
+                break;
+            }
+        }
+    }
+
+    if(!cursors) {
+        uint32_t id;
+        while((id = c->advance(c)))
+            ac_top_n_add(top, id, score_term_cursors(c, id, score, arg));
+        return;
+    }
+
+    ranked_term_t *terms = (ranked_term_t *)ac_pool_alloc(c->pool, sizeof(ranked_term_t) * (num_cursors+1));
+    uint32_t num_terms = 0;
+    for(uint32_t i=0; i<num_cursors; i++) {
+        if(!is_block_cursor(cursors[i]) || !cursors[i]->advance(cursors[i]))
+            continue;
+        block_cursor_t *sc = (block_cursor_t *)cursors[i];
+        terms[num_terms].c = sc;
+        terms[num_terms].max_score = max_score(sc->term->max_frequency, sc->term->num_ids, arg);
+        num_terms++;
+    }
+    sort_ranked_terms(terms, &num_terms);
+
+    while(num_terms) {
+        double threshold = ac_top_n_threshold(top);
+
+        /* the first id which could beat the threshold if every term before
+           it also matched */
+        double bound = 0.0;
+        uint32_t pivot = 0;
+        while(pivot < num_terms) {
+            bound += terms[pivot].max_score;
+            if(bound > threshold)
+                break;
+            pivot++;
+        }
+        if(pivot == num_terms)
+            break;
+
+        uint32_t id = terms[pivot].c->cursor.current;
+        while(pivot+1 < num_terms && terms[pivot+1].c->cursor.current == id)
+            pivot++;
+
+        /* ids are grouped in 4096 id blocks, so every term shares the boundary
+           of the block which the pivot lands in */
+        uint32_t group_id = ac_s_get_group_id(id);
+        bound = 0.0;
+        for(uint32_t i=0; i<=pivot; i++)
+            bound += group_max_score(terms + i, group_id, max_score, arg);
+
+        if(bound > threshold) {
+            if(terms[0].c->cursor.current == id) {
+                double weight = 0.0;
+                for(uint32_t i=0; i<=pivot; i++)
+                    weight += score(&terms[i].c->cursor, terms[i].c->term->num_ids, arg);
+                ac_top_n_add(top, id, weight);
+                for(uint32_t i=0; i<=pivot; i++)
+                    advance_block_cursor(terms[i].c);
+            }
+            else {
+                uint32_t num_before = 0;
+                while(terms[num_before].c->cursor.current < id)
+                    num_before++;
+                ranked_term_t *t = best_ranked_term(terms, num_before);
+                advance_block_cursor_to(&t->c->cursor, id);
+            }
+        }
+        else {
+            /* nothing in [id, next) can beat the threshold */
+            uint32_t next = (group_id+1) << 12;
+            if(pivot+1 < num_terms && terms[pivot+1].c->cursor.current < next)
+                next = terms[pivot+1].c->cursor.current;
+            ranked_term_t *t = best_ranked_term(terms, pivot+1);
+            if(next > 0x7ffffff)
+                ac_s_empty_cursor(&t->c->cursor);
+            else
+                advance_block_cursor_to(&t->c->cursor, next);
+        }
+        sort_ranked_terms(terms, &num_terms);
+    }
+}
+
+
 struct phrase_cursor_s;
 typedef struct phrase_cursor_s phrase_cursor_t;
 
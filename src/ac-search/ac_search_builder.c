@@ -1,11 +1,22 @@
 #include "another-c-library/ac-search/ac_search_builder.h"
 
 #include <inttypes.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "another-c-library/ac_out.h"
 #include "another-c-library/ac_buffer.h"
+#include "another-c-library/ac_lz4.h"
 #include "the-macro-library/macro_bsearch.h"
 
+#if !defined(AC_SEARCH_BUILDER_NO_SIMD) && defined(__SSE2__)
+#include <emmintrin.h>
+#define AC_SEARCH_BUILDER_SSE2
+#endif
+
 static ac_out_t *open_sorted(char *filename, ac_io_compare_cb compare, size_t buffer_size) {
   ac_out_options_t options;
   ac_out_ext_options_t ext_options;
@@ -32,6 +43,17 @@ struct ac_search_builder_s {
     ac_out_t *term_data;
     ac_out_t *global_data;
     uint32_t max_id;
+
+    /* parallel builds (see ac_search_builder_init_parallel), the builder
+       which is returned is producer 0 */
+    size_t num_partitions;
+    size_t num_threads;
+    ac_search_builder_t **producers;
+    size_t num_producers;
+    size_t producers_size;
+    size_t next_partition;
+    bool is_producer;
+    pthread_mutex_t mutex;
 };
 
 struct term_data_s;
@@ -46,6 +68,28 @@ struct term_data_s {
 };
 #pragma pack(pop)
 
+/*
+    Terms with at least BLOCK_IDS ids are written in blocks instead of 4096 id
+    groups (the high bit of max_term_size in the term index marks them).
+
+    uint32_t num_ids, uint32_t num_blocks
+    num_blocks x { uint32_t last id in block, uint32_t offset of block }
+    blocks, each
+      uint8_t bits, uint8_t flags (1 if controls follow)
+      BLOCK_IDS gaps (id - previous id - 1) packed into bits bits each as
+        BLOCK_LANES interleaved lanes of 32 bit words
+      controls (BLOCK_IDS 4 bit controls as in advance_id, all zero if absent)
+      payload bytes for each id (as in advance_id)
+    BLOCK_PADDING zero bytes
+
+    The gaps of a block are unpacked and prefix summed four at a time and
+    advance_to only decodes the block which the skip table points it to.
+*/
+#define BLOCK_IDS 128
+#define BLOCK_LANES 4
+#define BLOCK_PADDING 32
+#define BLOCK_FORMAT 0x80000000
+
 static int compare_term_data(const ac_io_record_t *r1, const ac_io_record_t *r2, void *arg) {
     term_data_t *a = (term_data_t *)r1->record;
     term_data_t *b = (term_data_t *)r2->record;
@@ -67,23 +111,100 @@ static int compare_global_data(const ac_io_record_t *r1, const ac_io_record_t *r
     return 0;
 }
 
-ac_search_builder_t *ac_search_builder_init(const char *filename, size_t buffer_size) {
+static size_t partition_term(const ac_io_record_t *r, size_t num_part, void *arg) {
+    const char *term = r->record + sizeof(term_data_t);
+    return ac_lz4_hash64(term, strlen(term)) % num_part;
+}
+
+/* postings are split into num_partitions by a hash of the term and each
+   partition is sorted on its own (num_threads at a time) */
+static ac_out_t *open_partitioned(char *filename, size_t buffer_size, size_t num_partitions, size_t num_threads) {
+  ac_out_options_t options;
+  ac_out_ext_options_t ext_options;
+  ac_out_options_init(&options);
+  ac_out_ext_options_init(&ext_options);
+
+  ac_out_options_format(&options, ac_io_prefix());
+  ac_out_options_buffer_size(&options, buffer_size);
+  ac_out_ext_options_compare(&ext_options, compare_term_data, NULL);
+  ac_out_ext_options_reducer(&ext_options,
+                             ac_io_keep_first, NULL);
+  ac_out_ext_options_partition(&ext_options, partition_term, NULL);
+  ac_out_ext_options_num_partitions(&ext_options, num_partitions);
+  ac_out_ext_options_num_sort_threads(&ext_options, num_threads);
+
+  return ac_out_ext_init(filename, &options, &ext_options);
+}
+
+static ac_search_builder_t *builder_init(const char *filename, size_t buffer_size) {
     ac_search_builder_t *h = (ac_search_builder_t *)ac_calloc(sizeof(*h) + (strlen(filename)*2) + 50);
     h->base_filename = (char *)(h+1);
     strcpy(h->base_filename, filename);
     h->filename_len = strlen(filename);
     h->filename = h->base_filename + h->filename_len + 1;
+    h->buffer_size = buffer_size;
+    h->bh = ac_buffer_init(256);
+    h->tmp_pool = ac_pool_init(1024);
+    return h;
+}
 
+ac_search_builder_t *ac_search_builder_init(const char *filename, size_t buffer_size) {
+    ac_search_builder_t *h = builder_init(filename, buffer_size);
     snprintf(h->filename, h->filename_len+40, "%s_data", filename );
     h->term_data = open_sorted(h->filename, compare_term_data, buffer_size);
     snprintf(h->filename, h->filename_len+40, "%s_gbl", filename );
     h->global_data = open_sorted(h->filename, compare_global_data, buffer_size/10);
-    h->buffer_size = buffer_size;
-    h->bh = ac_buffer_init(256);
-    h->tmp_pool = ac_pool_init(1024);
     return h;
 }
 
+static ac_search_builder_t *producer_init(ac_search_builder_t *h, size_t producer) {
+    ac_search_builder_t *r = builder_init(h->base_filename, h->buffer_size);
+    snprintf(r->filename, r->filename_len+40, "%s_data_%lu", r->base_filename, producer);
+    r->term_data = open_partitioned(r->filename, r->buffer_size, h->num_partitions, h->num_threads);
+    snprintf(r->filename, r->filename_len+40, "%s_gbl_%lu", r->base_filename, producer);
+    r->global_data = open_sorted(r->filename, compare_global_data, r->buffer_size/10);
+    r->is_producer = producer > 0;
+    return r;
+}
+
+ac_search_builder_t *ac_search_builder_init_parallel(const char *filename, size_t buffer_size,
+                                                     size_t num_partitions, size_t num_threads) {
+    if(num_partitions < 1)
+        num_partitions = 1;
+    if(num_threads < 1)
+        num_threads = 1;
+    ac_search_builder_t tmp;
+    memset(&tmp, 0, sizeof(tmp));
+    tmp.base_filename = (char *)filename;
+    tmp.buffer_size = buffer_size;
+    tmp.num_partitions = num_partitions;
+    tmp.num_threads = num_threads;
+    ac_search_builder_t *h = producer_init(&tmp, 0);
+    h->num_partitions = num_partitions;
+    h->num_threads = num_threads;
+    h->producers_size = 8;
+    h->producers = (ac_search_builder_t **)ac_malloc(sizeof(ac_search_builder_t *) * h->producers_size);
+    h->producers[0] = h;
+    h->num_producers = 1;
+    pthread_mutex_init(&h->mutex, NULL);
+    return h;
+}
+
+ac_search_builder_t *ac_search_builder_producer(ac_search_builder_t *h) {
+    if(!h->num_partitions || h->is_producer)
+        abort();
+    pthread_mutex_lock(&h->mutex);
+    if(h->num_producers == h->producers_size) {
+        h->producers_size *= 2;
+        h->producers = (ac_search_builder_t **)ac_realloc(h->producers, sizeof(ac_search_builder_t *) * h->producers_size);
+    }
+    ac_search_builder_t *r = producer_init(h, h->num_producers);
+    h->producers[h->num_producers] = r;
+    h->num_producers++;
+    pthread_mutex_unlock(&h->mutex);
+    return r;
+}
+
 void ac_search_builder_global(ac_search_builder_t *h, uint32_t id, const void *d, uint32_t len) {
     ac_buffer_set(h->bh, &id, sizeof(id));
     ac_buffer_append(h->bh, d, len);
@@ -137,13 +258,220 @@ void ac_search_builder_wtermf(ac_search_builder_t *h, uint32_t id, int32_t value
     ac_search_builder_wterm(h, id, value, pos, sp, r);
 }
 
-void ac_search_builder_destroy(ac_search_builder_t *h) {
+/* appends the payload for the postings of one id (p..ep) and returns the 4
+   bit control which describes it (see advance_id) */
+static uint32_t append_payload(ac_buffer_t *bh, term_data_t *p, term_data_t *ep, uint32_t *max_term_size) {
+    if(ep-p == 1 && p->position == 0) {
+        if(p->value >= 0 && p->value < 65536) {
+            if(p->value < 256) {
+                if(p->value < 5) // encode directly
+                    return p->value;
+                uint8_t value = p->value;
+                ac_buffer_append(bh, &value, sizeof(value));
+                return 5;
+            }
+            uint16_t value = p->value;
+            ac_buffer_append(bh, &value, sizeof(value));
+            return 6;
+        }
+        int32_t value = p->value;
+        ac_buffer_append(bh, &value, sizeof(value));
+        return 7;
+    }
+
+    if(ep-p > *max_term_size)
+        *max_term_size = ep-p;
+    uint32_t control = 8;
+    uint32_t sum = 0;
+    term_data_t *p3 = p;
+    while(p3 < ep) {
+        if(p3->value == 0)
+            sum += 2;
+        else if(p3->value > 0 && p3->value < 65536) {
+            if(p3->value < 256)
+                sum += 3;
+            else
+                sum += 4;
+        }
+        else
+            sum += 6;
+        p3++;
+    }
+
+    sum--; // always at least 2 bytes, zero reserved for extension
+    if(sum > 7)
+        ac_buffer_append(bh, &sum, sizeof(sum));
+    else
+        control |= sum;
+    p3 = p;
+    while(p3 < ep) {
+        uint16_t pos = p3->position;
+        if(p3->value == 0)
+            ac_buffer_append(bh, &pos, sizeof(pos));
+        else if(p3->value > 0 && p3->value < 65536) {
+            if(p3->value < 256) {
+                pos |= (1<<14);
+                ac_buffer_append(bh, &pos, sizeof(pos));
+                uint8_t value = p3->value;
+                ac_buffer_append(bh, &value, sizeof(value));
+            }
+            else {
+                pos |= (2<<14);
+                ac_buffer_append(bh, &pos, sizeof(pos));
+                uint16_t value = p3->value;
+                ac_buffer_append(bh, &value, sizeof(value));
+            }
+        }
+        else {
+            pos |= (3<<14);
+            ac_buffer_append(bh, &pos, sizeof(pos));
+            int32_t value = p3->value;
+            ac_buffer_append(bh, &value, sizeof(value));
+        }
+        p3++;
+    }
+    return control;
+}
+
+/* the end of the postings which share p's id */
+static inline term_data_t *next_id(term_data_t *p, term_data_t *ep) {
+    uint32_t id = p->id;
+    p++;
+    while(p < ep && p->id == id)
+        p++;
+    return p;
+}
+
+static uint32_t count_ids(term_data_t *p, term_data_t *ep) {
+    uint32_t num_ids = 0;
+    while(p < ep) {
+        p = next_id(p, ep);
+        num_ids++;
+    }
+    return num_ids;
+}
+
+static void encode_groups(ac_buffer_t *out_bh, ac_buffer_t *group_bh, term_data_t *p, term_data_t *ep, uint32_t *max_term_size) {
+    while(p < ep) {
+        term_data_t *cur = p;
+        uint32_t id = cur->id & 0xffff000;
+        p++;
+        while(p < ep && id == (p->id & 0xffff000))
+            p++;
+
+        ac_buffer_clear(group_bh);
+        term_data_t *p2 = cur;
+        while(p2 < p) {
+            term_data_t *cur2 = p2;
+            p2 = next_id(p2, p);
+            uint16_t sid = (cur2->id & 0xfff) << 4;
+            size_t sid_offs = ac_buffer_length(group_bh);
+            ac_buffer_append(group_bh, &sid, sizeof(sid));
+            sid |= append_payload(group_bh, cur2, p2, max_term_size);
+            memcpy(ac_buffer_data(group_bh) + sid_offs, &sid, sizeof(sid));
+        }
+        id = (cur->id & 0xffff000) >> 12;
+        uint16_t gid = id;
+        ac_buffer_append(out_bh, &gid, sizeof(gid));
+        uint32_t len = ac_buffer_length(group_bh);
+        if(len <= 63) {
+            uint8_t value = len;
+            ac_buffer_append(out_bh, &value, sizeof(value));
+        }
+        else if(len <= 16383) {
+            uint32_t v = (len & 0x3f00) >> 8;
+            v |= (1<<6);
+            uint8_t value = v;
+            ac_buffer_append(out_bh, &value, sizeof(value));
+            v = len & 0xff;
+            value = v;
+            ac_buffer_append(out_bh, &value, sizeof(value));
+        }
+        else { // at most 4194303
+            uint32_t v = (len & 0x3f0000) >> 16;
+            v |= (2<<6);
+            uint8_t value = v;
+            ac_buffer_append(out_bh, &value, sizeof(value));
+            v = len & 0xffffff;
+            uint16_t v2 = v;
+            ac_buffer_append(out_bh, &v2, sizeof(v2));
+        }
+        ac_buffer_append(out_bh, ac_buffer_data(group_bh), ac_buffer_length(group_bh));
+    }
+}
+
+/* pack the gaps of one block into BLOCK_LANES interleaved lanes of bits
+   bit words (value i goes to lane i % 4) so the decoder can unpack four at a
+   time with plain vector shifts */
+static void pack_gaps(ac_buffer_t *bh, const uint32_t *gaps, uint32_t bits) {
+    uint32_t *words = (uint32_t *)ac_buffer_append_ualloc(bh, bits * BLOCK_LANES * sizeof(uint32_t));
+    memset(words, 0, bits * BLOCK_LANES * sizeof(uint32_t));
+    for( uint32_t i=0; i<BLOCK_IDS; i++ ) {
+        uint32_t lane = i & (BLOCK_LANES-1);
+        uint32_t offs = (i / BLOCK_LANES) * bits;
+        uint32_t w = offs >> 5;
+        uint32_t shift = offs & 31;
+        words[(w*BLOCK_LANES)+lane] |= gaps[i] << shift;
+        if(shift + bits > 32)
+            words[((w+1)*BLOCK_LANES)+lane] |= gaps[i] >> (32 - shift);
+    }
+}
+
+static void encode_blocks(ac_buffer_t *out_bh, ac_buffer_t *block_bh, term_data_t *p, term_data_t *ep, uint32_t *max_term_size) {
+    uint32_t num_ids = count_ids(p, ep);
+    uint32_t num_blocks = (num_ids + BLOCK_IDS - 1) / BLOCK_IDS;
+    ac_buffer_append(out_bh, &num_ids, sizeof(num_ids));
+    ac_buffer_append(out_bh, &num_blocks, sizeof(num_blocks));
+    size_t skip_offs = ac_buffer_length(out_bh);
+    ac_buffer_append_ualloc(out_bh, num_blocks * sizeof(uint32_t) * 2);
+    size_t blocks_offs = ac_buffer_length(out_bh);
+
+    uint32_t gaps[BLOCK_IDS];
+    uint8_t controls[BLOCK_IDS/2];
+    uint32_t prev = (uint32_t)-1;
+    for( uint32_t block=0; block<num_blocks; block++ ) {
+        ac_buffer_clear(block_bh);
+        memset(gaps, 0, sizeof(gaps));
+        memset(controls, 0, sizeof(controls));
+        uint32_t max_gap = 0;
+        bool has_controls = false;
+        uint32_t n = 0;
+        while(p < ep && n < BLOCK_IDS) {
+            term_data_t *cur = p;
+            p = next_id(p, ep);
+            gaps[n] = cur->id - prev - 1;
+            max_gap |= gaps[n];
+            prev = cur->id;
+            uint32_t control = append_payload(block_bh, cur, p, max_term_size);
+            if(control) {
+                controls[n >> 1] |= control << ((n & 1) << 2);
+                has_controls = true;
+            }
+            n++;
+        }
+        uint32_t bits = 0;
+        while(bits < 32 && (max_gap >> bits))
+            bits++;
+
+        uint32_t *skip = (uint32_t *)(ac_buffer_data(out_bh) + skip_offs) + (block * 2);
+        skip[0] = prev;
+        skip[1] = ac_buffer_length(out_bh) - blocks_offs;
+
+        uint8_t header[2];
+        header[0] = bits;
+        header[1] = has_controls ? 1 : 0;
+        ac_buffer_append(out_bh, header, sizeof(header));
+        pack_gaps(out_bh, gaps, bits);
+        if(has_controls)
+            ac_buffer_append(out_bh, controls, sizeof(controls));
+        ac_buffer_append(out_bh, ac_buffer_data(block_bh), ac_buffer_length(block_bh));
+    }
+    /* the decoders read up to a vector past the packed gaps */
+    ac_buffer_appendn(out_bh, 0, BLOCK_PADDING);
+}
+
+static void write_globals(ac_search_builder_t *h, ac_in_t *in) {
     ac_io_record_t *r;
-    ac_buffer_t *bh = ac_buffer_init(1024*1024);
-    ac_buffer_t *out_bh = ac_buffer_init(1024*1024);
-    ac_buffer_t *group_bh = ac_buffer_init(1024*1024);
-    ac_buffer_t *key = ac_buffer_init(128);
-    ac_in_t *in;
     FILE *out_idx, *out_data;
     size_t offs;
 
@@ -154,7 +482,6 @@ void ac_search_builder_destroy(ac_search_builder_t *h) {
     offs = 4;
     uint32_t last_id = 0;
     size_t zero = 0;
-    in = ac_out_in(h->global_data);
     while((r=ac_in_advance(in)) != NULL) {
         uint32_t id = (*(uint32_t *)r->record);
         while(last_id < id) {
@@ -172,15 +499,30 @@ void ac_search_builder_destroy(ac_search_builder_t *h) {
     }
     fclose(out_idx);
     fclose(out_data);
-    ac_in_destroy(in);
+}
 
-    snprintf(h->filename, h->filename_len+40, "%s_term_idx", h->base_filename);
-    out_idx = fopen(h->filename, "wb");
-    snprintf(h->filename, h->filename_len+40, "%s_term_data", h->base_filename);
-    out_data = fopen(h->filename, "wb");
+/* writes base_term_idx, base_term_offs, and base_term_data from the sorted
+   postings in in */
+static void write_terms(const char *base, ac_in_t *in) {
+    ac_io_record_t *r;
+    ac_buffer_t *bh = ac_buffer_init(1024*1024);
+    ac_buffer_t *out_bh = ac_buffer_init(1024*1024);
+    ac_buffer_t *group_bh = ac_buffer_init(1024*1024);
+    ac_buffer_t *key = ac_buffer_init(128);
+    FILE *out_idx, *out_offs, *out_data;
+    size_t offs;
+    size_t filename_len = strlen(base)+40;
+    char *filename = (char *)ac_malloc(filename_len);
+
+    size_t idx_offs = 0;
+    snprintf(filename, filename_len, "%s_term_idx", base);
+    out_idx = fopen(filename, "wb");
+    snprintf(filename, filename_len, "%s_term_offs", base);
+    out_offs = fopen(filename, "wb");
+    snprintf(filename, filename_len, "%s_term_data", base);
+    out_data = fopen(filename, "wb");
 
     offs = 4;
-    in = ac_out_in(h->term_data);
     r=ac_in_advance(in);
     while(r != NULL) {
         ac_buffer_set(key, r->record+sizeof(term_data_t), r->length-sizeof(term_data_t));
@@ -193,140 +535,14 @@ void ac_search_builder_destroy(ac_search_builder_t *h) {
         term_data_t *ep = (term_data_t *)ac_buffer_end(bh);
         uint32_t max_term_size = 0;
         ac_buffer_clear(out_bh);
-        while(p < ep) {
-            term_data_t *cur = p;
-            uint32_t id = cur->id & 0xffff000;
-            p++;
-            while(p < ep && id == (p->id & 0xffff000))
-                p++;
-
-            ac_buffer_clear(group_bh);
-            term_data_t *p2 = cur;
-            while(p2 < p) {
-                term_data_t *cur2 = p2;
-                p2++;
-                id = cur2->id & 0xfff;
-                while(p2 < p && id == (p2->id & 0xfff))
-                    p2++;
-                uint16_t sid = id << 4;
-                if(p2-cur2 == 1 && cur2->position == 0) {
-                    if(cur2->value >= 0 && cur2->value < 65536) {
-                        if(cur2->value < 256) {
-                            if(cur2->value < 5) {
-                                // encode directly
-                                sid += cur2->value;
-                                ac_buffer_append(group_bh, &sid, sizeof(sid));
-                            }
-                            else {
-                                // uint8
-                                sid |= 5;
-                                ac_buffer_append(group_bh, &sid, sizeof(sid));
-                                uint8_t value = cur2->value;
-                                ac_buffer_append(group_bh, &value, sizeof(value));
-                            }
-                        }
-                        else {
-                            // uint16
-                            sid |= 6;
-                            ac_buffer_append(group_bh, &sid, sizeof(sid));
-                            uint16_t value = cur2->value;
-                            ac_buffer_append(group_bh, &value, sizeof(value));
-                        }
-                    }
-                    else {
-                        // int32
-                        sid |= 7;
-                        ac_buffer_append(group_bh, &sid, sizeof(sid));
-                        int32_t value = cur2->value;
-                        ac_buffer_append(group_bh, &value, sizeof(value));
-                    }
-                }
-                else {
-                    if(p2-cur2 > max_term_size)
-                        max_term_size = p2-cur2;
-                    sid |= 8;
-                    uint32_t sum = 0;
-                    term_data_t *p3 = cur2;
-                    while(p3 < p2) {
-                        if(p3->value == 0)
-                            sum += 2;
-                        else if(p3->value > 0 && p3->value < 65536) {
-                            if(p3->value < 256)
-                                sum += 3;
-                            else
-                                sum += 4;
-                        }
-                        else
-                            sum += 6;
-                        p3++;
-                    }
-
-                    sum--; // always at least 2 bytes, zero reserved for extension
-                    if(sum > 7) {
-                        ac_buffer_append(group_bh, &sid, sizeof(sid));
-                        ac_buffer_append(group_bh, &sum, sizeof(sum));
-                    }
-                    else {
-                        sid |= sum;
-                        ac_buffer_append(group_bh, &sid, sizeof(sid));
-                    }
-                    p3 = cur2;
-                    while(p3 < p2) {
-                        uint16_t pos = p3->position;
-                        if(p3->value == 0)
-                            ac_buffer_append(group_bh, &pos, sizeof(pos));
-                        else if(p3->value > 0 && p3->value < 65536) {
-                            if(p3->value < 256) {
-                                pos |= (1<<14);
-                                ac_buffer_append(group_bh, &pos, sizeof(pos));
-                                uint8_t value = p3->value;
-                                ac_buffer_append(group_bh, &value, sizeof(value));
-                            }
-                            else {
-                                pos |= (2<<14);
-                                ac_buffer_append(group_bh, &pos, sizeof(pos));
-                                uint16_t value = p3->value;
-                                ac_buffer_append(group_bh, &value, sizeof(value));
-                            }
-                        }
-                        else {
-                            pos |= (3<<14);
-                            ac_buffer_append(group_bh, &pos, sizeof(pos));
-                            int32_t value = p3->value;
-                            ac_buffer_append(group_bh, &value, sizeof(value));
-                        }
-                        p3++;
-                    }
-                }
-            }
-            id = (cur->id & 0xffff000) >> 12;
-            uint16_t gid = id;
-            ac_buffer_append(out_bh, &gid, sizeof(gid));
-            uint32_t len = ac_buffer_length(group_bh);
-            if(len <= 63) {
-                uint8_t value = len;
-                ac_buffer_append(out_bh, &value, sizeof(value));
-            }
-            else if(len <= 16383) {
-                uint32_t v = (len & 0x3f00) >> 8;
-                v |= (1<<6);
-                uint8_t value = v;
-                ac_buffer_append(out_bh, &value, sizeof(value));
-                v = len & 0xff;
-                value = v;
-                ac_buffer_append(out_bh, &value, sizeof(value));
-            }
-            else { // at most 4194303
-                uint32_t v = (len & 0x3f0000) >> 16;
-                v |= (2<<6);
-                uint8_t value = v;
-                ac_buffer_append(out_bh, &value, sizeof(value));
-                v = len & 0xffffff;
-                uint16_t v2 = v;
-                ac_buffer_append(out_bh, &v2, sizeof(v2));
-            }
-            ac_buffer_append(out_bh, ac_buffer_data(group_bh), ac_buffer_length(group_bh));
+        if(count_ids(p, ep) >= BLOCK_IDS) {
+            encode_blocks(out_bh, group_bh, p, ep, &max_term_size);
+            max_term_size |= BLOCK_FORMAT;
         }
+        else
+            encode_groups(out_bh, group_bh, p, ep, &max_term_size);
+        fwrite(&idx_offs, sizeof(idx_offs), 1, out_offs);
+        idx_offs += ac_buffer_length(key) + sizeof(offs) + sizeof(max_term_size);
         fwrite(ac_buffer_data(key), ac_buffer_length(key), 1, out_idx);
         fwrite(&offs, sizeof(offs), 1, out_idx);
         fwrite(&max_term_size, sizeof(max_term_size), 1, out_idx);
@@ -336,22 +552,211 @@ void ac_search_builder_destroy(ac_search_builder_t *h) {
         fwrite(ac_buffer_data(out_bh), len, 1, out_data);
     }
     fclose(out_idx);
+    fclose(out_offs);
     fclose(out_data);
-    ac_in_destroy(in);
 
+    ac_free(filename);
     ac_buffer_destroy(bh);
     ac_buffer_destroy(group_bh);
     ac_buffer_destroy(out_bh);
     ac_buffer_destroy(key);
+}
 
+static void builder_destroy(ac_search_builder_t *h) {
     ac_buffer_destroy(h->bh);
     ac_pool_destroy(h->tmp_pool);
     ac_free(h);
 }
 
+/* merges the sorted runs which each producer wrote for one partition and
+   encodes them as the segment base_seg_<partition> */
+static void *encode_segments(void *arg) {
+    ac_search_builder_t *h = (ac_search_builder_t *)arg;
+    size_t filename_len = h->filename_len+80;
+    char *filename = (char *)ac_malloc(filename_len*2);
+    char *part_filename = filename + filename_len;
+    size_t buffer_size = h->buffer_size / (h->num_threads * h->num_producers);
+    if(buffer_size < 64*1024)
+        buffer_size = 64*1024;
+
+    while(true) {
+        pthread_mutex_lock(&h->mutex);
+        size_t partition = h->next_partition;
+        h->next_partition++;
+        pthread_mutex_unlock(&h->mutex);
+        if(partition >= h->num_partitions)
+            break;
+
+        ac_in_options_t opts;
+        ac_in_options_init(&opts);
+        ac_in_options_format(&opts, ac_io_prefix());
+        ac_in_options_buffer_size(&opts, buffer_size);
+        ac_in_t *in = ac_in_ext_init(compare_term_data, NULL, &opts);
+        for( size_t i=0; i<h->num_producers; i++ ) {
+            snprintf(filename, filename_len, "%s_data_%lu", h->base_filename, i);
+            ac_out_partition_filename(part_filename, filename, partition);
+            ac_in_ext_add(in, ac_in_init(part_filename, &opts), 0);
+        }
+        ac_in_ext_keep_first(in);
+        snprintf(filename, filename_len, "%s_seg_%lu", h->base_filename, partition);
+        write_terms(filename, in);
+        ac_in_destroy(in);
+
+        for( size_t i=0; i<h->num_producers; i++ ) {
+            snprintf(filename, filename_len, "%s_data_%lu", h->base_filename, i);
+            ac_out_partition_filename(part_filename, filename, partition);
+            remove(part_filename);
+        }
+    }
+    ac_free(filename);
+    return NULL;
+}
+
+static void append_file(FILE *out, const char *filename, char *buf, size_t buf_size) {
+    FILE *in = fopen(filename, "rb");
+    if(!in)
+        abort();
+    size_t n;
+    while((n = fread(buf, 1, buf_size, in)) > 0)
+        fwrite(buf, 1, n, out);
+    fclose(in);
+}
+
+/* the segments hold disjoint sets of terms, so the image is their term data
+   laid end to end and a merge of their (sorted) term indexes */
+static void concat_segments(ac_search_builder_t *h) {
+    size_t num_segments = h->num_partitions;
+    size_t filename_len = h->filename_len+80;
+    char *filename = (char *)ac_malloc(filename_len);
+    char **idx = (char **)ac_calloc(sizeof(char *) * num_segments * 3);
+    char **idx_p = idx + num_segments;
+    char **idx_ep = idx_p + num_segments;
+    size_t *data_base = (size_t *)ac_calloc(sizeof(size_t) * num_segments);
+
+    size_t base = 0;
+    for( size_t i=0; i<num_segments; i++ ) {
+        size_t len = 0;
+        snprintf(filename, filename_len, "%s_seg_%lu_term_idx", h->base_filename, i);
+        idx[i] = (char *)ac_io_read_file(&len, filename);
+        idx_p[i] = idx[i];
+        idx_ep[i] = idx[i] ? idx[i] + len : NULL;
+        data_base[i] = base;
+        snprintf(filename, filename_len, "%s_seg_%lu_term_data", h->base_filename, i);
+        base += ac_io_file_size(filename);
+    }
+
+    snprintf(h->filename, h->filename_len+40, "%s_term_idx", h->base_filename);
+    FILE *out_idx = fopen(h->filename, "wb");
+    snprintf(h->filename, h->filename_len+40, "%s_term_offs", h->base_filename);
+    FILE *out_offs = fopen(h->filename, "wb");
+    size_t idx_offs = 0;
+    while(true) {
+        size_t best = num_segments;
+        for( size_t i=0; i<num_segments; i++ ) {
+            if(idx_p[i] < idx_ep[i] &&
+               (best == num_segments || strcmp(idx_p[i], idx_p[best]) < 0))
+                best = i;
+        }
+        if(best == num_segments)
+            break;
+        char *p = idx_p[best];
+        size_t term_len = strlen(p)+1;
+        size_t offs = (*(size_t *)(p+term_len)) + data_base[best];
+        uint32_t max_term_size = (*(uint32_t *)(p+term_len+sizeof(offs)));
+        idx_p[best] = p + term_len + sizeof(offs) + sizeof(max_term_size);
+
+        fwrite(&idx_offs, sizeof(idx_offs), 1, out_offs);
+        idx_offs += term_len + sizeof(offs) + sizeof(max_term_size);
+        fwrite(p, term_len, 1, out_idx);
+        fwrite(&offs, sizeof(offs), 1, out_idx);
+        fwrite(&max_term_size, sizeof(max_term_size), 1, out_idx);
+    }
+    fclose(out_idx);
+    fclose(out_offs);
+
+    size_t buf_size = 1024*1024;
+    char *buf = (char *)ac_malloc(buf_size);
+    snprintf(h->filename, h->filename_len+40, "%s_term_data", h->base_filename);
+    FILE *out_data = fopen(h->filename, "wb");
+    for( size_t i=0; i<num_segments; i++ ) {
+        snprintf(filename, filename_len, "%s_seg_%lu_term_data", h->base_filename, i);
+        append_file(out_data, filename, buf, buf_size);
+    }
+    fclose(out_data);
+    ac_free(buf);
+
+    for( size_t i=0; i<num_segments; i++ ) {
+        if(idx[i])
+            ac_free(idx[i]);
+        snprintf(filename, filename_len, "%s_seg_%lu_term_idx", h->base_filename, i);
+        remove(filename);
+        snprintf(filename, filename_len, "%s_seg_%lu_term_offs", h->base_filename, i);
+        remove(filename);
+        snprintf(filename, filename_len, "%s_seg_%lu_term_data", h->base_filename, i);
+        remove(filename);
+    }
+    ac_free(data_base);
+    ac_free(idx);
+    ac_free(filename);
+}
+
+static void destroy_parallel(ac_search_builder_t *h) {
+    /* sorts each producer's partitions */
+    for( size_t i=0; i<h->num_producers; i++ )
+        ac_out_destroy(h->producers[i]->term_data);
+
+    size_t num_threads = h->num_threads;
+    if(num_threads > h->num_partitions)
+        num_threads = h->num_partitions;
+    pthread_t *threads = (pthread_t *)ac_malloc(sizeof(pthread_t) * num_threads);
+    h->next_partition = 0;
+    for( size_t i=0; i<num_threads; i++ )
+        pthread_create(threads + i, NULL, encode_segments, h);
+
+    /* globals are written while the segments are encoded */
+    ac_in_t *in = ac_in_ext_init(compare_global_data, NULL, NULL);
+    for( size_t i=0; i<h->num_producers; i++ )
+        ac_in_ext_add(in, ac_out_in(h->producers[i]->global_data), 0);
+    ac_in_ext_keep_first(in);
+    write_globals(h, in);
+    ac_in_destroy(in);
+
+    for( size_t i=0; i<num_threads; i++ )
+        pthread_join(threads[i], NULL);
+    ac_free(threads);
+
+    concat_segments(h);
+
+    for( size_t i=1; i<h->num_producers; i++ )
+        builder_destroy(h->producers[i]);
+    ac_free(h->producers);
+    pthread_mutex_destroy(&h->mutex);
+    builder_destroy(h);
+}
+
+void ac_search_builder_destroy(ac_search_builder_t *h) {
+    if(h->is_producer)
+        abort();
+    if(h->num_partitions) {
+        destroy_parallel(h);
+        return;
+    }
+
+    ac_in_t *in = ac_out_in(h->global_data);
+    write_globals(h, in);
+    ac_in_destroy(in);
+
+    in = ac_out_in(h->term_data);
+    write_terms(h->base_filename, in);
+    ac_in_destroy(in);
+
+    builder_destroy(h);
+}
+
 
 struct ac_search_builder_image_s {
-    void **gbls;
+    size_t *gbl_idx;
+    size_t gbl_idx_len;
     uint32_t num_gbls;
 
     char *gbl_data;
@@ -359,59 +764,91 @@ struct ac_search_builder_image_s {
 
     char *term_idx;
     size_t term_idx_len;
+    size_t *term_offs;
+    size_t term_offs_len;
     char **terms;
     size_t num_terms;
     char *term_data;
     size_t term_data_len;
+
+    bool mapped;
 };
 
+static void unmap_file(void *p, size_t len) {
+    if(p && len)
+        munmap(p, len);
+}
+
 void ac_search_builder_image_destroy(ac_search_builder_image_t *h) {
-    ac_free(h->gbls);
-    ac_free(h->gbl_data);
-    ac_free(h->term_idx);
-    ac_free(h->terms);
-    ac_free(h->term_data);
+    if(h->mapped) {
+        unmap_file(h->gbl_idx, h->gbl_idx_len);
+        unmap_file(h->gbl_data, h->gbl_data_len);
+        unmap_file(h->term_idx, h->term_idx_len);
+        unmap_file(h->term_offs, h->term_offs_len);
+        unmap_file(h->term_data, h->term_data_len);
+    }
+    else {
+        ac_free(h->gbl_idx);
+        ac_free(h->gbl_data);
+        ac_free(h->term_idx);
+        ac_free(h->term_data);
+    }
+    if(h->terms)
+        ac_free(h->terms);
     ac_free(h);
 }
 
 const void * ac_search_builder_image_global(ac_search_builder_image_t *h, uint32_t gid) {
-    return h->gbls[gid];
+    if(gid >= h->num_gbls || !h->gbl_idx[gid])
+        return NULL;
+    return h->gbl_data + h->gbl_idx[gid];
 }
 
-ac_search_builder_image_t *ac_search_builder_image_init(const char *base) {
-    char *p, *ep, **wp;
-    size_t filename_len = strlen(base)+50;
-    char *filename = (char *)ac_malloc(filename_len);
-    ac_search_builder_image_t *h = (ac_search_builder_image_t *)ac_calloc(sizeof(*h));
-
-    size_t len = 0;
-    snprintf(filename, filename_len, "%s_gbl_idx", base );
-    size_t *gbl_idx = (size_t *)ac_io_read_file(&len, filename);
-    len /= sizeof(size_t);
-
-    h->gbls = (void **)ac_calloc(sizeof(void *) * len);
-    h->num_gbls = len;
+/* maps the whole file read only and shared so that multiple processes opening
+   the same image share the page cache.  An empty or missing file yields NULL. */
+static void *map_file(size_t *len, const char *filename, int advice) {
+    *len = 0;
+    int fd = open(filename, O_RDONLY);
+    if(fd == -1)
+        return NULL;
 
-    snprintf(filename, filename_len, "%s_gbl", base );
-    h->gbl_data = (char *)ac_io_read_file(&h->gbl_data_len, filename);
-    for( size_t i=0; i<len; i++ ) {
-        if(gbl_idx[i] > 0)
-            h->gbls[i] = (void *)(h->gbl_data + gbl_idx[i]);
+    struct stat st;
+    if(fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return NULL;
     }
-    ac_free(gbl_idx);
+    void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(p == MAP_FAILED)
+        return NULL;
+    madvise(p, st.st_size, advice);
+    *len = st.st_size;
+    return p;
+}
 
-    snprintf(filename, filename_len, "%s_term_idx", base );
-    h->term_idx = (char *)ac_io_read_file(&h->term_idx_len, filename);
+/* true if offs is the start of a whole entry (term, offset, max_term_size)
+   in the term index */
+static bool valid_term_offset(ac_search_builder_image_t *h, size_t offs) {
+    if(offs >= h->term_idx_len)
+        return false;
+    char *p = (char *)memchr(h->term_idx+offs, 0, h->term_idx_len-offs);
+    return p && (size_t)(h->term_idx_len - (p+1-h->term_idx)) >= sizeof(size_t) + sizeof(uint32_t);
+}
+
+/* walk the term index to build the terms array (images written before
+   _term_offs existed or with a table that doesn't match the index) */
+static void walk_terms(ac_search_builder_image_t *h) {
+    char *p = h->term_idx;
+    char *ep = p+h->term_idx_len;
+    char **wp;
     h->num_terms = 0;
-    p = h->term_idx;
-    ep = p+h->term_idx_len;
     while(p < ep) {
         h->num_terms++;
         p += strlen(p) + 1;
         p += sizeof(size_t) + sizeof(uint32_t); // offset + max_term_size
     }
 
-    h->terms = (char **)ac_calloc(sizeof(char *) * h->num_terms);
+    h->terms = (char **)ac_calloc(sizeof(char *) * (h->num_terms+1));
     wp = h->terms;
     p = h->term_idx;
     while(p < ep) {
@@ -420,13 +857,101 @@ ac_search_builder_image_t *ac_search_builder_image_init(const char *base) {
         p += strlen(p) + 1;
         p += sizeof(size_t) + sizeof(uint32_t);
     }
+}
+
+/* Mapped images search the _term_offs table in place, so opening one doesn't
+   touch every term.  Only the first and last offsets are checked here,
+   lookups check each offset they visit.  Images read into the heap still
+   build the terms array (which term/eterm point into). */
+static void index_terms(ac_search_builder_image_t *h, const char *filename) {
+    h->num_terms = 0;
+    if(!h->term_idx)
+        return;
+
+    if(h->mapped)
+        h->term_offs = (size_t *)map_file(&h->term_offs_len, filename, MADV_RANDOM);
+    else
+        h->term_offs = (size_t *)ac_io_read_file(&h->term_offs_len, filename);
+
+    size_t num_terms = h->term_offs_len / sizeof(size_t);
+    if(!h->term_offs || !num_terms || (h->term_offs_len % sizeof(size_t)) ||
+       h->term_offs[0] != 0 || !valid_term_offset(h, h->term_offs[num_terms-1])) {
+        if(h->term_offs) {
+            if(h->mapped)
+                unmap_file(h->term_offs, h->term_offs_len);
+            else
+                ac_free(h->term_offs);
+        }
+        h->term_offs = NULL;
+        h->term_offs_len = 0;
+        walk_terms(h);
+        return;
+    }
+
+    h->num_terms = num_terms;
+    if(h->mapped)
+        return;
+
+    h->terms = (char **)ac_calloc(sizeof(char *) * (h->num_terms+1));
+    for( size_t i=0; i<h->num_terms; i++ ) {
+        if(!valid_term_offset(h, h->term_offs[i])) {
+            ac_free(h->terms);
+            h->terms = NULL;
+            walk_terms(h);
+            break;
+        }
+        h->terms[i] = h->term_idx + h->term_offs[i];
+    }
+    ac_free(h->term_offs);
+    h->term_offs = NULL;
+    h->term_offs_len = 0;
+}
+
+static ac_search_builder_image_t *image_init(const char *base, bool mapped) {
+    size_t filename_len = strlen(base)+50;
+    char *filename = (char *)ac_malloc(filename_len);
+    ac_search_builder_image_t *h = (ac_search_builder_image_t *)ac_calloc(sizeof(*h));
+    h->mapped = mapped;
+
+    snprintf(filename, filename_len, "%s_gbl_idx", base );
+    if(mapped)
+        h->gbl_idx = (size_t *)map_file(&h->gbl_idx_len, filename, MADV_WILLNEED);
+    else
+        h->gbl_idx = (size_t *)ac_io_read_file(&h->gbl_idx_len, filename);
+    h->num_gbls = h->gbl_idx_len / sizeof(size_t);
+
+    snprintf(filename, filename_len, "%s_gbl", base );
+    if(mapped)
+        h->gbl_data = (char *)map_file(&h->gbl_data_len, filename, MADV_RANDOM);
+    else
+        h->gbl_data = (char *)ac_io_read_file(&h->gbl_data_len, filename);
+
+    snprintf(filename, filename_len, "%s_term_idx", base );
+    if(mapped)
+        h->term_idx = (char *)map_file(&h->term_idx_len, filename, MADV_RANDOM);
+    else
+        h->term_idx = (char *)ac_io_read_file(&h->term_idx_len, filename);
+
+    snprintf(filename, filename_len, "%s_term_offs", base );
+    index_terms(h, filename);
 
     snprintf(filename, filename_len, "%s_term_data", base );
-    h->term_data = (char *)ac_io_read_file(&h->term_data_len, filename);
+    if(mapped)
+        h->term_data = (char *)map_file(&h->term_data_len, filename, MADV_NORMAL);
+    else
+        h->term_data = (char *)ac_io_read_file(&h->term_data_len, filename);
     ac_free(filename);
     return h;
 }
 
+ac_search_builder_image_t *ac_search_builder_image_init(const char *base) {
+    return image_init(base, false);
+}
+
+ac_search_builder_image_t *ac_search_builder_image_map(const char *base) {
+    return image_init(base, true);
+}
+
 static inline int compare_strings(const char *key, const char **v) {
     return strcmp(key, *v);
 }
@@ -484,13 +1009,7 @@ static inline void advance_group(ac_search_builder_image_term_t *t)
        value of 6 if 2 byte unsigned value
        value of 7 if 4 byte int value
 */
-static inline void advance_id(ac_search_builder_image_term_t *t) {
-    uint8_t *p = t->p;
-    uint16_t id = (*(uint16_t *)p);
-    p += 2;
-    uint32_t control = id & 0xF;
-    t->id = id >> 4;
-    t->id += t->gid;
+static inline uint8_t *read_payload(ac_search_builder_image_term_t *t, uint8_t *p, uint32_t control) {
     if(control & 0x8) {
         t->value = 0;
         control -= 8;
@@ -501,7 +1020,6 @@ static inline void advance_id(ac_search_builder_image_term_t *t) {
         control++;
         t->wp = p;
         p += control;
-        t->p = p;
     }
     else {
         if(control < 5)
@@ -518,13 +1036,181 @@ static inline void advance_id(ac_search_builder_image_term_t *t) {
             t->value = (*(int32_t *)p);
             p += 4;
         }
-        t->p = p;
         t->wp = p;
     }
+    return p;
+}
+
+static inline uint8_t *skip_payload(uint8_t *p, uint32_t control) {
+    if(control & 0x8) {
+        control -= 8;
+        if(!control) {
+            control = (*(uint32_t *)p);
+            p += 4;
+        }
+        return p + control + 1;
+    }
+    if(control < 5)
+        return p;
+    else if(control == 5)
+        return p + 1;
+    else if(control == 6)
+        return p + 2;
+    return p + 4;
+}
+
+static inline void advance_id(ac_search_builder_image_term_t *t) {
+    uint8_t *p = t->p;
+    uint16_t id = (*(uint16_t *)p);
+    p += 2;
+    t->id = id >> 4;
+    t->id += t->gid;
+    t->p = read_payload(t, p, id & 0xF);
+}
+
+#ifndef AC_SEARCH_BUILDER_SSE2
+/* block format (see BLOCK_IDS) */
+static void unpack_ids_scalar(uint32_t *ids, const uint8_t *p, uint32_t bits, uint32_t prev) {
+    const uint32_t *words = (const uint32_t *)p;
+    uint64_t mask = (1ULL << bits) - 1;
+    for( uint32_t i=0; i<BLOCK_IDS; i++ ) {
+        uint32_t lane = i & (BLOCK_LANES-1);
+        uint32_t offs = (i / BLOCK_LANES) * bits;
+        uint32_t w = offs >> 5;
+        uint64_t v = words[(w*BLOCK_LANES)+lane];
+        v |= ((uint64_t)words[((w+1)*BLOCK_LANES)+lane]) << 32;
+        prev += (uint32_t)((v >> (offs & 31)) & mask) + 1;
+        ids[i] = prev;
+    }
+}
+#else
+/* each vector of words holds the next bits of four consecutive gaps, so one
+   shift (and an or when a gap straddles two words) unpacks four ids */
+static void unpack_ids_sse2(uint32_t *ids, const uint8_t *p, uint32_t bits, uint32_t prev) {
+    const __m128i *in = (const __m128i *)p;
+    __m128i mask = _mm_set1_epi32(bits < 32 ? (1U << bits) - 1 : 0xFFFFFFFF);
+    __m128i one = _mm_set1_epi32(1);
+    __m128i base = _mm_set1_epi32(prev);
+    __m128i cur = _mm_loadu_si128(in++);
+    uint32_t shift = 0;
+    for( uint32_t i=0; i<BLOCK_IDS; i+=BLOCK_LANES ) {
+        __m128i v = _mm_srl_epi32(cur, _mm_cvtsi32_si128(shift));
+        shift += bits;
+        if(shift >= 32) {
+            shift -= 32;
+            cur = _mm_loadu_si128(in++);
+            if(shift)
+                v = _mm_or_si128(v, _mm_sll_epi32(cur, _mm_cvtsi32_si128(bits - shift)));
+        }
+        v = _mm_add_epi32(_mm_and_si128(v, mask), one);
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 4));
+        v = _mm_add_epi32(v, _mm_slli_si128(v, 8));
+        v = _mm_add_epi32(v, base);
+        _mm_storeu_si128((__m128i *)(ids + i), v);
+        base = _mm_shuffle_epi32(v, 0xFF);
+    }
+}
+#endif
+
+static inline void unpack_ids(uint32_t *ids, const uint8_t *p, uint32_t bits, uint32_t prev) {
+#ifdef AC_SEARCH_BUILDER_SSE2
+    unpack_ids_sse2(ids, p, bits, prev);
+#else
+    unpack_ids_scalar(ids, p, bits, prev);
+#endif
+}
+
+static void decode_block(ac_search_builder_image_term_t *t, uint32_t block) {
+    uint8_t *p = t->blocks + t->skip[(block*2)+1];
+    uint32_t bits = p[0];
+    bool has_controls = p[1] & 1;
+    p += 2;
+    unpack_ids(t->block_ids, p, bits, block ? t->skip[(block-1)*2] : (uint32_t)-1);
+    p += bits * BLOCK_LANES * sizeof(uint32_t);
+    if(has_controls) {
+        t->controls = p;
+        p += BLOCK_IDS / 2;
+    }
+    else
+        t->controls = NULL;
+    t->p = p;
+    t->payload_idx = 0;
+    t->block = block + 1;
+    t->block_size = t->block < t->num_blocks ? BLOCK_IDS : t->num_ids - (block * BLOCK_IDS);
+}
+
+static inline uint32_t block_control(ac_search_builder_image_term_t *t, uint32_t idx) {
+    return (t->controls[idx >> 1] >> ((idx & 1) << 2)) & 0xF;
+}
+
+static inline void block_position(ac_search_builder_image_term_t *t, uint32_t idx) {
+    uint8_t *p = t->p;
+    if(t->controls) {
+        while(t->payload_idx < idx) {
+            p = skip_payload(p, block_control(t, t->payload_idx));
+            t->payload_idx++;
+        }
+        p = read_payload(t, p, block_control(t, idx));
+    }
+    else {
+        t->value = 0;
+        t->wp = p;
+    }
+    t->p = p;
+    t->payload_idx = idx + 1;
+    t->idx = idx;
+    t->id = t->block_ids[idx];
+}
+
+static bool advance_block(ac_search_builder_image_term_t *t) {
+    if(t->idx + 1 < t->block_size) {
+        block_position(t, t->idx + 1);
+        return true;
+    }
+    if(t->block >= t->num_blocks)
+        return false;
+    decode_block(t, t->block);
+    block_position(t, 0);
+    return true;
+}
+
+static bool advance_block_to(ac_search_builder_image_term_t *t, uint32_t id) {
+    uint32_t low;
+    if(t->block_size && t->block_ids[t->block_size-1] >= id)
+        low = t->idx + 1;
+    else {
+        /* first block whose last id is >= id */
+        uint32_t lo = t->block;
+        uint32_t hi = t->num_blocks;
+        while(lo < hi) {
+            uint32_t mid = lo + ((hi - lo) >> 1);
+            if(t->skip[mid*2] < id)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if(lo >= t->num_blocks)
+            return false;
+        decode_block(t, lo);
+        low = 0;
+    }
+    uint32_t high = t->block_size - 1;
+    while(low < high) {
+        uint32_t mid = low + ((high - low) >> 1);
+        if(t->block_ids[mid] < id)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    block_position(t, low);
+    return true;
 }
 
 bool ac_search_builder_image_advance(ac_search_builder_image_term_t *t)
 {
+    if(t->block_ids)
+        return advance_block(t);
+
     if(t->p >= t->ep)
     {
         if(t->gp >= t->egp)
@@ -540,6 +1226,9 @@ bool ac_search_builder_image_advance_to(ac_search_builder_image_term_t *t, uint3
     if(id <= t->id)
         return true;
 
+    if(t->block_ids)
+        return advance_block_to(t, id);
+
     uint32_t gid = id & 0xffff000;
     if(t->gid < gid) {
         while(t->gid < gid) {
@@ -571,8 +1260,7 @@ bool ac_search_builder_image_advance_to(ac_search_builder_image_term_t *t, uint3
     return true;
 }
 
-void ac_search_builder_fill_term(ac_search_builder_image_t *img, ac_pool_t *pool, ac_search_builder_image_term_t *r, char **termp) {
-    char *p = *termp;
+static void fill_term(ac_search_builder_image_t *img, ac_pool_t *pool, ac_search_builder_image_term_t *r, char *p) {
     p = p + strlen(p) + 1;
     size_t offs = (*(size_t *)p);
     p += sizeof(offs);
@@ -588,31 +1276,86 @@ void ac_search_builder_fill_term(ac_search_builder_image_t *img, ac_pool_t *pool
     r->wp = NULL;
     r->value = 0;
 
+    r->block_ids = NULL;
+    r->controls = NULL;
+    r->block = 0;
+    r->block_size = 0;
+    r->idx = 0;
+    r->payload_idx = 0;
+    if(max_term_size & BLOCK_FORMAT) {
+        max_term_size &= ~BLOCK_FORMAT;
+        uint32_t *hdr = (uint32_t *)r->gp;
+        r->num_ids = hdr[0];
+        r->num_blocks = hdr[1];
+        r->skip = hdr + 2;
+        r->blocks = (uint8_t *)(r->skip + (r->num_blocks * 2));
+        r->block_ids = (uint32_t *)ac_pool_alloc(pool, sizeof(uint32_t) * BLOCK_IDS);
+    }
+
     r->max_term_size = max_term_size;
     r->term_pos = (ac_search_builder_image_term_pos_t *)ac_pool_alloc(pool, sizeof(ac_search_builder_image_term_pos_t) * (max_term_size+1));
     r->num_term_pos = 0;
 
+    r->term = NULL;
+    r->eterm = NULL;
+}
+
+void ac_search_builder_fill_term(ac_search_builder_image_t *img, ac_pool_t *pool, ac_search_builder_image_term_t *r, char **termp) {
+    fill_term(img, pool, r, *termp);
     r->term = termp;
     r->eterm = img->terms+img->num_terms;
 }
 
-bool ac_search_builder_image_term(ac_search_builder_image_t *img, ac_pool_t *pool, ac_search_builder_image_term_t *r, const char *term) {
-    char **termp = search_strings(term, (const char **)img->terms, img->num_terms);
-    if(!termp) {
-        if(term && term[0] && term[strlen(term)-1] == '*') {
-            char *t = ac_pool_strdup(pool, term);
-            t[strlen(t)-1] = 0;
-            termp = search_strings(t, (const char **)img->terms, img->num_terms);
-            if(!termp)
-                return false;
-        }
+/* binary search of the mapped _term_offs table, an offset which doesn't
+   point at an entry in the term index ends the search */
+static char *search_term_offs(ac_search_builder_image_t *img, const char *term) {
+    size_t lo = 0;
+    size_t hi = img->num_terms;
+    while(lo < hi) {
+        size_t mid = lo + ((hi-lo) >> 1);
+        size_t offs = img->term_offs[mid];
+        if(!valid_term_offset(img, offs))
+            return NULL;
+        char *p = img->term_idx + offs;
+        int n = strcmp(term, p);
+        if(!n)
+            return p;
+        if(n < 0)
+            hi = mid;
         else
+            lo = mid+1;
+    }
+    return NULL;
+}
+
+static bool find_term(ac_search_builder_image_t *img, ac_pool_t *pool, ac_search_builder_image_term_t *r, const char *term) {
+    if(img->terms) {
+        char **termp = search_strings(term, (const char **)img->terms, img->num_terms);
+        if(!termp)
             return false;
+        ac_search_builder_fill_term(img, pool, r, termp);
+        return true;
     }
-    ac_search_builder_fill_term(img, pool, r, termp);
+    if(!img->term_offs)
+        return false;
+    char *p = search_term_offs(img, term);
+    if(!p)
+        return false;
+    fill_term(img, pool, r, p);
     return true;
 }
 
+bool ac_search_builder_image_term(ac_search_builder_image_t *img, ac_pool_t *pool, ac_search_builder_image_term_t *r, const char *term) {
+    if(find_term(img, pool, r, term))
+        return true;
+    if(term && term[0] && term[strlen(term)-1] == '*') {
+        char *t = ac_pool_strdup(pool, term);
+        t[strlen(t)-1] = 0;
+        return find_term(img, pool, r, t);
+    }
+    return false;
+}
+
 uint32_t ac_search_builder_cursor_advance(ac_search_builder_cursor_t *c)
 {
     if(ac_search_builder_image_advance(&c->term)) {
@@ -2,70 +2,127 @@
 
 #include "the-macro-library/macro_sort.h"
 
+#include <float.h>
+
 static inline bool compare_ac_top_n_item(const ac_top_n_item_t *a, const ac_top_n_item_t *b) {
   if(a->weight != b->weight)
-    return (a->weight < b->weight) ? 1 : -1; // descending
+    return a->weight > b->weight; // descending
   return a->id < b->id;
 }
 
 static inline macro_sort(sort_ac_top_n_item, ac_top_n_item_t, compare_ac_top_n_item);
 
+/* Items are appended to a buffer of 2*size.  When it fills, a quickselect
+   moves the best size items to the front (in no particular order) and the
+   worst of those becomes the threshold, so each overflow costs O(size) and
+   most adds after the first are rejected by a single compare. */
 struct ac_top_n_s {
     ac_top_n_item_t *iw;
-    ac_top_n_item_t *split;
     ac_top_n_item_t *p;
     ac_top_n_item_t *ep;
+    uint32_t size;
+    ac_top_n_item_t worst;
 };
 
 ac_top_n_t *ac_top_n_init(ac_pool_t *pool, uint32_t size) {
-    size = size * 2;
     ac_top_n_t *t = (ac_top_n_t *)ac_pool_calloc(pool, sizeof(*t));
-    t->iw = (ac_top_n_item_t *)ac_pool_alloc(pool, sizeof(ac_top_n_item_t) * size);
-    t->p = t->iw;
-    t->split = t->ep = t->iw + size;
+    t->iw = (ac_top_n_item_t *)ac_pool_alloc(pool, sizeof(ac_top_n_item_t) * size * 2);
+    t->ep = t->iw + (size * 2);
+    t->size = size;
+    ac_top_n_reset(t);
     return t;
 }
 
-void ac_top_n_clear(ac_top_n_t *top) {
-    top->split = top->ep;
+void ac_top_n_reset(ac_top_n_t *top) {
     top->p = top->iw;
+    top->worst.id = 0xFFFFFFFF;
+    top->worst.weight = -DBL_MAX;
 }
 
-void ac_top_n_add(ac_top_n_t *top, uint32_t id, double weight) {
-    if(top->p < top->split) {
-        ac_top_n_item_t *iw = top->p;
-        iw->id = id;
-        iw->weight = weight;
-        top->p++;
-    }
-    else {
-        if(top->p < top->ep) {
-            if(weight > top->split->weight) {
-                ac_top_n_item_t *iw = top->p;
-                iw->id = id;
-                iw->weight = weight;
-                top->p++;
-            }
-        }
-        else {
-            if(top->split == top->ep) {
-                // sort everything
-                sort_ac_top_n_item(top->iw, top->ep-top->iw);
-                top->split = top->iw + ((top->ep-top->iw) / 2);
-            }
-            else {
-                // an optimization could be to sort the second half and merge
-                // for now just sort everything
-                sort_ac_top_n_item(top->iw, top->ep-top->iw);
+static inline void swap_item(ac_top_n_item_t *a, ac_top_n_item_t *b) {
+    ac_top_n_item_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+/* rearrange base so that base[k] is the item which sorts to position k and
+   everything before it sorts before (or equal to) it */
+static void select_ac_top_n_item(ac_top_n_item_t *base, size_t num, size_t k) {
+    size_t lo = 0;
+    size_t hi = num - 1;
+    while(hi > lo) {
+        size_t mid = lo + ((hi - lo) >> 1);
+        if(compare_ac_top_n_item(base + mid, base + lo))
+            swap_item(base + mid, base + lo);
+        if(compare_ac_top_n_item(base + hi, base + lo))
+            swap_item(base + hi, base + lo);
+        if(compare_ac_top_n_item(base + hi, base + mid))
+            swap_item(base + hi, base + mid);
+        ac_top_n_item_t pivot = base[mid];
+
+        size_t i = lo;
+        size_t j = hi;
+        while(i <= j) {
+            while(compare_ac_top_n_item(base + i, &pivot))
+                i++;
+            while(compare_ac_top_n_item(&pivot, base + j))
+                j--;
+            if(i <= j) {
+                swap_item(base + i, base + j);
+                i++;
+                if(!j)
+                    break;
+                j--;
             }
-            top->p = top->split;
         }
+        if(k <= j)
+            hi = j;
+        else if(k >= i)
+            lo = i;
+        else
+            return;
+    }
+}
+
+void ac_top_n_add(ac_top_n_t *top, uint32_t id, double weight) {
+    if(weight < top->worst.weight)
+        return;
+    /* equal weights only displace a larger id */
+    if(weight == top->worst.weight && id > top->worst.id)
+        return;
+
+    ac_top_n_item_t item;
+    item.id = id;
+    item.weight = weight;
+    if(top->p == top->ep) {
+        if(!top->size)
+            return;
+        select_ac_top_n_item(top->iw, top->ep - top->iw, top->size - 1);
+        top->worst = top->iw[top->size - 1];
+        top->p = top->iw + top->size;
+        if(!compare_ac_top_n_item(&item, &top->worst))
+            return;
+    }
+    *top->p++ = item;
+}
+
+double ac_top_n_threshold(ac_top_n_t *top) {
+    return top->worst.weight;
+}
+
+void ac_top_n_merge(ac_top_n_t *dest, ac_top_n_t *src) {
+    ac_top_n_item_t *p = src->iw;
+    ac_top_n_item_t *ep = src->p;
+    while(p < ep) {
+        ac_top_n_add(dest, p->id, p->weight);
+        p++;
     }
 }
 
 ac_top_n_item_t *ac_top_n_finish(ac_top_n_item_t **ep, ac_top_n_t *top) {
-    sort_ac_top_n_item(top->iw, top->p-top->iw);
+    sort_ac_top_n_item(top->iw, top->p - top->iw);
+    if(top->p > top->iw + top->size)
+        top->p = top->iw + top->size;
     *ep = top->p;
     return top->iw;
 }
-